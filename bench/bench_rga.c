@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Deterministic CPU stand-in for librga, so the pipeline can be replayed on
+ * a host. Nearest-neighbour scaling, 90/180/270 rotation and conversion
+ * between the NV12/NV16/RGB/BGR/RGBA formats rkfacial uses.
+ *
+ * Buffers are memfds, turned into real dma-bufs through /dev/udmabuf when
+ * the host has it, and a blit by fd maps the fd itself so the fd paths are
+ * exercised without any address behind them.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/udmabuf.h>
+#include <rga/RgaApi.h>
+
+#define CLIP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
+
+int c_RkRgaInit(void)
+{
+    return 0;
+}
+
+unsigned int bench_rga_fd_blits;
+unsigned int bench_rga_addr_blits;
+
+/* returns a dma-buf, or the memfd when udmabuf is missing, mapped at *ptr */
+int bench_rga_buffer(size_t size, void **ptr)
+{
+    struct udmabuf_create create;
+    long page = sysconf(_SC_PAGESIZE);
+    int memfd, dev, fd;
+
+    size = (size + page - 1) / page * page;
+    memfd = memfd_create("bench_rga", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+    if (memfd < 0)
+        return -1;
+    if (ftruncate(memfd, size) || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK)) {
+        close(memfd);
+        return -1;
+    }
+    fd = memfd;
+    dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev >= 0) {
+        memset(&create, 0, sizeof(create));
+        create.memfd = memfd;
+        create.flags = UDMABUF_FLAGS_CLOEXEC;
+        create.size = size;
+        fd = ioctl(dev, UDMABUF_CREATE, &create);
+        close(dev);
+        if (fd >= 0)
+            close(memfd);
+        else
+            fd = memfd;
+    }
+    *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (*ptr == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void bench_rga_buffer_free(int fd, void *ptr)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+
+    if (ptr && size > 0)
+        munmap(ptr, size);
+    close(fd);
+}
+
+static int bench_rga_alloc(bo_t *bo_info, int width, int height, int bpp)
+{
+    bo_info->size = (size_t)width * height * bpp / 8;
+    bo_info->fd = bench_rga_buffer(bo_info->size, &bo_info->ptr);
+    if (bo_info->fd < 0) {
+        bo_info->ptr = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    bo_info->offset = 0;
+    bo_info->handle = 0;
+    bo_info->pitch = width * bpp / 8;
+    return 0;
+}
+
+int c_RkRgaGetAllocBuffer(bo_t *bo_info, int width, int height, int bpp)
+{
+    return bench_rga_alloc(bo_info, width, height, bpp);
+}
+
+int c_RkRgaGetAllocBufferCache(bo_t *bo_info, int width, int height, int bpp)
+{
+    return bench_rga_alloc(bo_info, width, height, bpp);
+}
+
+int c_RkRgaGetMmap(bo_t *bo_info)
+{
+    return bo_info->ptr ? 0 : -1;
+}
+
+int c_RkRgaUnmap(bo_t *bo_info)
+{
+    return 0;
+}
+
+int c_RkRgaFree(bo_t *bo_info)
+{
+    if (bo_info->fd >= 0)
+        bench_rga_buffer_free(bo_info->fd, bo_info->ptr);
+    bo_info->fd = -1;
+    bo_info->ptr = NULL;
+    bo_info->size = 0;
+    return 0;
+}
+
+int c_RkRgaGetBufferFd(bo_t *bo_info, int *fd)
+{
+    *fd = dup(bo_info->fd);
+    return *fd < 0 ? -1 : 0;
+}
+
+int rga_set_rect(rga_rect_t *rect, int x, int y, int w, int h, int sw, int sh, int f)
+{
+    if (!rect)
+        return -EINVAL;
+
+    rect->xoffset = x;
+    rect->yoffset = y;
+    rect->width = w;
+    rect->height = h;
+    rect->wstride = sw;
+    rect->hstride = sh;
+    rect->format = f;
+    return 0;
+}
+
+static inline void rga_read(rga_info_t *info, int x, int y, int *r, int *g, int *b)
+{
+    rga_rect_t *rect = &info->rect;
+    unsigned char *p = (unsigned char *)info->virAddr;
+    unsigned char *uv = p + rect->wstride * rect->hstride;
+    int yy, u, v;
+
+    x += rect->xoffset;
+    y += rect->yoffset;
+    switch (rect->format) {
+    case RK_FORMAT_RGB_888:
+        p += (y * rect->wstride + x) * 3;
+        *r = p[0]; *g = p[1]; *b = p[2];
+        return;
+    case RK_FORMAT_BGR_888:
+        p += (y * rect->wstride + x) * 3;
+        *r = p[2]; *g = p[1]; *b = p[0];
+        return;
+    case RK_FORMAT_RGBA_8888:
+        p += (y * rect->wstride + x) * 4;
+        *r = p[0]; *g = p[1]; *b = p[2];
+        return;
+    case RK_FORMAT_BGRA_8888:
+        p += (y * rect->wstride + x) * 4;
+        *r = p[2]; *g = p[1]; *b = p[0];
+        return;
+    case RK_FORMAT_YUYV_422:
+        p += y * rect->wstride * 2 + (x & ~1) * 2;
+        yy = p[(x & 1) * 2];
+        u = p[1];
+        v = p[3];
+        break;
+    case RK_FORMAT_YCbCr_422_SP:
+        yy = p[y * rect->wstride + x];
+        uv += y * rect->wstride + (x & ~1);
+        u = uv[0];
+        v = uv[1];
+        break;
+    case RK_FORMAT_YCrCb_420_SP:
+    case RK_FORMAT_YCbCr_420_SP:
+    default:
+        yy = p[y * rect->wstride + x];
+        uv += (y / 2) * rect->wstride + (x & ~1);
+        u = uv[rect->format == RK_FORMAT_YCrCb_420_SP];
+        v = uv[rect->format != RK_FORMAT_YCrCb_420_SP];
+        break;
+    }
+    yy -= 16;
+    u -= 128;
+    v -= 128;
+    *r = CLIP((298 * yy + 409 * v + 128) >> 8);
+    *g = CLIP((298 * yy - 100 * u - 208 * v + 128) >> 8);
+    *b = CLIP((298 * yy + 516 * u + 128) >> 8);
+}
+
+static inline void rga_write(rga_info_t *info, int x, int y, int r, int g, int b)
+{
+    rga_rect_t *rect = &info->rect;
+    unsigned char *p = (unsigned char *)info->virAddr;
+    unsigned char *uv = p + rect->wstride * rect->hstride;
+
+    x += rect->xoffset;
+    y += rect->yoffset;
+    switch (rect->format) {
+    case RK_FORMAT_RGB_888:
+        p += (y * rect->wstride + x) * 3;
+        p[0] = r; p[1] = g; p[2] = b;
+        return;
+    case RK_FORMAT_BGR_888:
+        p += (y * rect->wstride + x) * 3;
+        p[0] = b; p[1] = g; p[2] = r;
+        return;
+    case RK_FORMAT_RGBA_8888:
+        p += (y * rect->wstride + x) * 4;
+        p[0] = r; p[1] = g; p[2] = b; p[3] = 0xff;
+        return;
+    case RK_FORMAT_BGRA_8888:
+        p += (y * rect->wstride + x) * 4;
+        p[0] = b; p[1] = g; p[2] = r; p[3] = 0xff;
+        return;
+    default:
+        break;
+    }
+
+    p[y * rect->wstride + x] = CLIP(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    if ((x & 1) || (rect->format != RK_FORMAT_YCbCr_422_SP && (y & 1)))
+        return;
+    if (rect->format == RK_FORMAT_YCbCr_422_SP)
+        uv += y * rect->wstride + x;
+    else
+        uv += (y / 2) * rect->wstride + x;
+    uv[0] = CLIP(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    uv[1] = CLIP(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+static int bench_rga_blit(rga_info_t *src, rga_info_t *dst)
+{
+    int sw = src->rect.width;
+    int sh = src->rect.height;
+    int dw = dst->rect.width;
+    int dh = dst->rect.height;
+    int rot = src->rotation;
+    int swap = rot == HAL_TRANSFORM_ROT_90 || rot == HAL_TRANSFORM_ROT_270;
+    int *col;
+    int r, g, b;
+
+    if (!src->virAddr || !dst->virAddr || sw <= 0 || sh <= 0 || dw <= 0 || dh <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    col = (int *)malloc(dw * sizeof(int));
+    if (!col) {
+        errno = ENOMEM;
+        return -1;
+    }
+    /* position in the rotated source, mapped back to source space below */
+    for (int x = 0; x < dw; x++)
+        col[x] = swap ? x * sh / dw : x * sw / dw;
+
+    for (int y = 0; y < dh; y++) {
+        int v = swap ? y * sw / dh : y * sh / dh;
+
+        for (int x = 0; x < dw; x++) {
+            int u = col[x];
+            int sx, sy;
+
+            switch (rot) {
+            case HAL_TRANSFORM_ROT_90:
+                sx = v;
+                sy = sh - 1 - u;
+                break;
+            case HAL_TRANSFORM_ROT_180:
+                sx = sw - 1 - u;
+                sy = sh - 1 - v;
+                break;
+            case HAL_TRANSFORM_ROT_270:
+                sx = sw - 1 - v;
+                sy = u;
+                break;
+            default:
+                sx = u;
+                sy = v;
+                break;
+            }
+            rga_read(src, sx, sy, &r, &g, &b);
+            rga_write(dst, x, y, r, g, b);
+        }
+    }
+    free(col);
+
+    return 0;
+}
+
+/* like the driver, an fd wins over the address */
+static void *bench_rga_map(rga_info_t *info, size_t *size)
+{
+    off_t end;
+    void *p;
+
+    *size = 0;
+    if (info->fd < 0)
+        return info->virAddr;
+    end = lseek(info->fd, 0, SEEK_END);
+    if (end <= 0)
+        return NULL;
+    p = mmap(NULL, end, PROT_READ | PROT_WRITE, MAP_SHARED, info->fd, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    *size = end;
+    return p;
+}
+
+int c_RkRgaBlit(rga_info_t *src, rga_info_t *dst, rga_info_t *src1)
+{
+    rga_info_t s = *src, d = *dst;
+    size_t src_size, dst_size;
+    int ret;
+
+    s.virAddr = bench_rga_map(src, &src_size);
+    d.virAddr = bench_rga_map(dst, &dst_size);
+    if (src->fd >= 0 || dst->fd >= 0)
+        __atomic_add_fetch(&bench_rga_fd_blits, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&bench_rga_addr_blits, 1, __ATOMIC_RELAXED);
+    ret = bench_rga_blit(&s, &d);
+    if (src_size)
+        munmap(s.virAddr, src_size);
+    if (dst_size)
+        munmap(d.virAddr, dst_size);
+
+    return ret;
+}
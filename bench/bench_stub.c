@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Host stand-ins for the board specific modules rockface_control.cpp calls
+ * into: audio prompts, camera exposure, display, hardware jpeg codecs and
+ * the rkfacial callbacks.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "rkfacial.h"
+#include "play_wav.h"
+#include "camrgb_control.h"
+#include "camir_control.h"
+#include "display.h"
+#include "image_read.h"
+#include "codec_pool.h"
+
+rkfacial_paint_box_callback rkfacial_paint_box_cb = NULL;
+rkfacial_paint_info_callback rkfacial_paint_info_cb = NULL;
+rkfacial_paint_face_callback rkfacial_paint_face_cb = NULL;
+
+void play_wav_signal(const char *name)
+{
+}
+
+void camrgb_control_expo_weights(int left, int top, int right, int bottom)
+{
+}
+
+void camrgb_control_expo_weights_default(void)
+{
+}
+
+bool camir_control_run(void)
+{
+    return false;
+}
+
+void display_get_resolution(int *width, int *height)
+{
+    *width = 0;
+    *height = 0;
+}
+
+#ifndef BENCH_JPEG
+int image_read(const char *path, rockface_image_t *img, bo_t *rgb_bo, int *rgb_fd)
+{
+    /* no jpeg decoder, let the caller fall back to software */
+    return -2;
+}
+
+int image_read_deinit(bo_t *rgb_bo, int *rgb_fd)
+{
+    return 0;
+}
+
+struct soft_jpeg *soft_jpeg_create(void)
+{
+    return NULL;
+}
+
+void soft_jpeg_destroy(struct soft_jpeg *j)
+{
+}
+
+int soft_jpeg_decode(struct soft_jpeg *j, const void *data, size_t size, void *nv12,
+                     int hor_stride, int ver_stride)
+{
+    return -1;
+}
+
+int soft_jpeg_encode(struct soft_jpeg *j, const void *nv12, int width, int height, int quality,
+                     void *dst, size_t dst_size, size_t *length)
+{
+    return -1;
+}
+#endif
+
+/* no VPU, the codec pool falls back to soft jpeg */
+int vpu_decode_jpeg_init(struct vpu_decode *decode, int width, int height)
+{
+    return -1;
+}
+
+int vpu_decode_jpeg_doing(struct vpu_decode *decode, void *in_data, RK_S32 in_size,
+                          int out_fd, void *out_data)
+{
+    return -1;
+}
+
+int vpu_decode_jpeg_done(struct vpu_decode *decode)
+{
+    return 0;
+}
+
+int vpu_encode_jpeg_init(struct vpu_encode *encode, int width, int height, int quant,
+                         MppFrameFormat format)
+{
+    return -1;
+}
+
+int vpu_encode_jpeg_doing(struct vpu_encode *encode, void *srcbuf, int src_fd, size_t src_size,
+                          void *dst_buf, int dst_fd, size_t dst_size)
+{
+    encode->enc_out_data = (RK_U8 *)dst_buf;
+    encode->enc_out_length = 0;
+    return 0;
+}
+
+void vpu_encode_jpeg_done(struct vpu_encode *encode)
+{
+}
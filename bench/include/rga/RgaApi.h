@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Host stand-in for the subset of librga used by rkfacial.
+ * Only used by rkfacial_bench, see bench_rga.c.
+ */
+#ifndef __BENCH_RGAAPI_H__
+#define __BENCH_RGAAPI_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    RK_FORMAT_RGBA_8888 = 0x0,
+    RK_FORMAT_RGB_888 = 0x2,
+    RK_FORMAT_BGRA_8888 = 0x3,
+    RK_FORMAT_BGR_888 = 0x7,
+    RK_FORMAT_YCbCr_422_SP = 0x8,
+    RK_FORMAT_YCbCr_420_SP = 0xa,
+    RK_FORMAT_YCrCb_420_SP = 0xe,
+    RK_FORMAT_YUYV_422 = 0x1a,
+    RK_FORMAT_UNKNOWN = 0x100,
+} RgaSURF_FORMAT;
+
+enum {
+    HAL_TRANSFORM_FLIP_H = 0x01,
+    HAL_TRANSFORM_FLIP_V = 0x02,
+    HAL_TRANSFORM_ROT_180 = 0x03,
+    HAL_TRANSFORM_ROT_90 = 0x04,
+    HAL_TRANSFORM_ROT_270 = 0x07,
+};
+
+typedef struct rga_rect {
+    int xoffset;
+    int yoffset;
+    int width;
+    int height;
+    int wstride;
+    int hstride;
+    int format;
+    int size;
+} rga_rect_t;
+
+typedef struct rga_info {
+    int fd;
+    void *virAddr;
+    void *phyAddr;
+    unsigned hnd;
+    int format;
+    rga_rect_t rect;
+    unsigned int blend;
+    int bufferSize;
+    int rotation;
+    int color;
+    int testLog;
+    int mmuFlag;
+} rga_info_t;
+
+typedef struct bo {
+    int fd;
+    void *ptr;
+    size_t size;
+    size_t offset;
+    uint32_t handle;
+    uint32_t pitch;
+} bo_t;
+
+int c_RkRgaInit(void);
+int c_RkRgaGetAllocBuffer(bo_t *bo_info, int width, int height, int bpp);
+int c_RkRgaGetAllocBufferCache(bo_t *bo_info, int width, int height, int bpp);
+int c_RkRgaGetMmap(bo_t *bo_info);
+int c_RkRgaUnmap(bo_t *bo_info);
+int c_RkRgaFree(bo_t *bo_info);
+int c_RkRgaGetBufferFd(bo_t *bo_info, int *fd);
+int c_RkRgaBlit(rga_info_t *src, rga_info_t *dst, rga_info_t *src1);
+int rga_set_rect(rga_rect_t *rect, int x, int y, int w, int h, int sw, int sh, int f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Host stand-in for the MPP types rkfacial headers refer to. The bench does
+ * not link the vpu code, it only needs the declarations to compile.
+ */
+#ifndef __BENCH_RK_MPI_H__
+#define __BENCH_RK_MPI_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+
+typedef int32_t RK_S32;
+typedef uint32_t RK_U32;
+typedef uint8_t RK_U8;
+
+typedef void *MppCtx;
+typedef void *MppPacket;
+typedef void *MppFrame;
+typedef void *MppBuffer;
+typedef void *MppBufferGroup;
+typedef struct MppApi_t MppApi;
+
+typedef enum {
+    MPP_FMT_YUV420SP = 0,
+    MPP_FMT_YUV422SP = 2,
+} MppFrameFormat;
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Host stand-in for the rockface SDK types used by rkfacial, so the
+ * pipeline and the mock backend build without the SDK. There are no
+ * functions on purpose, model calls have to go through face_backend.
+ */
+#ifndef __BENCH_ROCKFACE_H__
+#define __BENCH_ROCKFACE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void *rockface_handle_t;
+
+typedef enum {
+    ROCKFACE_RET_SUCCESS = 0,
+    ROCKFACE_RET_FAIL = -1,
+} rockface_ret_t;
+
+typedef enum {
+    ROCKFACE_PIXEL_FORMAT_GRAY8 = 0,
+    ROCKFACE_PIXEL_FORMAT_RGB888,
+    ROCKFACE_PIXEL_FORMAT_BGR888,
+} rockface_pixel_format;
+
+typedef enum {
+    ROCKFACE_RECOG_NORMAL = 0,
+    ROCKFACE_RECOG_MASK,
+} rockface_recog_type;
+
+typedef struct {
+    uint8_t *data;
+    uint32_t size;
+    rockface_pixel_format pixel_format;
+    uint32_t width;
+    uint32_t height;
+    uint8_t is_prealloc_buf;
+} rockface_image_t;
+
+typedef struct {
+    int left;
+    int top;
+    int right;
+    int bottom;
+} rockface_rect_t;
+
+typedef struct {
+    int x;
+    int y;
+} rockface_point_t;
+
+typedef struct {
+    int id;
+    rockface_rect_t box;
+    float score;
+} rockface_det_t;
+
+typedef struct {
+    int count;
+    rockface_det_t face[128];
+} rockface_det_array_t;
+
+typedef struct {
+    int image_width;
+    int image_height;
+    int landmarks_count;
+    rockface_point_t landmarks[128];
+    float score;
+} rockface_landmark_t;
+
+typedef struct {
+    float pitch;
+    float yaw;
+    float roll;
+} rockface_angle_t;
+
+typedef struct {
+    int version;
+    int len;
+    uint8_t feature[512];
+} rockface_feature_t;
+
+typedef struct {
+    int version;
+    int len;
+    float feature[512];
+} rockface_feature_float_t;
+
+typedef struct {
+    void *face_data;
+    float similarity;
+} rockface_search_result_t;
+
+typedef struct {
+    float real_score;
+    float fake_score;
+} rockface_liveness_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,647 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Offline replay benchmark: feeds recorded or synthetic frames through
+ * rockface_control_convert/_ir the way the camera threads do, and reports
+ * throughput, submit latency, queue drops and the per stage latency
+ * histograms.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef BENCH_JPEG
+#include <jpeglib.h>
+#endif
+
+#include "face_common.h"
+#include "database.h"
+#include "rkfacial.h"
+#include "rockface_control.h"
+#include "face_backend.h"
+
+#define SYNTH_FRAMES 64
+#define DRAIN_TIMEOUT_MS 5000
+
+struct bench_frame {
+    void *ptr;
+    int fd;
+};
+
+/* bench_rga.c */
+extern unsigned int bench_rga_fd_blits;
+extern unsigned int bench_rga_addr_blits;
+int bench_rga_buffer(size_t size, void **ptr);
+void bench_rga_buffer_free(int fd, void *ptr);
+
+static struct bench_frame *g_frames;
+static int g_frame_num;
+static int g_width = 1280;
+static int g_height = 720;
+static unsigned int g_boxes;
+static unsigned int g_faces;
+static unsigned int g_infos;
+
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void paint_box(int left, int top, int right, int bottom)
+{
+    __atomic_add_fetch(&g_boxes, 1, __ATOMIC_RELAXED);
+    if (right > left && bottom > top)
+        __atomic_add_fetch(&g_faces, 1, __ATOMIC_RELAXED);
+}
+
+static void paint_info(struct user_info *info, bool real)
+{
+    __atomic_add_fetch(&g_infos, 1, __ATOMIC_RELAXED);
+}
+
+static int frame_size(void)
+{
+    return g_width * g_height * 3 / 2;
+}
+
+static void *frame_add(void)
+{
+    struct bench_frame *frames;
+    void *ptr;
+
+    frames = (struct bench_frame *)realloc(g_frames, (g_frame_num + 1) * sizeof(struct bench_frame));
+    if (!frames)
+        return NULL;
+    g_frames = frames;
+    g_frames[g_frame_num].fd = bench_rga_buffer(frame_size(), &ptr);
+    if (g_frames[g_frame_num].fd < 0)
+        return NULL;
+    g_frames[g_frame_num++].ptr = ptr;
+    return ptr;
+}
+
+/* a bright square sweeping over a dark background */
+static int frame_synth(void)
+{
+    int side = g_height / 4;
+
+    for (int i = 0; i < SYNTH_FRAMES; i++) {
+        unsigned char *p = (unsigned char *)frame_add();
+        int x0 = (g_width - side) * i / SYNTH_FRAMES;
+        int y0 = (g_height - side) / 2;
+
+        if (!p)
+            return -1;
+        memset(p, 32, g_width * g_height);
+        memset(p + g_width * g_height, 128, g_width * g_height / 2);
+        for (int y = y0; y < y0 + side; y++)
+            memset(p + y * g_width + x0, 200, side);
+    }
+    return 0;
+}
+
+static int frame_load_nv12(const char *path)
+{
+    FILE *fp;
+    int ret = 0;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (1) {
+        void *ptr = frame_add();
+        if (!ptr) {
+            ret = -1;
+            break;
+        }
+        if (fread(ptr, 1, frame_size(), fp) != (size_t)frame_size()) {
+            free(ptr);
+            g_frame_num--;
+            break;
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+#ifdef BENCH_JPEG
+static int frame_load_jpeg(const char *path)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    rga_info_t src, dst;
+    unsigned char *rgb;
+    void *ptr;
+    FILE *fp;
+    int ret = -1;
+
+    fp = fopen(path, "rb");
+    if (!fp) {
+        printf("open %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, fp);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    if ((int)cinfo.output_width != g_width || (int)cinfo.output_height != g_height) {
+        printf("%s is %dx%d, expect %dx%d\n", path, cinfo.output_width, cinfo.output_height,
+               g_width, g_height);
+        jpeg_abort_decompress(&cinfo);
+        goto exit;
+    }
+    rgb = (unsigned char *)malloc(g_width * g_height * 3);
+    if (!rgb) {
+        jpeg_abort_decompress(&cinfo);
+        goto exit;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = rgb + cinfo.output_scanline * g_width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+
+    /* frames are replayed as NV12 like the camera delivers them */
+    ptr = frame_add();
+    if (ptr) {
+        memset(&src, 0, sizeof(rga_info_t));
+        src.fd = -1;
+        src.virAddr = rgb;
+        rga_set_rect(&src.rect, 0, 0, g_width, g_height, g_width, g_height, RK_FORMAT_RGB_888);
+        memset(&dst, 0, sizeof(rga_info_t));
+        dst.fd = -1;
+        dst.virAddr = ptr;
+        rga_set_rect(&dst.rect, 0, 0, g_width, g_height, g_width, g_height, RK_FORMAT_YCbCr_420_SP);
+        ret = c_RkRgaBlit(&src, &dst, NULL);
+    }
+    free(rgb);
+
+exit:
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    return ret;
+}
+#endif
+
+static int frame_load_file(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+
+    if (ext && (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg"))) {
+#ifdef BENCH_JPEG
+        return frame_load_jpeg(path);
+#else
+        printf("%s: built without jpeg support\n", path);
+        return -1;
+#endif
+    }
+    return frame_load_nv12(path);
+}
+
+static int name_cmp(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static int name_filter(const struct dirent *d)
+{
+    const char *ext = strrchr(d->d_name, '.');
+
+    if (!ext)
+        return 0;
+    return !strcasecmp(ext, ".nv12") || !strcasecmp(ext, ".yuv") ||
+           !strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg");
+}
+
+static int frame_load(const char *path)
+{
+    struct dirent **list;
+    struct stat st;
+    char name[512];
+    int num, ret = 0;
+
+    if (!path)
+        return frame_synth();
+    if (stat(path, &st)) {
+        printf("%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode))
+        return frame_load_file(path);
+
+    num = scandir(path, &list, name_filter, name_cmp);
+    if (num < 0) {
+        printf("scandir %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < num; i++) {
+        snprintf(name, sizeof(name), "%s/%s", path, list[i]->d_name);
+        if (!ret && frame_load_file(name))
+            ret = -1;
+        free(list[i]);
+    }
+    free(list);
+    return ret;
+}
+
+static void frame_free(void)
+{
+    for (int i = 0; i < g_frame_num; i++)
+        bench_rga_buffer_free(g_frames[i].fd, g_frames[i].ptr);
+    free(g_frames);
+    g_frames = NULL;
+    g_frame_num = 0;
+}
+
+/*
+ * start from an empty database, optionally holding num synthetic users,
+ * and a licence file so rockface_control_init does not wait for BAK_PATH
+ */
+static int gallery_init(int num)
+{
+    struct face_data face;
+    struct mask_data mask;
+    unsigned int seed = 1;
+    char name[NAME_LEN];
+    FILE *fp;
+
+    mkdir(PRE_PATH, 0755);
+    mkdir(BAK_PATH, 0755);
+    fp = fopen(PRE_PATH "/key.lic", "a");
+    if (!fp) {
+        printf("create licence in %s failed: %s\n", PRE_PATH, strerror(errno));
+        return -1;
+    }
+    fclose(fp);
+    /* the same library again, keep it so the boot can map the gallery file */
+    if (!access(DATABASE_PATH, F_OK) && !database_init()) {
+        int cnt = database_record_count();
+        database_exit();
+        if (cnt == num)
+            return 0;
+    }
+    unlink(DATABASE_PATH);
+    unlink(BAK_DATABASE_PATH);
+    unlink(GALLERY_PATH);
+    if (database_init())
+        return -1;
+    for (int i = 0; i < num; i++) {
+        memset(&face, 0, sizeof(face));
+        memset(&mask, 0, sizeof(mask));
+        face.feature.len = sizeof(face.feature.feature);
+        mask.feature.version = ROCKFACE_RECOG_MASK;
+        mask.feature.len = face.feature.len;
+        for (int j = 0; j < face.feature.len; j++) {
+            seed = seed * 1103515245 + 12345;
+            face.feature.feature[j] = seed >> 24;
+            mask.feature.feature[j] = (seed >> 24) / 255.0f;
+        }
+        snprintf(name, sizeof(name), "%s_%d", USER_NAME, i);
+        if (database_insert(&face.feature, sizeof(rockface_feature_t), name, NAME_LEN, i, false,
+                            &mask.feature, sizeof(rockface_feature_float_t))) {
+            database_exit();
+            return -1;
+        }
+    }
+    database_exit();
+    return 0;
+}
+
+static void enroll_progress(const struct enroll_item *item, int done, int total)
+{
+    if (done % 100 == 0 || done == total)
+        printf("enroll      : %d/%d\n", done, total);
+}
+
+/* batch enroll every image of a directory into the running library */
+static int enroll_dir(const char *path)
+{
+    struct dirent **list;
+    struct enroll_item *item;
+    char name[512];
+    long long t;
+    int num, cnt;
+
+    num = scandir(path, &list, name_filter, name_cmp);
+    if (num < 0) {
+        printf("scandir %s failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    item = (struct enroll_item *)calloc(num ? num : 1, sizeof(struct enroll_item));
+    for (int i = 0; i < num; i++) {
+        if (item) {
+            snprintf(name, sizeof(name), "%s/%s", path, list[i]->d_name);
+            item[i].path = strdup(name);
+            item[i].id = -1;
+        }
+        free(list[i]);
+    }
+    free(list);
+    if (!item)
+        return -1;
+
+    t = now_us();
+    cnt = rockface_control_add_batch(item, num, false, enroll_progress);
+    t = now_us() - t;
+    printf("enroll      : %d of %d in %.1f ms\n", cnt, num, t / 1000.0);
+
+    for (int i = 0; i < num; i++)
+        free((char *)item[i].path);
+    free(item);
+    return 0;
+}
+
+static int us_cmp(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void report(long long *lat, int num, long long elapsed, long long init)
+{
+    struct face_stage_stat stat[FACE_STAGE_NUM];
+    struct det_queue_stat queue;
+    double sec = elapsed / 1000000.0;
+    unsigned int dropped;
+
+    get_face_det_queue_stat(&queue);
+    dropped = queue.drop_newest + queue.replace_oldest;
+    qsort(lat, num, sizeof(long long), us_cmp);
+
+    printf("\n");
+    printf("init        : %.1f ms\n", init / 1000.0);
+    printf("queue       : depth %d, %s\n", queue.depth,
+           queue.policy == DET_QUEUE_REPLACE_OLDEST ? "replace-oldest" : "drop-newest");
+    printf("frames      : submitted %d, detected %u, dropped %u (drop-newest %u, replace-oldest %u)\n",
+           num, g_boxes, dropped, queue.drop_newest, queue.replace_oldest);
+    printf("results     : faces %u, user info %u\n", g_faces, g_infos);
+    printf("rga         : %u blits by fd, %u by address\n", bench_rga_fd_blits, bench_rga_addr_blits);
+    printf("throughput  : submit %.2f fps, detect %.2f fps over %.3f s\n",
+           num / sec, g_boxes / sec, sec);
+    if (num)
+        printf("submit (us) : p50 %lld, p90 %lld, p99 %lld, max %lld\n",
+               lat[num / 2], lat[num * 9 / 10], lat[num * 99 / 100], lat[num - 1]);
+
+    rockface_get_stage_stat(stat, FACE_STAGE_NUM);
+    printf("\n%-16s %8s %8s %8s %8s %8s %10s\n",
+           "stage", "count", "p50_us", "p90_us", "p99_us", "max_us", "cpu_ms");
+    for (int i = 0; i < FACE_STAGE_NUM; i++) {
+        if (!stat[i].count)
+            continue;
+        printf("%-16s %8u %8u %8u %8u %8u %10.1f\n", rockface_get_stage_name((enum face_stage)i),
+               stat[i].count, stat[i].p50_us, stat[i].p90_us, stat[i].p99_us, stat[i].max_us,
+               stat[i].cpu_us / 1000.0);
+    }
+}
+
+static void usage(const char *name)
+{
+    struct face_mock_cost cost;
+
+    face_mock_get_cost(&cost);
+    printf("usage: %s [options] [input]\n"
+           "input is a raw NV12 file, a jpeg, or a directory of .nv12/.yuv/.jpg frames;\n"
+           "synthetic frames are used when omitted\n"
+           "  -w width      frame width, default 1280\n"
+           "  -h height     frame height, default 720\n"
+           "  -n frames     frames to submit, default 300\n"
+           "  -f fps        submit rate, 0 for as fast as possible, default 0\n"
+           "  -r rotation   0, 90 or 270, default 90\n"
+           "  -q depth      detect queue depth\n"
+           "  -p policy     detect queue policy, drop or replace\n"
+           "  -j workers    detect workers\n"
+           "  -g users      synthetic users in the face library, default 0\n"
+           "  -i users      index the face library from this size, default 0 (never)\n"
+           "  -P lists      index lists probed per search\n"
+           "  -b dir        batch enroll the images of dir before the replay\n"
+           "  -k image      verify faces 1:1 against this reference image\n"
+           "  -R            convert only the face area for the feature stage\n"
+           "  -A            blit by virtual address instead of dma-buf fd\n"
+           "  -F            fused CPU conversion of the detect and feature frames\n"
+           "  -D us         simulated detect latency, default %d\n"
+           "  -L us         simulated landmark latency, default %d\n"
+           "  -E us         simulated feature extract latency, default %d\n"
+           "  -V us         simulated liveness latency, default %d\n", name,
+           cost.detect, cost.landmark, cost.extract, cost.liveness);
+}
+
+int main(int argc, char *argv[])
+{
+    enum det_queue_policy policy = DET_QUEUE_DROP_NEWEST;
+    int num = 300, fps = 0, depth = 0, workers = 0, users = 0, index = 0, nprobe = 0;
+    int rotation = HAL_TRANSFORM_ROT_90;
+    bool roi = false;
+    const char *enroll = NULL;
+    const char *identity = NULL;
+    struct face_mock_cost cost;
+    long long *lat;
+    long long start, end, next, init;
+    struct det_queue_stat queue;
+    int opt;
+
+    face_mock_get_cost(&cost);
+    while ((opt = getopt(argc, argv, "w:h:n:f:r:q:p:j:g:i:P:b:k:RAFD:L:E:V:")) != -1) {
+        switch (opt) {
+        case 'w':
+            g_width = atoi(optarg);
+            break;
+        case 'h':
+            g_height = atoi(optarg);
+            break;
+        case 'n':
+            num = atoi(optarg);
+            break;
+        case 'f':
+            fps = atoi(optarg);
+            break;
+        case 'r':
+            switch (atoi(optarg)) {
+            case 0:
+                rotation = 0;
+                break;
+            case 90:
+                rotation = HAL_TRANSFORM_ROT_90;
+                break;
+            case 270:
+                rotation = HAL_TRANSFORM_ROT_270;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'q':
+            depth = atoi(optarg);
+            break;
+        case 'p':
+            policy = strcmp(optarg, "replace") ? DET_QUEUE_DROP_NEWEST : DET_QUEUE_REPLACE_OLDEST;
+            break;
+        case 'j':
+            workers = atoi(optarg);
+            break;
+        case 'g':
+            users = atoi(optarg);
+            break;
+        case 'i':
+            index = atoi(optarg);
+            break;
+        case 'P':
+            nprobe = atoi(optarg);
+            break;
+        case 'b':
+            enroll = optarg;
+            break;
+        case 'k':
+            identity = optarg;
+            break;
+        case 'R':
+            roi = true;
+            break;
+        case 'A':
+            set_rga_dmabuf(false);
+            break;
+        case 'F':
+            set_face_convert_fused(true);
+            break;
+        case 'D':
+            cost.detect = atoi(optarg);
+            break;
+        case 'L':
+            cost.landmark = atoi(optarg);
+            break;
+        case 'E':
+            cost.extract = atoi(optarg);
+            break;
+        case 'V':
+            cost.liveness = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    face_mock_set_cost(&cost);
+    if (g_width <= 0 || g_height <= 0 || num <= 0 || (g_width & 1) || (g_height & 1)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (frame_load(optind < argc ? argv[optind] : NULL) || !g_frame_num) {
+        printf("no frame loaded\n");
+        frame_free();
+        return -1;
+    }
+    printf("%d frames of %dx%d loaded\n", g_frame_num, g_width, g_height);
+
+    lat = (long long *)calloc(num, sizeof(long long));
+    if (!lat || gallery_init(users)) {
+        printf("bench init failed\n");
+        free(lat);
+        frame_free();
+        return -1;
+    }
+
+    set_face_param(g_width, g_height, users);
+    set_face_det_queue(depth, policy);
+    set_face_det_worker(workers);
+    set_face_feature_roi(roi);
+    set_face_index(index, nprobe);
+    rkfacial_paint_box_cb = paint_box;
+    rkfacial_paint_info_cb = paint_info;
+    start = now_us();
+    if (rockface_control_init()) {
+        printf("rockface_control_init failed\n");
+        rockface_control_exit();
+        free(lat);
+        frame_free();
+        return -1;
+    }
+    init = now_us() - start;
+    if (enroll)
+        enroll_dir(enroll);
+    if (identity)
+        rockface_control_set_identity_en(1, (char *)identity);
+    rockface_reset_stage_stat();
+
+    start = now_us();
+    next = start;
+    for (int i = 0; i < num; i++) {
+        void *ptr = g_frames[i % g_frame_num].ptr;
+        int fd = g_frames[i % g_frame_num].fd;
+        long long t;
+
+        if (fps > 0) {
+            struct timespec ts;
+            ts.tv_sec = next / 1000000;
+            ts.tv_nsec = (next % 1000000) * 1000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            next += 1000000 / fps;
+        }
+        t = now_us();
+        rockface_control_convert(ptr, fd, g_width, g_height, RK_FORMAT_YCbCr_420_SP, rotation, i + 1);
+        rockface_control_convert_ir(ptr, fd, g_width, g_height, RK_FORMAT_YCbCr_420_SP, rotation);
+        lat[i] = now_us() - t;
+    }
+
+    /* let the detect thread finish what is still queued */
+    end = now_us();
+    do {
+        get_face_det_queue_stat(&queue);
+        if (!queue.ready)
+            break;
+        usleep(1000);
+    } while (now_us() - end < DRAIN_TIMEOUT_MS * 1000LL);
+    usleep(10000 + cost.detect);
+    end = now_us();
+
+    report(lat, num, end - start, init);
+
+    rockface_control_exit();
+    free(lat);
+    frame_free();
+    return 0;
+}
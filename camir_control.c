@@ -42,6 +42,7 @@
 #include <rkaiq/rkisp_api.h>
 #endif
 #include "rga_control.h"
+#include "frame_mailbox.h"
 #include <linux/media-bus-format.h>
 #include "rkfacial.h"
 
@@ -50,6 +51,10 @@ static const struct rkisp_api_buf *buf;
 static bool g_run;
 static pthread_t g_tid;
 
+/* one more than display can hold, so the isp always has a buffer queued */
+#define CAMIR_BUF_NUM 4
+static struct mailbox_frame g_frames[CAMIR_BUF_NUM];
+
 static bool g_ir_en;
 static int g_ir_width;
 static int g_ir_height;
@@ -80,23 +85,42 @@ void set_ir_param(int width, int height, display_callback cb)
     set_ir_display(cb);
 }
 
+static void camir_frame_release(struct mailbox_frame *frame)
+{
+    rkisp_put_frame(ctx, (const struct rkisp_api_buf *)frame->priv);
+}
+
 static void *process(void *arg)
 {
+    struct mailbox_frame *frame;
     rga_info_t src, dst;
 
     do {
         buf = rkisp_get_frame(ctx, 0);
-
-        rockface_control_convert_ir(buf->buf, ctx->width, ctx->height,
+        frame = mailbox_frame_alloc(g_frames, CAMIR_BUF_NUM);
+        if (!frame) {
+            rkisp_put_frame(ctx, buf);
+            continue;
+        }
+        frame->ptr = buf->buf;
+        frame->fd = buf->fd;
+        frame->fmt = RK_FORMAT_YCbCr_420_SP;
+        frame->width = ctx->width;
+        frame->height = ctx->height;
+        frame->rotation = g_rotation;
+        frame->release = camir_frame_release;
+        frame->priv = (void *)buf;
+
+        rockface_control_convert_ir(buf->buf, buf->fd, ctx->width, ctx->height,
                                     RK_FORMAT_YCbCr_420_SP, g_rotation);
 
         pthread_mutex_lock(&g_display_lock);
         if (g_display_cb)
-            g_display_cb(buf->buf, buf->fd, RK_FORMAT_YCbCr_420_SP,
-                    ctx->width, ctx->height, g_rotation);
+            frame_mailbox_post(frame, g_display_cb);
         pthread_mutex_unlock(&g_display_lock);
 
-        rkisp_put_frame(ctx, buf);
+        /* back to the isp now, or once display is done with it */
+        mailbox_frame_put(frame);
     } while (g_run);
 
     pthread_exit(NULL);
@@ -128,7 +152,7 @@ int camir_control_init(void)
         return -1;
     }
 
-    rkisp_set_buf(ctx, 3, NULL, 0);
+    rkisp_set_buf(ctx, CAMIR_BUF_NUM, NULL, 0);
 #ifdef CAMERA_ENGINE_RKISP
     rkisp_set_sensor_fmt(ctx, 1280, 720, MEDIA_BUS_FMT_YUYV8_2X8);
 #endif
@@ -156,6 +180,7 @@ void camir_control_exit(void)
         pthread_join(g_tid, NULL);
         g_tid = 0;
     }
+    frame_mailbox_flush();
 
     rkisp_stop_capture(ctx);
     rkisp_close_device(ctx);
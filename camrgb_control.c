@@ -42,6 +42,7 @@
 #include <rkaiq/rkisp_api.h>
 #endif
 #include "rga_control.h"
+#include "frame_mailbox.h"
 #include "rkfacial.h"
 
 static bool g_def_expo_weights = false;
@@ -53,6 +54,10 @@ static const struct rkisp_api_buf *buf;
 static bool g_run;
 static pthread_t g_tid;
 
+/* one more than display can hold, so the isp always has a buffer queued */
+#define CAMRGB_BUF_NUM 4
+static struct mailbox_frame g_frames[CAMRGB_BUF_NUM];
+
 bool g_rgb_en;
 int g_rgb_width;
 int g_rgb_height;
@@ -102,8 +107,14 @@ static inline void camrgb_inc_fps(void)
     }
 }
 
+static void camrgb_frame_release(struct mailbox_frame *frame)
+{
+    rkisp_put_frame(ctx, (const struct rkisp_api_buf *)frame->priv);
+}
+
 static void *process(void *arg)
 {
+    struct mailbox_frame *frame;
     int id = 0;
     do {
         id++;
@@ -111,17 +122,29 @@ static void *process(void *arg)
         camrgb_inc_fps();
 #endif
         buf = rkisp_get_frame(ctx, 0);
+        frame = mailbox_frame_alloc(g_frames, CAMRGB_BUF_NUM);
+        if (!frame) {
+            rkisp_put_frame(ctx, buf);
+            continue;
+        }
+        frame->ptr = buf->buf;
+        frame->fd = buf->fd;
+        frame->fmt = RK_FORMAT_YCbCr_420_SP;
+        frame->width = ctx->width;
+        frame->height = ctx->height;
+        frame->rotation = g_rotation;
+        frame->release = camrgb_frame_release;
+        frame->priv = (void *)buf;
 
-        if (!rockface_control_convert_detect(buf->buf, ctx->width, ctx->height, RK_FORMAT_YCbCr_420_SP, g_rotation, id))
-            rockface_control_convert_feature(buf->buf, ctx->width, ctx->height, RK_FORMAT_YCbCr_420_SP, g_rotation, id);
+        rockface_control_convert(buf->buf, buf->fd, ctx->width, ctx->height, RK_FORMAT_YCbCr_420_SP, g_rotation, id);
 
         pthread_mutex_lock(&g_display_lock);
         if (g_display_cb)
-            g_display_cb(buf->buf, buf->fd, RK_FORMAT_YCbCr_420_SP,
-                    ctx->width, ctx->height, g_rotation);
+            frame_mailbox_post(frame, g_display_cb);
         pthread_mutex_unlock(&g_display_lock);
 
-        rkisp_put_frame(ctx, buf);
+        /* back to the isp now, or once display is done with it */
+        mailbox_frame_put(frame);
     } while (g_run);
 
     pthread_exit(NULL);
@@ -153,7 +176,7 @@ int camrgb_control_init(void)
         return -1;
     }
 
-    rkisp_set_buf(ctx, 3, NULL, 0);
+    rkisp_set_buf(ctx, CAMRGB_BUF_NUM, NULL, 0);
 
     rkisp_set_fmt(ctx, g_rgb_width, g_rgb_height, V4L2_PIX_FMT_NV12);
 
@@ -190,6 +213,7 @@ void camrgb_control_exit(void)
         pthread_join(g_tid, NULL);
         g_tid = 0;
     }
+    frame_mailbox_flush();
 
     rkisp_stop_capture(ctx);
     rkisp_close_device(ctx);
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "codec_pool.h"
+
+static struct codec_ctx *g_pool[CODEC_POOL_SIZE];
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int g_pool_clock;
+/* once the VPU refuses a codec type, use soft jpeg and ask it again after a while */
+#define CODEC_HW_RETRY_SEC 10
+static time_t g_hw_retry[2];
+
+static time_t codec_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* g_pool_lock held */
+static bool codec_hw_ready(enum codec_type type)
+{
+    return !g_hw_retry[type] || codec_now() >= g_hw_retry[type];
+}
+
+static int codec_ctx_init(struct codec_ctx *ctx)
+{
+    int ret = -1;
+    bool hw;
+
+    pthread_mutex_lock(&g_pool_lock);
+    hw = codec_hw_ready(ctx->type);
+    pthread_mutex_unlock(&g_pool_lock);
+    if (hw) {
+        if (ctx->type == CODEC_JPEG_DEC) {
+            ret = vpu_decode_jpeg_init(&ctx->dec, ctx->width, ctx->height);
+            if (ret)
+                vpu_decode_jpeg_done(&ctx->dec);
+        } else {
+            ret = vpu_encode_jpeg_init(&ctx->enc, ctx->width, ctx->height, ctx->quant, ctx->format);
+            if (ret)
+                vpu_encode_jpeg_done(&ctx->enc);
+        }
+        pthread_mutex_lock(&g_pool_lock);
+        g_hw_retry[ctx->type] = ret ? codec_now() + CODEC_HW_RETRY_SEC : 0;
+        pthread_mutex_unlock(&g_pool_lock);
+        if (!ret)
+            return 0;
+        printf("%s: no vpu for %s, use soft jpeg for %ds\n", __func__,
+               ctx->type == CODEC_JPEG_DEC ? "decode" : "encode", CODEC_HW_RETRY_SEC);
+    }
+
+    if (ctx->type == CODEC_JPEG_ENC && ctx->format != MPP_FMT_YUV420SP)
+        return -1;
+    ctx->jpeg = soft_jpeg_create();
+    if (!ctx->jpeg)
+        return -1;
+    ctx->soft = true;
+    return 0;
+}
+
+static void codec_ctx_destroy(struct codec_ctx *ctx)
+{
+    if (ctx->soft)
+        soft_jpeg_destroy(ctx->jpeg);
+    else if (ctx->type == CODEC_JPEG_DEC)
+        vpu_decode_jpeg_done(&ctx->dec);
+    else
+        vpu_encode_jpeg_done(&ctx->enc);
+    free(ctx);
+}
+
+static bool codec_ctx_match(struct codec_ctx *ctx, enum codec_type type, int width, int height,
+                            MppFrameFormat format, int quant)
+{
+    if (ctx->type != type || ctx->width != width || ctx->height != height)
+        return false;
+    return type == CODEC_JPEG_DEC || (ctx->format == format && ctx->quant == quant);
+}
+
+static void codec_pool_drop(struct codec_ctx *ctx)
+{
+    pthread_mutex_lock(&g_pool_lock);
+    for (int i = 0; i < CODEC_POOL_SIZE; i++) {
+        if (g_pool[i] == ctx)
+            g_pool[i] = NULL;
+    }
+    ctx->pooled = false;
+    pthread_mutex_unlock(&g_pool_lock);
+}
+
+struct codec_ctx *codec_pool_get(enum codec_type type, int width, int height,
+                                 MppFrameFormat format, int quant)
+{
+    struct codec_ctx *ctx;
+    struct codec_ctx *evict = NULL;
+    int slot = -1;
+
+    pthread_mutex_lock(&g_pool_lock);
+    for (int i = 0; i < CODEC_POOL_SIZE; i++) {
+        ctx = g_pool[i];
+        if (!ctx) {
+            if (slot < 0)
+                slot = i;
+            continue;
+        }
+        if (ctx->busy)
+            continue;
+        /* an idle soft context is passed over once the VPU may be tried again */
+        if (ctx->soft && codec_hw_ready(type))
+            continue;
+        if (codec_ctx_match(ctx, type, width, height, format, quant)) {
+            ctx->busy = true;
+            ctx->used = ++g_pool_clock;
+            pthread_mutex_unlock(&g_pool_lock);
+            return ctx;
+        }
+    }
+    /* no idle match, take a free slot or the least recently used idle one */
+    if (slot < 0) {
+        for (int i = 0; i < CODEC_POOL_SIZE; i++) {
+            if (g_pool[i]->busy)
+                continue;
+            if (slot < 0 || g_pool[i]->used < g_pool[slot]->used)
+                slot = i;
+        }
+        if (slot >= 0) {
+            evict = g_pool[slot];
+            g_pool[slot] = NULL;
+        }
+    }
+    /* hold the slot while the context is set up outside the lock */
+    ctx = (struct codec_ctx *)calloc(1, sizeof(struct codec_ctx));
+    if (ctx) {
+        ctx->type = type;
+        ctx->width = width;
+        ctx->height = height;
+        ctx->format = format;
+        ctx->quant = quant;
+        ctx->busy = true;
+        ctx->used = ++g_pool_clock;
+        if (slot >= 0) {
+            ctx->pooled = true;
+            g_pool[slot] = ctx;
+        }
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+
+    if (evict)
+        codec_ctx_destroy(evict);
+    if (!ctx)
+        return NULL;
+    if (codec_ctx_init(ctx)) {
+        printf("%s: %dx%d codec init failed\n", __func__, width, height);
+        codec_pool_drop(ctx);
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* give the context back, one that failed a frame is not reused */
+void codec_pool_put(struct codec_ctx *ctx, bool ok)
+{
+    bool pooled;
+
+    if (!ctx)
+        return;
+
+    if (!ok)
+        codec_pool_drop(ctx);
+    /* an idle pooled context may be evicted as soon as the lock drops */
+    pthread_mutex_lock(&g_pool_lock);
+    pooled = ctx->pooled;
+    ctx->busy = false;
+    pthread_mutex_unlock(&g_pool_lock);
+    if (!pooled)
+        codec_ctx_destroy(ctx);
+}
+
+void codec_pool_exit(void)
+{
+    pthread_mutex_lock(&g_pool_lock);
+    for (int i = 0; i < CODEC_POOL_SIZE; i++) {
+        if (!g_pool[i])
+            continue;
+        /* a busy one is destroyed by its codec_pool_put */
+        if (g_pool[i]->busy)
+            g_pool[i]->pooled = false;
+        else
+            codec_ctx_destroy(g_pool[i]);
+        g_pool[i] = NULL;
+    }
+    pthread_mutex_unlock(&g_pool_lock);
+}
+
+int codec_jpeg_decode(struct codec_ctx *ctx, void *data, size_t size, int out_fd, void *out_data)
+{
+    int ret;
+
+    if (!ctx->soft) {
+        ret = vpu_decode_jpeg_doing(&ctx->dec, data, size, out_fd, out_data);
+        ctx->fmt = ctx->dec.fmt;
+        ctx->hor_stride = ctx->dec.hor_stride;
+        ctx->ver_stride = ctx->dec.ver_stride;
+        return ret;
+    }
+
+    ctx->fmt = MPP_FMT_YUV420SP;
+    ctx->hor_stride = MPP_ALIGN(ctx->width, 16);
+    ctx->ver_stride = MPP_ALIGN(ctx->height, 16);
+    return soft_jpeg_decode(ctx->jpeg, data, size, out_data, ctx->hor_stride, ctx->ver_stride);
+}
+
+int codec_jpeg_encode(struct codec_ctx *ctx, void *src, int src_fd, size_t src_size,
+                      void *dst, int dst_fd, size_t dst_size)
+{
+    int ret;
+
+    ctx->out = NULL;
+    ctx->out_len = 0;
+    if (!ctx->soft) {
+        ret = vpu_encode_jpeg_doing(&ctx->enc, src, src_fd, src_size, dst, dst_fd, dst_size);
+        ctx->out = ctx->enc.enc_out_data;
+        ctx->out_len = ctx->enc.enc_out_length;
+        return ret;
+    }
+
+    /* mpp quant 0 - 10 worst to best */
+    ret = soft_jpeg_encode(ctx->jpeg, src, ctx->width, ctx->height, ctx->quant * 10, dst,
+                           dst_size, &ctx->out_len);
+    if (!ret)
+        ctx->out = dst;
+    return ret;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __CODEC_POOL_H__
+#define __CODEC_POOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "vpu_decode.h"
+#include "vpu_encode.h"
+#include "soft_jpeg.h"
+
+#define CODEC_POOL_SIZE 6
+
+enum codec_type {
+    CODEC_JPEG_DEC,
+    CODEC_JPEG_ENC,
+};
+
+/*
+ * A jpeg codec context keyed by type, resolution, format and quant. The
+ * VPU one is used when it comes up, the soft one otherwise.
+ */
+struct codec_ctx {
+    enum codec_type type;
+    int width;
+    int height;
+    MppFrameFormat format;
+    int quant;
+    bool soft;
+    bool busy;
+    bool pooled;
+    unsigned int used;
+    struct vpu_decode dec;
+    struct vpu_encode enc;
+    struct soft_jpeg *jpeg;
+    /* decode result */
+    MppFrameFormat fmt;
+    int hor_stride;
+    int ver_stride;
+    /* encode result */
+    void *out;
+    size_t out_len;
+};
+
+struct codec_ctx *codec_pool_get(enum codec_type type, int width, int height,
+                                 MppFrameFormat format, int quant);
+void codec_pool_put(struct codec_ctx *ctx, bool ok);
+void codec_pool_exit(void);
+int codec_jpeg_decode(struct codec_ctx *ctx, void *data, size_t size, int out_fd, void *out_data);
+int codec_jpeg_encode(struct codec_ctx *ctx, void *src, int src_fd, size_t src_size,
+                      void *dst, int dst_fd, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
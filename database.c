@@ -39,6 +39,7 @@
 
 #include "database.h"
 #include "face_common.h"
+#include "face_meta.h"
 
 #define DATABASE_TABLE "face_data"
 #define DATABASE_VERSION "version_0"
@@ -53,6 +54,22 @@ void database_bak(void)
     system(cmd);
 }
 
+static void database_load_meta(void)
+{
+    char cmd[256];
+    sqlite3_stmt *stat = NULL;
+
+    face_meta_clear();
+    snprintf(cmd, sizeof(cmd), "SELECT id, name FROM %s;", DATABASE_TABLE);
+    if (sqlite3_prepare(g_db, cmd, -1, &stat, 0) != SQLITE_OK)
+        return;
+    while (sqlite3_step(stat) == SQLITE_ROW) {
+        const char *name = (const char *)sqlite3_column_text(stat, 1);
+        face_meta_set(sqlite3_column_int(stat, 0), name ? name : "");
+    }
+    sqlite3_finalize(stat);
+}
+
 int database_init(void)
 {
     char *err;
@@ -81,6 +98,7 @@ int database_init(void)
         return database_init();
     }
 
+    database_load_meta();
     database_bak();
 
     return 0;
@@ -89,6 +107,7 @@ int database_init(void)
 void database_exit(void)
 {
     sqlite3_close(g_db);
+    face_meta_clear();
     database_bak();
 }
 
@@ -119,7 +138,8 @@ int database_insert(void *data, size_t size, const char *name, size_t n_size, in
     sqlite3_exec(g_db, "begin transaction", NULL, NULL, NULL);
     sqlite3_bind_blob(stat, 1, data, size, NULL);
     sqlite3_bind_blob(stat, 2, mask, mask_size, NULL);
-    sqlite3_step(stat);
+    if (sqlite3_step(stat) == SQLITE_DONE)
+        face_meta_set(id, name);
     sqlite3_finalize(stat);
     sqlite3_exec(g_db, "commit transaction", NULL, NULL, NULL);
     if (sync_flag) {
@@ -131,6 +151,45 @@ int database_insert(void *data, size_t size, const char *name, size_t n_size, in
     return 0;
 }
 
+/* all records in one transaction, none of them if one fails */
+int database_insert_batch(const struct database_record *record, int num, bool sync_flag)
+{
+    int ret = 0;
+    char cmd[256];
+    sqlite3_stmt *stat = NULL;
+
+    pthread_mutex_lock(&g_mutex);
+    snprintf(cmd, sizeof(cmd), "REPLACE INTO %s VALUES(?, ?, ?, ?, 0);", DATABASE_TABLE);
+    if (sqlite3_prepare(g_db, cmd, -1, &stat, 0) != SQLITE_OK) {
+        pthread_mutex_unlock(&g_mutex);
+        return -1;
+    }
+    sqlite3_exec(g_db, "begin transaction", NULL, NULL, NULL);
+    for (int i = 0; i < num; i++) {
+        sqlite3_bind_blob(stat, 1, record[i].data, record[i].size, NULL);
+        sqlite3_bind_text(stat, 2, record[i].name, -1, NULL);
+        sqlite3_bind_int(stat, 3, record[i].id);
+        sqlite3_bind_blob(stat, 4, record[i].mask, record[i].mask_size, NULL);
+        if (sqlite3_step(stat) != SQLITE_DONE) {
+            printf("%s: insert %d fail!\n", __func__, record[i].id);
+            ret = -1;
+            break;
+        }
+        sqlite3_reset(stat);
+    }
+    sqlite3_finalize(stat);
+    sqlite3_exec(g_db, ret ? "rollback transaction" : "commit transaction", NULL, NULL, NULL);
+    for (int i = 0; !ret && i < num; i++)
+        face_meta_set(record[i].id, record[i].name);
+    if (sync_flag) {
+        sync();
+        database_bak();
+    }
+    pthread_mutex_unlock(&g_mutex);
+
+    return ret;
+}
+
 int database_record_count(void)
 {
     int ret = 0;
@@ -218,34 +277,17 @@ bool database_is_name_exist(const char *name)
     return exist;
 }
 
+/* served from the in-memory map, sqlite is not touched */
 bool database_is_id_exist(int id, char *name, size_t size)
 {
-    bool exist = false;
-    int ret = 0;
-    char cmd[256];
-    sqlite3_stmt *stat = NULL;
+    struct face_meta meta;
 
     memset(name, 0, size);
-    snprintf(cmd, sizeof(cmd), "SELECT * FROM %s WHERE id = %d LIMIT 1;", DATABASE_TABLE, id);
-    pthread_mutex_lock(&g_mutex);
-    if (sqlite3_prepare(g_db, cmd, -1, &stat, 0) != SQLITE_OK) {
-        pthread_mutex_unlock(&g_mutex);
+    if (!face_meta_get(id, &meta))
         return false;
-    }
-    ret = sqlite3_step(stat);
-    if (ret == SQLITE_ROW) {
-        const char *n = sqlite3_column_text(stat, 1);
-        size_t s = sqlite3_column_bytes(stat, 1);
-        if (s <= size)
-            strncpy(name, n, size - 1);
-        exist = true;
-    } else {
-        exist = false;
-    }
-    sqlite3_finalize(stat);
-    pthread_mutex_unlock(&g_mutex);
-
-    return exist;
+    if (strlen(meta.name) < size)
+        strncpy(name, meta.name, size - 1);
+    return true;
 }
 
 int database_get_user_name_id(void)
@@ -326,6 +368,7 @@ void database_delete(int id, bool sync_flag)
     sqlite3_exec(g_db, "begin transaction", NULL, NULL, NULL);
     sqlite3_exec(g_db, cmd, NULL, NULL, NULL);
     sqlite3_exec(g_db, "commit transaction", NULL, NULL, NULL);
+    face_meta_remove(id);
     if (sync_flag)
         sync();
     database_bak();
@@ -46,6 +46,7 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <assert.h>
+#include <stddef.h>
 
 #include <json-c/json.h>
 #include <glib.h>
@@ -63,6 +64,12 @@
 #define DBSERVER_EVENT_INTERFACE DBSERVER ".event"
 
 #include <list>
+#include <unordered_map>
+
+#define DB_MONITOR_BATCH 64
+/* shorter runs of adds are cheaper one by one through add_web */
+#define DB_MONITOR_BATCH_MIN 16
+#define DB_USER_CACHE_NUM 128
 
 struct json_data {
     int id;
@@ -82,6 +89,49 @@ static bool g_flag;
 extern int g_face_width;
 extern int g_face_height;
 
+struct user_field {
+    const char *key;
+    size_t offset;
+    size_t size;
+    bool string;
+};
+
+#define USER_INT(x) { #x, offsetof(struct user_info, x), sizeof(((struct user_info *)0)->x), false }
+#define USER_STRING(x) { #x, offsetof(struct user_info, x), sizeof(((struct user_info *)0)->x), true }
+
+/* the FaceList columns copied into struct user_info */
+static const struct user_field g_user_field[] = {
+    USER_INT(id),
+    USER_STRING(sPicturePath),
+    USER_STRING(sRegistrationTime),
+    USER_INT(iAge),
+    USER_STRING(sListType),
+    USER_STRING(sType),
+    USER_STRING(sName),
+    USER_STRING(sGender),
+    USER_STRING(sNation),
+    USER_STRING(sCertificateType),
+    USER_STRING(sCertificateNumber),
+    USER_STRING(sBirthday),
+    USER_STRING(sTelephoneNumber),
+    USER_STRING(sHometown),
+    USER_INT(iAccessCardNumber),
+};
+#define USER_FIELD_NUM (sizeof(g_user_field) / sizeof(g_user_field[0]))
+
+/* FaceList rows by face id, most recently used first */
+struct user_cache {
+    int id;
+    unsigned int present; /* string fields the row has */
+    struct user_info info;
+};
+
+static std::list<struct user_cache> g_user_lru;
+static std::unordered_map<int, std::list<struct user_cache>::iterator> g_user_map;
+static pthread_mutex_t g_user_lock = PTHREAD_MUTEX_INITIALIZER;
+/* bumped on every invalidation so a fetch racing with it is not cached */
+static unsigned int g_user_gen;
+
 static void db_monitor_wait(void)
 {
     pthread_mutex_lock(&g_mutex);
@@ -99,6 +149,30 @@ static void db_monitor_signal(void)
     pthread_mutex_unlock(&g_mutex);
 }
 
+static void db_monitor_add_progress(const struct enroll_item *item, int done, int total)
+{
+    dbserver_face_load_complete(item->id, item->ret ? -1 : 1);
+    printf("Update: id = %d, path = %s (%d/%d)\n", item->id, item->path, done, total);
+}
+
+/* a run of at least DB_MONITOR_BATCH_MIN queued adds goes through the batch enrollment */
+static void db_monitor_add_batch(struct json_data **data, int num)
+{
+    struct enroll_item *item = (struct enroll_item*)calloc(num, sizeof(struct enroll_item));
+
+    if (!item) {
+        for (int i = 0; i < num; i++)
+            dbserver_face_load_complete(data[i]->id, -1);
+        return;
+    }
+    for (int i = 0; i < num; i++) {
+        item[i].path = data[i]->path;
+        item[i].id = data[i]->id;
+    }
+    rockface_control_add_batch(item, num, false, db_monitor_add_progress);
+    free(item);
+}
+
 static void db_monitor_check(void);
 static void *db_monitor_thread(void *arg)
 {
@@ -150,6 +224,27 @@ static void *db_monitor_thread(void *arg)
             continue;
 
         if (data->add) {
+            struct json_data *batch[DB_MONITOR_BATCH];
+            int run = 1;
+            int num = 1;
+
+            batch[0] = data;
+            pthread_mutex_lock(&g_lock);
+            for (auto it = g_json.begin(); run < DB_MONITOR_BATCH_MIN && it != g_json.end() && (*it)->add; ++it)
+                run++;
+            while (run == DB_MONITOR_BATCH_MIN && num < DB_MONITOR_BATCH && !g_json.empty() && g_json.front()->add) {
+                batch[num++] = g_json.front();
+                g_json.pop_front();
+            }
+            pthread_mutex_unlock(&g_lock);
+            if (num > 1) {
+                db_monitor_add_batch(batch, num);
+                for (int i = 1; i < num; i++) {
+                    free(batch[i]->path);
+                    free(batch[i]);
+                }
+                continue;
+            }
             ret = rockface_control_add_web(data->id, data->path);
             if (ret == -1 )
                 dbserver_face_load_complete(data->id, -1);
@@ -170,41 +265,45 @@ static void *db_monitor_thread(void *arg)
 
 static void get_face_config(json_object *j_obj)
 {
+    struct face_config cfg;
+
     if (!j_obj)
         return;
-    g_face_config.en = true;
-    g_face_config.volume = json_object_get_int(json_object_object_get(j_obj, "iPromptVolume"));
+    face_config_copy(&cfg);
+    cfg.en = true;
+    cfg.volume = json_object_get_int(json_object_object_get(j_obj, "iPromptVolume"));
     const char *live_det = json_object_get_string(json_object_object_get(j_obj, "sLiveDetect"));
     if (live_det) {
         if (!strncmp(live_det, "open", strlen("open")))
-            g_face_config.live_det_en = 1;
+            cfg.live_det_en = 1;
         else
-            g_face_config.live_det_en = 0;
+            cfg.live_det_en = 0;
     }
-    g_face_config.live_det_th = json_object_get_int(json_object_object_get(j_obj, "iLiveDetectThreshold"));
-    g_face_config.face_det_th = json_object_get_int(json_object_object_get(j_obj, "iFaceDetectionThreshold"));
-    g_face_config.face_rec_th = json_object_get_int(json_object_object_get(j_obj, "iFaceRecognitionThreshold"));
-    g_face_config.face_mask_th = 50; // TODO
-    g_face_config.min_pixel = json_object_get_int(json_object_object_get(j_obj, "iFaceMinPixel"));
-    g_face_config.corner_x = json_object_get_int(json_object_object_get(j_obj, "iLeftCornerX"));
-    g_face_config.corner_y = json_object_get_int(json_object_object_get(j_obj, "iLeftCornerY"));
-    g_face_config.det_width = json_object_get_int(json_object_object_get(j_obj, "iDetectWidth"));
-    g_face_config.det_height = json_object_get_int(json_object_object_get(j_obj, "iDetectHeight"));
-    g_face_config.nor_width = json_object_get_int(json_object_object_get(j_obj, "iNormalizedWidth"));
-    g_face_config.nor_height = json_object_get_int(json_object_object_get(j_obj, "iNormalizedHeight"));
-    printf("face_config: en %d\n", g_face_config.en);
-    printf("             volume %d\n", g_face_config.volume);
-    printf("             live_det_en %d\n", g_face_config.live_det_en);
-    printf("             live_det_th %d\n", g_face_config.live_det_th);
-    printf("             face_det_th %d\n", g_face_config.face_det_th);
-    printf("             face_rec_th %d\n", g_face_config.face_rec_th);
-    printf("             min_pixel %d\n", g_face_config.min_pixel);
-    printf("             corner_x %d\n", g_face_config.corner_x);
-    printf("             corner_y %d\n", g_face_config.corner_y);
-    printf("             det_width %d\n", g_face_config.det_width);
-    printf("             det_height %d\n", g_face_config.det_height);
-    printf("             nor_width %d\n", g_face_config.nor_width);
-    printf("             nor_height %d\n", g_face_config.nor_height);
+    cfg.live_det_th = json_object_get_int(json_object_object_get(j_obj, "iLiveDetectThreshold"));
+    cfg.face_det_th = json_object_get_int(json_object_object_get(j_obj, "iFaceDetectionThreshold"));
+    cfg.face_rec_th = json_object_get_int(json_object_object_get(j_obj, "iFaceRecognitionThreshold"));
+    cfg.face_mask_th = 50; // TODO
+    cfg.min_pixel = json_object_get_int(json_object_object_get(j_obj, "iFaceMinPixel"));
+    cfg.corner_x = json_object_get_int(json_object_object_get(j_obj, "iLeftCornerX"));
+    cfg.corner_y = json_object_get_int(json_object_object_get(j_obj, "iLeftCornerY"));
+    cfg.det_width = json_object_get_int(json_object_object_get(j_obj, "iDetectWidth"));
+    cfg.det_height = json_object_get_int(json_object_object_get(j_obj, "iDetectHeight"));
+    cfg.nor_width = json_object_get_int(json_object_object_get(j_obj, "iNormalizedWidth"));
+    cfg.nor_height = json_object_get_int(json_object_object_get(j_obj, "iNormalizedHeight"));
+    printf("face_config: en %d\n", cfg.en);
+    printf("             volume %d\n", cfg.volume);
+    printf("             live_det_en %d\n", cfg.live_det_en);
+    printf("             live_det_th %d\n", cfg.live_det_th);
+    printf("             face_det_th %d\n", cfg.face_det_th);
+    printf("             face_rec_th %d\n", cfg.face_rec_th);
+    printf("             min_pixel %d\n", cfg.min_pixel);
+    printf("             corner_x %d\n", cfg.corner_x);
+    printf("             corner_y %d\n", cfg.corner_y);
+    printf("             det_width %d\n", cfg.det_width);
+    printf("             det_height %d\n", cfg.det_height);
+    printf("             nor_width %d\n", cfg.nor_width);
+    printf("             nor_height %d\n", cfg.nor_height);
+    face_config_publish(&cfg);
     if (get_face_config_region_cb) {
         int x, y, w, h;
         int width, height;
@@ -213,14 +312,32 @@ static void get_face_config(json_object *j_obj)
             width = g_face_width;
             height = g_face_height;
         }
-        x = g_face_config.corner_x * width / g_face_config.nor_width;
-        y = g_face_config.corner_y * height / g_face_config.nor_height;
-        w = g_face_config.det_width * width / g_face_config.nor_width;
-        h = g_face_config.det_height * height / g_face_config.nor_height;
+        x = cfg.corner_x * width / cfg.nor_width;
+        y = cfg.corner_y * height / cfg.nor_height;
+        w = cfg.det_width * width / cfg.nor_width;
+        h = cfg.det_height * height / cfg.nor_height;
         get_face_config_region_cb(x, y, w, h);
     }
 }
 
+/* id < 0 drops every cached row */
+static void db_monitor_user_invalidate(int id)
+{
+    pthread_mutex_lock(&g_user_lock);
+    g_user_gen++;
+    if (id < 0) {
+        g_user_map.clear();
+        g_user_lru.clear();
+    } else {
+        auto it = g_user_map.find(id);
+        if (it != g_user_map.end()) {
+            g_user_lru.erase(it->second);
+            g_user_map.erase(it);
+        }
+    }
+    pthread_mutex_unlock(&g_user_lock);
+}
+
 void db_monitor_run(void *json_str)
 {
     if (!json_str) {
@@ -249,6 +366,9 @@ void db_monitor_run(void *json_str)
     int id = json_object_get_int(j_id);
     const char *cmd = json_object_get_string(j_cmd);
 
+    if (cmd && (strstr(cmd, "Update") || strstr(cmd, "Delete")))
+        db_monitor_user_invalidate(j_id ? id : -1);
+
     if (cmd && strstr(cmd, "Update")) {
         json_object *j_note = json_object_object_get(j_data, "sNote");
         const char *note = json_object_get_string(j_note);
@@ -445,12 +565,14 @@ static void db_monitor_check(void)
 
 void db_monitor_face_list_add(int id, char *path, char *name, char *type)
 {
+    db_monitor_user_invalidate(id);
     dbserver_face_list_add(id, path, name, type);
     dbserver_face_load_complete(id, 1);
 }
 
 void db_monitor_face_list_delete(int id)
 {
+    db_monitor_user_invalidate(id);
     dbserver_face_list_delete(id);
 }
 
@@ -465,41 +587,84 @@ void db_monitor_control_record_set(int face_id, char *path, char *status, char *
 }
 
 
-void db_monitor_get_user_info(struct user_info *info, int i)
+static void db_monitor_user_copy(struct user_info *info, const struct user_cache *user)
+{
+    for (unsigned int k = 0; k < USER_FIELD_NUM; k++) {
+        const struct user_field *f = &g_user_field[k];
+        char *dst = (char *)info + f->offset;
+        const char *src = (const char *)&user->info + f->offset;
+
+        if (!f->string)
+            memcpy(dst, src, f->size);
+        else if (user->present & (1u << k))
+            strncpy(dst, src, f->size - 1);
+    }
+}
+
+static int db_monitor_user_fetch(struct user_cache *user, int i)
 {
     char *json_str = NULL;
 
     json_str = dbserver_event_get_by_id(TABLE_FACE_LIST, i);
-    if (json_str) {
-        json_object *j_cfg = json_tokener_parse((const char*)json_str);
-        json_object *j_data = json_object_object_get(j_cfg, "jData");
-        json_object *j_obj = json_object_array_get_idx(j_data, 0);
-#define COPY_INT(x) info->x = json_object_get_int(json_object_object_get(j_obj, #x))
-#define COPY_STRING(x) \
-        do { \
-            if (json_object_get_string(json_object_object_get(j_obj, #x))) \
-                strncpy(info->x, json_object_get_string(json_object_object_get(j_obj, #x)), sizeof(info->x) - 1); \
-        } while (0)
-        COPY_INT(id);
-        COPY_STRING(sPicturePath);
-        COPY_STRING(sRegistrationTime);
-        COPY_INT(iAge);
-        COPY_STRING(sListType);
-        COPY_STRING(sType);
-        COPY_STRING(sName);
-        COPY_STRING(sGender);
-        COPY_STRING(sNation);
-        COPY_STRING(sCertificateType);
-        COPY_STRING(sCertificateNumber);
-        COPY_STRING(sBirthday);
-        COPY_STRING(sTelephoneNumber);
-        COPY_STRING(sHometown);
-        COPY_INT(iAccessCardNumber);
-        json_object_put(j_cfg);
-        free(json_str);
-    } else {
+    if (!json_str)
+        return -1;
+
+    json_object *j_cfg = json_tokener_parse((const char*)json_str);
+    json_object *j_data = json_object_object_get(j_cfg, "jData");
+    json_object *j_obj = json_object_array_get_idx(j_data, 0);
+    memset(user, 0, sizeof(struct user_cache));
+    user->id = i;
+    for (unsigned int k = 0; k < USER_FIELD_NUM; k++) {
+        const struct user_field *f = &g_user_field[k];
+        json_object *j_val = json_object_object_get(j_obj, f->key);
+        char *dst = (char *)&user->info + f->offset;
+
+        if (!f->string) {
+            unsigned int val = json_object_get_int(j_val);
+            memcpy(dst, &val, f->size);
+        } else if (json_object_get_string(j_val)) {
+            strncpy(dst, json_object_get_string(j_val), f->size - 1);
+            user->present |= 1u << k;
+        }
+    }
+    json_object_put(j_cfg);
+    free(json_str);
+    return 0;
+}
+
+/* served from the LRU, dbserver is asked only on a miss */
+void db_monitor_get_user_info(struct user_info *info, int i)
+{
+    struct user_cache user;
+    unsigned int gen;
+
+    pthread_mutex_lock(&g_user_lock);
+    auto it = g_user_map.find(i);
+    if (it != g_user_map.end()) {
+        g_user_lru.splice(g_user_lru.begin(), g_user_lru, it->second);
+        db_monitor_user_copy(info, &*it->second);
+        pthread_mutex_unlock(&g_user_lock);
+        return;
+    }
+    gen = g_user_gen;
+    pthread_mutex_unlock(&g_user_lock);
+
+    if (db_monitor_user_fetch(&user, i)) {
         printf("%s %d failed\n", __func__, i);
+        return;
+    }
+    db_monitor_user_copy(info, &user);
+
+    pthread_mutex_lock(&g_user_lock);
+    if (gen == g_user_gen && g_user_map.find(i) == g_user_map.end()) {
+        g_user_lru.push_front(user);
+        g_user_map[i] = g_user_lru.begin();
+        if (g_user_lru.size() > DB_USER_CACHE_NUM) {
+            g_user_map.erase(g_user_lru.back().id);
+            g_user_lru.pop_back();
+        }
     }
+    pthread_mutex_unlock(&g_user_lock);
 }
 #else
 void db_monitor_init()
@@ -34,15 +34,29 @@
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
 
 #include <rga/RgaApi.h>
 #include "display.h"
 #include "rkdrm_display.h"
+#include "rga_control.h"
 #include "rkfacial.h"
+#include "face_stat.h"
 
 #define BUF_COUNT 3
+#define BOX_BUF_COUNT 2
 #define USE_NV12
 
+/* a flip not reported within this time is taken as lost */
+#define FLIP_TIMEOUT_MS 500
+
+enum display_buf_state {
+    DISPLAY_BUF_FREE,
+    DISPLAY_BUF_QUEUED,
+    DISPLAY_BUF_SCANOUT,
+};
+
 struct display {
     int fmt;
     int width;
@@ -53,6 +67,24 @@ struct display {
     int buf_cnt;
     int rga_fmt;
 
+    /*
+     * A buffer is queued from the pick in display_commit until its flip
+     * event, then scanned out until the next flip. While a commit is in
+     * flight new frames are dropped instead of waiting for the vblank.
+     */
+    enum display_buf_state state[BUF_COUNT];
+    bool flip_pending;
+    struct timespec flip_time;
+    pthread_t event_tid;
+    bool event_run;
+
+    unsigned int frames;
+    unsigned int dropped;
+    unsigned int errors;
+    unsigned int fps_frames;
+    struct timespec fps_time;
+    float fps;
+
     /* face rect */
     int x;
     int y;
@@ -60,6 +92,17 @@ struct display {
     int h;
 
     YUV_Color color;
+
+    /*
+     * ARGB buffers on a plane above the video, redrawn only when the
+     * rect or color changes. box_cnt is 0 when the crtc has no spare
+     * plane, then the rect is drawn into the video buffer instead.
+     */
+    struct drm_buf box_buf[BOX_BUF_COUNT];
+    YUV_Rect box_rect[BOX_BUF_COUNT];
+    int box_cnt;
+    int box_num;
+    bool box_dirty;
 };
 
 static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -81,9 +124,86 @@ static int drm_display_init(struct display *disp)
         }
     }
 
+    if (drmInitBoxPlane(&disp->dev, DRM_FORMAT_ARGB8888)) {
+        printf("%s: no box plane, draw into video\n", __func__);
+        return 0;
+    }
+    for (int i = 0; i < BOX_BUF_COUNT; i++) {
+        ret = drmGetBuffer(disp->dev.drm_fd, disp->width, disp->height,
+                           DRM_FORMAT_ARGB8888, &disp->box_buf[i]);
+        if (ret) {
+            fprintf(stderr, "Alloc box buffer failed, %d\n", i);
+            while (--i >= 0)
+                drmPutBuffer(disp->dev.drm_fd, &disp->box_buf[i]);
+            return 0;
+        }
+        memset(disp->box_buf[i].map, 0, disp->box_buf[i].size);
+    }
+    disp->box_cnt = BOX_BUF_COUNT;
+    disp->box_dirty = true;
+
     return 0;
 }
 
+static void drm_display_exit(struct display *disp)
+{
+    if (disp->event_run) {
+        disp->event_run = false;
+        pthread_join(disp->event_tid, NULL);
+    }
+    for (int i = 0; i < disp->buf_cnt; i++)
+        drmPutBuffer(disp->dev.drm_fd, &disp->buf[i]);
+    for (int i = 0; i < disp->box_cnt; i++)
+        drmPutBuffer(disp->dev.drm_fd, &disp->box_buf[i]);
+    disp->box_cnt = 0;
+    drmDeinit(&disp->dev);
+}
+
+static int timespec_ms(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) * 1000 + (t1->tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+static void display_flip_handler(int fd, unsigned int sequence,
+                                 unsigned int tv_sec, unsigned int tv_usec,
+                                 void *user_data)
+{
+    struct display *disp = (struct display *)user_data;
+    struct timespec now;
+    int ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < disp->buf_cnt; i++) {
+        if (disp->state[i] == DISPLAY_BUF_SCANOUT)
+            disp->state[i] = DISPLAY_BUF_FREE;
+        else if (disp->state[i] == DISPLAY_BUF_QUEUED)
+            disp->state[i] = DISPLAY_BUF_SCANOUT;
+    }
+    disp->flip_pending = false;
+    disp->frames++;
+    disp->fps_frames++;
+    ms = timespec_ms(&disp->fps_time, &now);
+    if (ms >= 1000) {
+        disp->fps = disp->fps_frames * 1000.0f / ms;
+        disp->fps_frames = 0;
+        disp->fps_time = now;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void *display_event_thread(void *arg)
+{
+    struct display *disp = (struct display *)arg;
+
+    while (disp->event_run) {
+        if (drmWaitFlip(&disp->dev, 100, display_flip_handler) < 0)
+            usleep(10000);
+    }
+
+    pthread_exit(NULL);
+}
+
 int display_init(int width, int height)
 {
     int ret;
@@ -104,65 +224,156 @@ int display_init(int width, int height)
     if (ret)
         return ret;
 
+    clock_gettime(CLOCK_MONOTONIC, &g_disp.fps_time);
+    g_disp.event_run = true;
+    if (pthread_create(&g_disp.event_tid, NULL, display_event_thread, &g_disp)) {
+        printf("%s: create event thread failed\n", __func__);
+        g_disp.event_run = false;
+        drm_display_exit(&g_disp);
+        return -1;
+    }
+
     return 0;
 }
 
 
-static void drm_display_exit(struct display *disp)
+void display_exit(void)
 {
-    drmDeinit(&disp->dev);
-    for (int i = 0; i < disp->buf_cnt; i++)
-        drmPutBuffer(disp->dev.drm_fd, &disp->buf[i]);
+    drm_display_exit(&g_disp);
 }
 
-void display_exit(void)
+static YUV_Rect drm_draw_box(struct display *disp, int n, YUV_Rect rect, YUV_Color color)
 {
-    drm_display_exit(&g_disp);
+    struct drm_buf *buf = &disp->box_buf[n];
+    int x1 = rect.x + rect.width;
+    int y1 = rect.y + rect.height;
+
+    /* clip to the screen, the rect is also the plane window */
+    rect.x = rect.x < 0 ? 0 : rect.x;
+    rect.y = rect.y < 0 ? 0 : rect.y;
+    x1 = x1 > disp->width ? disp->width : x1;
+    y1 = y1 > disp->height ? disp->height : y1;
+    rect.width = x1 > rect.x ? x1 - rect.x : 0;
+    rect.height = y1 > rect.y ? y1 - rect.y : 0;
+
+    argb8888_draw_rectangle(buf->map, buf->pitch, disp->width, disp->height,
+                            disp->box_rect[n], 0);
+    argb8888_draw_rectangle(buf->map, buf->pitch, disp->width, disp->height,
+                            rect, yuv_color_to_argb(color));
+    disp->box_rect[n] = rect;
+
+    return rect;
 }
 
-void drm_commit(struct display *disp, int num, void *ptr, int fd, int fmt, int w, int h, int rotation)
+static int drm_commit(struct display *disp, int num, void *ptr, int fd, int fmt, int w, int h, int rotation)
 {
     int ret;
     rga_info_t src, dst;
+    struct face_stat_timer timer;
     char *map = disp->buf[num].map;
     int dst_w = disp->width;
     int dst_h = disp->height;
     int dst_fmt = disp->rga_fmt;
+    struct drm_buf *box = NULL;
+    YUV_Rect box_rect = {0, 0, 0, 0};
+    int box_num = 0;
 
     memset(&src, 0, sizeof(rga_info_t));
-    src.fd = -1;
-    src.virAddr = ptr;
-    src.mmuFlag = 1;
+    rga_control_set_buf(&src, ptr, fd);
     src.rotation = rotation;
     rga_set_rect(&src.rect, 0, 0, w, h, w, h, fmt);
     memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = map;
-    dst.mmuFlag = 1;
+    rga_control_set_buf(&dst, map, disp->buf[num].dmabuf_fd);
     rga_set_rect(&dst.rect, 0, 0, dst_w, dst_h, dst_w, dst_h, dst_fmt);
-    if (c_RkRgaBlit(&src, &dst, NULL)) {
+    face_stat_begin(&timer);
+    ret = rga_control_blit(&src, &dst);
+    face_stat_end(&timer, FACE_STAGE_RGA_DISPLAY);
+    if (ret) {
         printf("%s: rga fail\n", __func__);
-        return;
+        return ret;
     }
 
     pthread_mutex_lock(&g_lock);
     YUV_Rect rect = {g_disp.x, g_disp.y, g_disp.w, g_disp.h};
     YUV_Color color = g_disp.color;
+    bool dirty = g_disp.box_dirty;
+    g_disp.box_dirty = false;
     pthread_mutex_unlock(&g_lock);
-    if (rect.x || rect.y || rect.width || rect.height)
-        yuv420_draw_rectangle(map, dst_w, dst_h, rect, color);
-    ret = drmCommit(&disp->buf[num], disp->width, disp->height, 0, 0, &disp->dev, disp->plane_type);
+    if (!disp->box_cnt) {
+        if (rect.x || rect.y || rect.width || rect.height)
+            yuv420_draw_rectangle(map, dst_w, dst_h, rect, color);
+    } else if (dirty) {
+        box_num = (disp->box_num + 1) % disp->box_cnt;
+        box_rect = drm_draw_box(disp, box_num, rect, color);
+        box = &disp->box_buf[box_num];
+    }
+    ret = drmCommitBox(&disp->buf[num], disp->width, disp->height, 0, 0, &disp->dev, disp->plane_type,
+                       box, box_rect.x, box_rect.y, box_rect.width, box_rect.height, disp);
     if (ret) {
         fprintf(stderr, "display commit error, ret = %d\n", ret);
+        if (box) {
+            pthread_mutex_lock(&g_lock);
+            g_disp.box_dirty = true;
+            pthread_mutex_unlock(&g_lock);
+        }
+    } else if (box) {
+        disp->box_num = box_num;
     }
+
+    return ret;
 }
 
 void display_commit(void *ptr, int fd, int fmt, int w, int h, int rotation)
 {
-    static int num = 0;
+    struct display *disp = &g_disp;
+    struct timespec now;
+    int num = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&g_lock);
+    if (disp->flip_pending && timespec_ms(&disp->flip_time, &now) > FLIP_TIMEOUT_MS) {
+        printf("%s: flip event lost\n", __func__);
+        for (int i = 0; i < disp->buf_cnt; i++) {
+            if (disp->state[i] == DISPLAY_BUF_QUEUED)
+                disp->state[i] = DISPLAY_BUF_FREE;
+        }
+        disp->flip_pending = false;
+    }
+    if (!disp->flip_pending) {
+        for (int i = 0; i < disp->buf_cnt; i++) {
+            if (disp->state[i] == DISPLAY_BUF_FREE) {
+                num = i;
+                break;
+            }
+        }
+    }
+    if (num < 0) {
+        disp->dropped++;
+        pthread_mutex_unlock(&g_lock);
+        return;
+    }
+    disp->state[num] = DISPLAY_BUF_QUEUED;
+    disp->flip_pending = true;
+    disp->flip_time = now;
+    pthread_mutex_unlock(&g_lock);
 
-    drm_commit(&g_disp, num, ptr, fd, fmt, w, h, rotation);
-    num = (num + 1) % BUF_COUNT;
+    if (drm_commit(disp, num, ptr, fd, fmt, w, h, rotation)) {
+        pthread_mutex_lock(&g_lock);
+        disp->state[num] = DISPLAY_BUF_FREE;
+        disp->flip_pending = false;
+        disp->errors++;
+        pthread_mutex_unlock(&g_lock);
+    }
+}
+
+void display_get_stat(struct display_stat *stat)
+{
+    pthread_mutex_lock(&g_lock);
+    stat->frames = g_disp.frames;
+    stat->dropped = g_disp.dropped;
+    stat->errors = g_disp.errors;
+    stat->fps = g_disp.fps;
+    pthread_mutex_unlock(&g_lock);
 }
 
 void display_switch(enum display_video_type type)
@@ -187,6 +398,9 @@ void display_get_resolution(int *width, int *height)
 void display_paint_box(int left, int top, int right, int bottom)
 {
     pthread_mutex_lock(&g_lock);
+    if (g_disp.x != left || g_disp.y != top ||
+        g_disp.w != right - left || g_disp.h != bottom - top)
+        g_disp.box_dirty = true;
     g_disp.x = left;
     g_disp.y = top;
     g_disp.w = right - left;
@@ -197,6 +411,8 @@ void display_paint_box(int left, int top, int right, int bottom)
 void display_set_color(YUV_Color color)
 {
     pthread_mutex_lock(&g_lock);
+    if (memcmp(&g_disp.color, &color, sizeof(color)))
+        g_disp.box_dirty = true;
     g_disp.color = color;
     pthread_mutex_unlock(&g_lock);
 }
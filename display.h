@@ -46,6 +46,14 @@ enum display_video_type {
     DISPLAY_VIDEO_USB,
 };
 
+/* frames is the number of flips, dropped the frames skipped while a flip was pending */
+struct display_stat {
+    unsigned int frames;
+    unsigned int dropped;
+    unsigned int errors;
+    float fps;
+};
+
 int display_init(int width, int height);
 void display_exit(void);
 void display_commit(void *ptr, int fd, int fmt, int w, int h, int rotation);
@@ -53,6 +61,7 @@ void display_switch(enum display_video_type type);
 void display_get_resolution(int *width, int *height);
 void display_paint_box(int left, int top, int right, int bottom);
 void display_set_color(YUV_Color color);
+void display_get_stat(struct display_stat *stat);
 
 #ifdef __cplusplus
 }
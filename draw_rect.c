@@ -358,3 +358,64 @@ void yuv420_draw_rectangle(void* imgdata,
     yuv420_draw_line(imgdata, width, height, Point[3], Point[2], color);
     yuv420_draw_line(imgdata, width, height, Point[0], Point[3], color);
 }
+
+static int yuv_clamp(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+uint32_t yuv_color_to_argb(YUV_Color color)
+{
+    int y = color.Y;
+    int u = color.U - 128;
+    int v = color.V - 128;
+    int r, g, b;
+
+    r = yuv_clamp(y + ((359 * v) >> 8));
+    g = yuv_clamp(y - ((88 * u + 183 * v) >> 8));
+    b = yuv_clamp(y + ((454 * u) >> 8));
+
+    return 0xff000000 | (r << 16) | (g << 8) | b;
+}
+
+static void argb8888_fill(void *imgdata, int pitch, int x0, int y0,
+    int x1, int y1, uint32_t color)
+{
+    for (int y = y0; y < y1; y++) {
+        uint32_t *line = (uint32_t *)((char *)imgdata + y * pitch);
+        for (int x = x0; x < x1; x++)
+            line[x] = color;
+    }
+}
+
+void argb8888_draw_rectangle(void *imgdata,
+    int pitch,
+    int width,
+    int height,
+    YUV_Rect rect_rio,
+    uint32_t color)
+{
+    int x0 = rect_rio.x < 0 ? 0 : rect_rio.x;
+    int y0 = rect_rio.y < 0 ? 0 : rect_rio.y;
+    int x1 = rect_rio.x + rect_rio.width;
+    int y1 = rect_rio.y + rect_rio.height;
+    int line = ARGB_LINE_WIDTH;
+
+    if (!imgdata)
+        return;
+    if (x1 > width)
+        x1 = width;
+    if (y1 > height)
+        y1 = height;
+    if (x1 <= x0 || y1 <= y0)
+        return;
+    if (x1 - x0 < line * 2 || y1 - y0 < line * 2) {
+        argb8888_fill(imgdata, pitch, x0, y0, x1, y1, color);
+        return;
+    }
+
+    argb8888_fill(imgdata, pitch, x0, y0, x1, y0 + line, color);
+    argb8888_fill(imgdata, pitch, x0, y1 - line, x1, y1, color);
+    argb8888_fill(imgdata, pitch, x0, y0 + line, x0 + line, y1 - line, color);
+    argb8888_fill(imgdata, pitch, x1 - line, y0 + line, x1, y1 - line, color);
+}
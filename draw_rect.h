@@ -38,6 +38,9 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#define ARGB_LINE_WIDTH 4
 
 typedef enum {
     COLOR_Y,
@@ -81,4 +84,13 @@ void yuv420_draw_rectangle(void* imgdata,
     YUV_Rect rect_rio,
     YUV_Color color);
 
+uint32_t yuv_color_to_argb(YUV_Color color);
+
+void argb8888_draw_rectangle(void *imgdata,
+    int pitch,
+    int width,
+    int height,
+    YUV_Rect rect_rio,
+    uint32_t color);
+
 #endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "face_backend.h"
+#include "rkfacial.h"
+
+static const struct face_backend *g_backends[] = {
+#ifdef FACE_BACKEND_ROCKFACE
+    &face_backend_rockface,
+#endif
+    &face_backend_mock,
+};
+
+static const struct face_backend *g_backend;
+
+int set_face_backend(const char *name)
+{
+    for (int i = 0; i < sizeof(g_backends) / sizeof(g_backends[0]); i++) {
+        if (!strcmp(g_backends[i]->name, name)) {
+            g_backend = g_backends[i];
+            return 0;
+        }
+    }
+    printf("%s: unknown backend %s\n", __func__, name);
+    return -1;
+}
+
+const struct face_backend *face_backend_get(void)
+{
+    if (!g_backend)
+        g_backend = g_backends[0];
+    return g_backend;
+}
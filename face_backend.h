@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __FACE_BACKEND_H__
+#define __FACE_BACKEND_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rockface/rockface.h>
+
+/*
+ * Inference backend, every model call of the pipeline goes through one of
+ * these. The rockface types are kept as the common vocabulary so a backend
+ * only has to fill them in.
+ */
+struct face_backend {
+    const char *name;
+
+    rockface_handle_t (*create_handle)(void);
+    rockface_ret_t (*release_handle)(rockface_handle_t handle);
+    rockface_ret_t (*set_licence)(rockface_handle_t handle, const char *path);
+    rockface_ret_t (*set_data_path)(rockface_handle_t handle, const char *path);
+    rockface_ret_t (*init_recognizer)(rockface_handle_t handle);
+    rockface_ret_t (*init_detector)(rockface_handle_t handle, int version);
+    rockface_ret_t (*init_landmark)(rockface_handle_t handle, int count);
+    rockface_ret_t (*init_liveness_detector)(rockface_handle_t handle);
+    /* the mask members are only used, and may be NULL, without FACE_MASK */
+    rockface_ret_t (*init_mask_recognizer)(rockface_handle_t handle);
+    rockface_ret_t (*init_mask_classifier)(rockface_handle_t handle);
+
+    rockface_ret_t (*detect)(rockface_handle_t handle, rockface_image_t *image,
+                             rockface_det_array_t *face_array);
+    rockface_ret_t (*track)(rockface_handle_t handle, rockface_image_t *image, int track_frame,
+                            rockface_det_array_t *in_array, rockface_det_array_t *out_array);
+    rockface_ret_t (*landmark5)(rockface_handle_t handle, rockface_image_t *image,
+                                rockface_rect_t *box, rockface_landmark_t *landmark);
+    rockface_ret_t (*landmark106)(rockface_handle_t handle, rockface_image_t *image,
+                                  rockface_rect_t *box, rockface_landmark_t *landmark5,
+                                  rockface_landmark_t *landmark, rockface_angle_t *angle);
+    rockface_ret_t (*mask_classifier)(rockface_handle_t handle, rockface_image_t *image,
+                                      rockface_rect_t *box, float *score);
+    rockface_ret_t (*align)(rockface_handle_t handle, rockface_image_t *image, rockface_rect_t *box,
+                            rockface_landmark_t *landmark, rockface_image_t *out_image);
+    rockface_ret_t (*feature_extract)(rockface_handle_t handle, rockface_image_t *image,
+                                      rockface_feature_t *feature);
+    rockface_ret_t (*mask_feature_extract)(rockface_handle_t handle, rockface_image_t *image,
+                                           rockface_rect_t *box, int mask,
+                                           rockface_feature_float_t *feature);
+    rockface_ret_t (*feature_compare)(rockface_feature_t *a, rockface_feature_t *b, float *similarity);
+    rockface_ret_t (*feature_search)(rockface_handle_t handle, rockface_feature_t *feature,
+                                     float threshold, rockface_search_result_t *result);
+    rockface_ret_t (*library_init)(rockface_handle_t handle, int type, void *data,
+                                   int num, size_t size, size_t offset);
+    rockface_ret_t (*library_release)(rockface_handle_t handle);
+    rockface_ret_t (*liveness_detect)(rockface_handle_t handle, rockface_image_t *image,
+                                      rockface_rect_t *box, rockface_liveness_t *result);
+    rockface_ret_t (*image_read)(const char *path, rockface_image_t *image, int flag);
+    rockface_ret_t (*image_release)(rockface_image_t *image);
+};
+
+#ifdef FACE_BACKEND_ROCKFACE
+extern const struct face_backend face_backend_rockface;
+#endif
+extern const struct face_backend face_backend_mock;
+
+/* simulated model latency of the mock backend in us, 0 means no delay */
+struct face_mock_cost {
+    int detect;
+    int landmark;
+    int extract;
+    int liveness;
+};
+
+void face_mock_set_cost(const struct face_mock_cost *cost);
+void face_mock_get_cost(struct face_mock_cost *cost);
+
+const struct face_backend *face_backend_get(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
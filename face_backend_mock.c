@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+/*
+ * Deterministic mock backend, builds on any Linux host. Results only depend
+ * on the pixels passed in: the detector reports the brightest block of the
+ * frame as a face, features are a coarse luma signature of the aligned
+ * face. Model latency is simulated by sleeping, like an NPU leaving the
+ * CPU idle, see struct face_mock_cost.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <rockface/rockface.h>
+
+#include "face_backend.h"
+
+#define GRID 8
+#define ALIGN_SIZE 112
+#define FEATURE_LEN 512
+#define FACE_MIN_LUMA 64
+#define MOCK_IMAGE_WIDTH 640
+#define MOCK_IMAGE_HEIGHT 480
+
+struct mock_library {
+    char *data;
+    int num;
+    size_t size;
+    size_t offset;
+};
+
+struct mock_handle {
+    struct mock_library library[2];
+};
+
+/* roughly what the models take on the NPU */
+static struct face_mock_cost g_cost = {
+    .detect = 20000,
+    .landmark = 2000,
+    .extract = 10000,
+    .liveness = 5000,
+};
+
+static void mock_delay(int us)
+{
+    struct timespec ts;
+
+    if (us <= 0)
+        return;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts))
+        ;
+}
+
+static rockface_ret_t mock_image_release(rockface_image_t *image);
+
+static int luma(rockface_image_t *image, int x, int y)
+{
+    uint8_t *p;
+
+    if (image->pixel_format == ROCKFACE_PIXEL_FORMAT_GRAY8)
+        return image->data[y * image->width + x];
+    p = image->data + (y * image->width + x) * 3;
+    return (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8;
+}
+
+static int block_mean(rockface_image_t *image, int left, int top, int right, int bottom)
+{
+    int sum = 0;
+    int cnt = 0;
+
+    for (int y = top; y < bottom; y += 4) {
+        for (int x = left; x < right; x += 4) {
+            sum += luma(image, x, y);
+            cnt++;
+        }
+    }
+    return cnt ? sum / cnt : 0;
+}
+
+static rockface_handle_t mock_create_handle(void)
+{
+    return calloc(1, sizeof(struct mock_handle));
+}
+
+static rockface_ret_t mock_release_handle(rockface_handle_t handle)
+{
+    free(handle);
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_set_licence(rockface_handle_t handle, const char *path)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_set_data_path(rockface_handle_t handle, const char *path)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_init_recognizer(rockface_handle_t handle)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_init_detector(rockface_handle_t handle, int version)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_init_landmark(rockface_handle_t handle, int count)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_init_liveness_detector(rockface_handle_t handle)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_init_mask_recognizer(rockface_handle_t handle)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_init_mask_classifier(rockface_handle_t handle)
+{
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_detect(rockface_handle_t handle, rockface_image_t *image,
+                                  rockface_det_array_t *face_array)
+{
+    int bw = image->width / GRID;
+    int bh = image->height / GRID;
+    int best = 0, bx = 0, by = 0;
+    rockface_rect_t *box;
+
+    mock_delay(g_cost.detect);
+    memset(face_array, 0, sizeof(*face_array));
+    if (!bw || !bh)
+        return ROCKFACE_RET_FAIL;
+
+    for (int y = 0; y < GRID; y++) {
+        for (int x = 0; x < GRID; x++) {
+            int mean = block_mean(image, x * bw, y * bh, (x + 1) * bw, (y + 1) * bh);
+            if (mean > best) {
+                best = mean;
+                bx = x;
+                by = y;
+            }
+        }
+    }
+    if (best < FACE_MIN_LUMA)
+        return ROCKFACE_RET_SUCCESS;
+
+    /* a face spans the brightest block and half of its neighbours */
+    box = &face_array->face[0].box;
+    box->left = bx * bw - bw / 2 > 0 ? bx * bw - bw / 2 : 1;
+    box->top = by * bh - bh / 2 > 0 ? by * bh - bh / 2 : 1;
+    box->right = box->left + bw * 2 < (int)image->width ? box->left + bw * 2 : image->width - 1;
+    box->bottom = box->top + bh * 2 < (int)image->height ? box->top + bh * 2 : image->height - 1;
+    face_array->count = 1;
+    face_array->face[0].score = 0.5 + best / 512.0;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_track(rockface_handle_t handle, rockface_image_t *image, int track_frame,
+                                 rockface_det_array_t *in_array, rockface_det_array_t *out_array)
+{
+    *out_array = *in_array;
+    for (int i = 0; i < out_array->count; i++)
+        out_array->face[i].id = i + 1;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_landmark5(rockface_handle_t handle, rockface_image_t *image,
+                                     rockface_rect_t *box, rockface_landmark_t *landmark)
+{
+    int w = box->right - box->left;
+    int h = box->bottom - box->top;
+    static const int pos[5][2] = {{3, 4}, {7, 4}, {5, 6}, {4, 8}, {6, 8}};
+
+    mock_delay(g_cost.landmark);
+    memset(landmark, 0, sizeof(*landmark));
+    landmark->image_width = image->width;
+    landmark->image_height = image->height;
+    landmark->landmarks_count = 5;
+    for (int i = 0; i < 5; i++) {
+        landmark->landmarks[i].x = box->left + w * pos[i][0] / 10;
+        landmark->landmarks[i].y = box->top + h * pos[i][1] / 10;
+    }
+    landmark->score = 0.9;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_landmark106(rockface_handle_t handle, rockface_image_t *image,
+                                       rockface_rect_t *box, rockface_landmark_t *landmark5,
+                                       rockface_landmark_t *landmark, rockface_angle_t *angle)
+{
+    mock_delay(g_cost.landmark);
+    memset(landmark, 0, sizeof(*landmark));
+    landmark->image_width = image->width;
+    landmark->image_height = image->height;
+    landmark->landmarks_count = 106;
+    landmark->score = 0.9;
+    memset(angle, 0, sizeof(*angle));
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_mask_classifier(rockface_handle_t handle, rockface_image_t *image,
+                                           rockface_rect_t *box, float *score)
+{
+    *score = 0;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_align(rockface_handle_t handle, rockface_image_t *image,
+                                 rockface_rect_t *box, rockface_landmark_t *landmark,
+                                 rockface_image_t *out_image)
+{
+    int w = box->right - box->left;
+    int h = box->bottom - box->top;
+
+    if (w <= 0 || h <= 0)
+        return ROCKFACE_RET_FAIL;
+
+    out_image->width = ALIGN_SIZE;
+    out_image->height = ALIGN_SIZE;
+    out_image->pixel_format = ROCKFACE_PIXEL_FORMAT_GRAY8;
+    out_image->size = ALIGN_SIZE * ALIGN_SIZE;
+    out_image->is_prealloc_buf = 0;
+    out_image->data = (uint8_t *)malloc(out_image->size);
+    if (!out_image->data)
+        return ROCKFACE_RET_FAIL;
+
+    for (int y = 0; y < ALIGN_SIZE; y++) {
+        for (int x = 0; x < ALIGN_SIZE; x++) {
+            int sx = box->left + x * w / ALIGN_SIZE;
+            int sy = box->top + y * h / ALIGN_SIZE;
+            if (sx >= (int)image->width)
+                sx = image->width - 1;
+            if (sy >= (int)image->height)
+                sy = image->height - 1;
+            out_image->data[y * ALIGN_SIZE + x] = luma(image, sx, sy);
+        }
+    }
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static void signature(rockface_image_t *image, int *out)
+{
+    /* 16x32 cells of the aligned face */
+    int cw = image->width / 16;
+    int ch = image->height / 32;
+
+    for (int i = 0; i < FEATURE_LEN; i++) {
+        int x = i % 16;
+        int y = i / 16;
+        out[i] = (cw && ch) ? block_mean(image, x * cw, y * ch, (x + 1) * cw, (y + 1) * ch) : 0;
+    }
+}
+
+static rockface_ret_t mock_feature_extract(rockface_handle_t handle, rockface_image_t *image,
+                                           rockface_feature_t *feature)
+{
+    int sig[FEATURE_LEN];
+
+    mock_delay(g_cost.extract);
+    signature(image, sig);
+    feature->version = ROCKFACE_RECOG_NORMAL;
+    feature->len = FEATURE_LEN;
+    for (int i = 0; i < FEATURE_LEN; i++)
+        feature->feature[i] = sig[i];
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_mask_feature_extract(rockface_handle_t handle, rockface_image_t *image,
+                                                rockface_rect_t *box, int mask,
+                                                rockface_feature_float_t *feature)
+{
+    rockface_image_t face;
+    int sig[FEATURE_LEN];
+
+    mock_delay(g_cost.extract);
+    memset(feature, 0, sizeof(*feature));
+    feature->version = ROCKFACE_RECOG_MASK;
+    feature->len = FEATURE_LEN;
+    if (mock_align(handle, image, box, NULL, &face))
+        return ROCKFACE_RET_FAIL;
+    signature(&face, sig);
+    mock_image_release(&face);
+    for (int i = 0; i < FEATURE_LEN; i++)
+        feature->feature[i] = sig[i] / 255.0f;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static float distance(void *a, void *b, int mask)
+{
+    float sum = 0;
+
+    for (int i = 0; i < FEATURE_LEN; i++) {
+        float d;
+        if (mask)
+            d = ((rockface_feature_float_t *)a)->feature[i] - ((rockface_feature_float_t *)b)->feature[i];
+        else
+            d = (((rockface_feature_t *)a)->feature[i] - ((rockface_feature_t *)b)->feature[i]) / 255.0f;
+        sum += d * d;
+    }
+    return sqrtf(sum / FEATURE_LEN);
+}
+
+static rockface_ret_t mock_feature_compare(rockface_feature_t *a, rockface_feature_t *b, float *similarity)
+{
+    *similarity = distance(a, b, a->version == ROCKFACE_RECOG_MASK);
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_feature_search(rockface_handle_t handle, rockface_feature_t *feature,
+                                          float threshold, rockface_search_result_t *result)
+{
+    struct mock_handle *h = (struct mock_handle *)handle;
+    int mask = feature->version == ROCKFACE_RECOG_MASK;
+    struct mock_library *lib = &h->library[mask];
+    float best = threshold;
+    void *found = NULL;
+
+    for (int i = 0; i < lib->num; i++) {
+        char *data = lib->data + i * lib->size;
+        float d = distance(feature, data + lib->offset, mask);
+        if (d < best) {
+            best = d;
+            found = data;
+        }
+    }
+    if (!found)
+        return ROCKFACE_RET_FAIL;
+    result->face_data = found;
+    result->similarity = best;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_library_init(rockface_handle_t handle, int type, void *data,
+                                              int num, size_t size, size_t offset)
+{
+    struct mock_handle *h = (struct mock_handle *)handle;
+
+    if (type != ROCKFACE_RECOG_NORMAL && type != ROCKFACE_RECOG_MASK)
+        return ROCKFACE_RET_FAIL;
+    h->library[type].data = (char *)data;
+    h->library[type].num = num;
+    h->library[type].size = size;
+    h->library[type].offset = offset;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_library_release(rockface_handle_t handle)
+{
+    struct mock_handle *h = (struct mock_handle *)handle;
+
+    memset(h->library, 0, sizeof(h->library));
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_liveness_detect(rockface_handle_t handle, rockface_image_t *image,
+                                           rockface_rect_t *box, rockface_liveness_t *result)
+{
+    mock_delay(g_cost.liveness);
+    result->real_score = 0.9;
+    result->fake_score = 0.1;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+/* no decoder on the host, the leading file bytes are taken as RGB pixels */
+static rockface_ret_t mock_image_read(const char *path, rockface_image_t *image, int flag)
+{
+    const size_t size = MOCK_IMAGE_WIDTH * MOCK_IMAGE_HEIGHT * 3;
+    FILE *fp;
+    size_t len;
+
+    memset(image, 0, sizeof(*image));
+    fp = fopen(path, "rb");
+    if (!fp)
+        return ROCKFACE_RET_FAIL;
+    image->data = (uint8_t *)calloc(1, size);
+    if (!image->data) {
+        fclose(fp);
+        return ROCKFACE_RET_FAIL;
+    }
+    len = fread(image->data, 1, size, fp);
+    fclose(fp);
+    if (!len) {
+        mock_image_release(image);
+        return ROCKFACE_RET_FAIL;
+    }
+    image->width = MOCK_IMAGE_WIDTH;
+    image->height = MOCK_IMAGE_HEIGHT;
+    image->pixel_format = ROCKFACE_PIXEL_FORMAT_RGB888;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+static rockface_ret_t mock_image_release(rockface_image_t *image)
+{
+    if (image->data && !image->is_prealloc_buf)
+        free(image->data);
+    image->data = NULL;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+void face_mock_set_cost(const struct face_mock_cost *cost)
+{
+    g_cost = *cost;
+}
+
+void face_mock_get_cost(struct face_mock_cost *cost)
+{
+    *cost = g_cost;
+}
+
+const struct face_backend face_backend_mock = {
+    .name = "mock",
+    .create_handle = mock_create_handle,
+    .release_handle = mock_release_handle,
+    .set_licence = mock_set_licence,
+    .set_data_path = mock_set_data_path,
+    .init_recognizer = mock_init_recognizer,
+    .init_detector = mock_init_detector,
+    .init_landmark = mock_init_landmark,
+    .init_liveness_detector = mock_init_liveness_detector,
+    .init_mask_recognizer = mock_init_mask_recognizer,
+    .init_mask_classifier = mock_init_mask_classifier,
+    .detect = mock_detect,
+    .track = mock_track,
+    .landmark5 = mock_landmark5,
+    .landmark106 = mock_landmark106,
+    .mask_classifier = mock_mask_classifier,
+    .align = mock_align,
+    .feature_extract = mock_feature_extract,
+    .mask_feature_extract = mock_mask_feature_extract,
+    .feature_compare = mock_feature_compare,
+    .feature_search = mock_feature_search,
+    .library_init = mock_library_init,
+    .library_release = mock_library_release,
+    .liveness_detect = mock_liveness_detect,
+    .image_read = mock_image_read,
+    .image_release = mock_image_release,
+};
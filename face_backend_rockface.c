@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "face_backend.h"
+
+const struct face_backend face_backend_rockface = {
+    .name = "rockface",
+    .create_handle = rockface_create_handle,
+    .release_handle = rockface_release_handle,
+    .set_licence = rockface_set_licence,
+    .set_data_path = rockface_set_data_path,
+    .init_recognizer = rockface_init_recognizer,
+    .init_detector = rockface_init_detector2,
+    .init_landmark = rockface_init_landmark,
+    .init_liveness_detector = rockface_init_liveness_detector,
+#ifdef FACE_MASK
+    .init_mask_recognizer = rockface_init_mask_recognizer,
+    .init_mask_classifier = rockface_init_mask_classifier,
+#endif
+    .detect = rockface_detect,
+    .track = rockface_track,
+    .landmark5 = rockface_landmark5,
+    .landmark106 = rockface_landmark106,
+#ifdef FACE_MASK
+    .mask_classifier = rockface_mask_classifier,
+#endif
+    .align = rockface_align,
+    .feature_extract = rockface_feature_extract,
+#ifdef FACE_MASK
+    .mask_feature_extract = rockface_mask_feature_extract,
+#endif
+    .feature_compare = rockface_feature_compare,
+    .feature_search = rockface_feature_search,
+    .library_init = rockface_face_library_init2,
+    .library_release = rockface_face_library_release,
+    .liveness_detect = rockface_liveness_detect,
+    .image_read = rockface_image_read,
+    .image_release = rockface_image_release,
+};
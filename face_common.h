@@ -41,10 +41,15 @@ extern "C" {
 
 #include "rockface_control.h"
 
+#ifndef PRE_PATH
 #define PRE_PATH "/oem"
+#endif
+#ifndef BAK_PATH
 #define BAK_PATH "/userdata"
+#endif
 #define DATABASE_PATH PRE_PATH "/face_data.db"
 #define BAK_DATABASE_PATH BAK_PATH "/face_data.db"
+#define GALLERY_PATH PRE_PATH "/face_gallery.bin"
 #define NAME_LEN 256
 #define USER_NAME "User"
 
@@ -30,17 +30,196 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
 #include "face_config.h"
 
-struct face_config g_face_config;
+/*
+ * A published snapshot with the references readers hold on it. A retired
+ * one is freed by whoever drops the last reference, the publisher or the
+ * last reader.
+ */
+struct face_config_ref {
+    struct face_config_snapshot s;
+    int ref;
+};
+
+static struct face_config_ref g_default = {
+    .s = {
+        .live_det_en = true,
+        .rec_score = FACE_SIMILARITY_SCORE,
+        .mask_score = FACE_MASK_SIMILARITY_SCORE,
+        .det_score = FACE_DETECT_SCORE,
+        .live_score = FACE_REAL_SCORE,
+        .min_pixel = -1,
+    },
+    /* the published one holds a reference, the default is never freed */
+    .ref = 2,
+};
+static struct face_config_ref *g_snapshot = &g_default;
+static struct face_config g_cfg;
+static int g_width, g_height, g_ratio;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+/* only guards the reference counts, readers never wait on a publish */
+static pthread_mutex_t g_ref_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static float face_config_similarity(int th)
+{
+    th = th < 1 ? 1 : th;
+    th = th > 100 ? 100 : th;
+    return log(100.0 / (th * 1.0)) / log(2);
+}
+
+static void face_config_build(struct face_config_snapshot *s)
+{
+    const struct face_config *c = &g_cfg;
+    int x = 0, y = 0, w = g_width, h = g_height, nw = g_width, nh = g_height;
+
+    memset(s, 0, sizeof(*s));
+    memcpy(&s->cfg, c, sizeof(s->cfg));
+    s->width = g_width;
+    s->height = g_height;
+    s->ratio = g_ratio > 0 ? g_ratio : 1;
+    s->live_det_en = c->en ? c->live_det_en : true;
+    s->rec_score = c->en ? face_config_similarity(c->face_rec_th) : FACE_SIMILARITY_SCORE;
+    s->mask_score = c->en ? face_config_similarity(c->face_mask_th) : FACE_MASK_SIMILARITY_SCORE;
+    s->det_score = c->en ? c->face_det_th * 1.0 / 100.0 : FACE_DETECT_SCORE;
+    s->live_score = c->en ? c->live_det_th * 1.0 / 100.0 : FACE_REAL_SCORE;
+    s->min_pixel = c->en && g_width > 0 ? c->min_pixel : -1;
+
+    if (c->en) {
+        x = c->corner_x;
+        y = c->corner_y;
+        w = c->det_width;
+        h = c->det_height;
+        nw = c->nor_width;
+        nh = c->nor_height;
+    }
+    if (nw <= 0 || nh <= 0)
+        return;
+
+    x = x * g_width / nw;
+    y = y * g_height / nh;
+    w = w * g_width / nw;
+    h = h * g_height / nh;
+    if (x + w > g_width)
+        w = g_width - x;
+    if (y + h > g_height)
+        h = g_height - y;
+    if (w <= 0 || h <= 0)
+        return;
+
+    s->region_en = true;
+    s->region[0] = x;
+    s->region[1] = y;
+    s->region[2] = w;
+    s->region[3] = h;
+    s->det_region[0] = x / s->ratio;
+    s->det_region[1] = y / s->ratio;
+    s->det_region[2] = w / s->ratio;
+    s->det_region[3] = h / s->ratio;
+}
+
+static void face_config_unref(struct face_config_ref *r)
+{
+    int ref;
+
+    pthread_mutex_lock(&g_ref_lock);
+    ref = --r->ref;
+    pthread_mutex_unlock(&g_ref_lock);
+    if (!ref)
+        free(r);
+}
+
+/* call with g_lock held */
+static void face_config_update(void)
+{
+    struct face_config_ref *r, *old;
+
+    r = (struct face_config_ref *)malloc(sizeof(*r));
+    if (!r) {
+        printf("%s: no memory\n", __func__);
+        return;
+    }
+    face_config_build(&r->s);
+    r->ref = 1;
+    pthread_mutex_lock(&g_ref_lock);
+    old = g_snapshot;
+    g_snapshot = r;
+    pthread_mutex_unlock(&g_ref_lock);
+    face_config_unref(old);
+}
+
+void face_config_publish(const struct face_config *cfg)
+{
+    pthread_mutex_lock(&g_lock);
+    memcpy(&g_cfg, cfg, sizeof(g_cfg));
+    face_config_update();
+    pthread_mutex_unlock(&g_lock);
+}
+
+void face_config_set_frame(int width, int height, int ratio)
+{
+    pthread_mutex_lock(&g_lock);
+    g_width = width;
+    g_height = height;
+    g_ratio = ratio;
+    face_config_update();
+    pthread_mutex_unlock(&g_lock);
+}
+
+const struct face_config_snapshot *face_config_get(void)
+{
+    struct face_config_ref *r;
+
+    pthread_mutex_lock(&g_ref_lock);
+    r = g_snapshot;
+    r->ref++;
+    pthread_mutex_unlock(&g_ref_lock);
+    return &r->s;
+}
+
+void face_config_put(const struct face_config_snapshot *s)
+{
+    if (s)
+        face_config_unref((struct face_config_ref *)s);
+}
+
+void face_config_read(struct face_config_snapshot *s)
+{
+    const struct face_config_snapshot *cur = face_config_get();
+
+    memcpy(s, cur, sizeof(*s));
+    face_config_put(cur);
+}
+
+void face_config_copy(struct face_config *cfg)
+{
+    pthread_mutex_lock(&g_lock);
+    memcpy(cfg, &g_cfg, sizeof(*cfg));
+    pthread_mutex_unlock(&g_lock);
+}
+
+int face_config_min_pixel(const struct face_config_snapshot *s, int img_width)
+{
+    if (s->min_pixel < 0)
+        return MIN_FACE_WIDTH(img_width);
+    return s->min_pixel * img_width / s->width;
+}
 
 #define GET_FACE_CONFIG_FUNC(val) \
     bool get_face_config_##val(int *arg) \
     { \
-        if (!g_face_config.en) \
-            return false; \
-        *arg = g_face_config.val; \
-        return true; \
+        const struct face_config_snapshot *s = face_config_get(); \
+        bool en = s->cfg.en; \
+        if (en) \
+            *arg = s->cfg.val; \
+        face_config_put(s); \
+        return en; \
     }
 
 GET_FACE_CONFIG_FUNC(volume)
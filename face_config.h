@@ -38,6 +38,12 @@ extern "C" {
 
 #include <stdbool.h>
 
+#define FACE_DETECT_SCORE 0.55 /* range 0 - 1.0, higher score means higher expectation */
+#define FACE_MASK_SIMILARITY_SCORE 1.05 /* suggest range 1.05 ~ 1.12, lower score means need higher similarity to recognize */
+#define FACE_SIMILARITY_SCORE 1.0 /* suggest range 0.7 ~ 1.3, lower score means need higher similarity to recognize */
+#define FACE_REAL_SCORE 0.5 /* range 0 - 1.0, higher score means higher expectation */
+#define MIN_FACE_WIDTH(w) ((w) / 5)
+
 struct face_config {
     bool en;
     int volume;
@@ -55,7 +61,37 @@ struct face_config {
     int nor_height;
 };
 
-extern struct face_config g_face_config;
+/*
+ * Immutable view of the config with everything the detect and feature
+ * threads need already derived. A new one is published whole whenever the
+ * config or the frame size changes, so readers never see a half update.
+ * face_config_get() takes a reference that face_config_put() drops, a
+ * replaced snapshot is freed with its last reference.
+ */
+struct face_config_snapshot {
+    struct face_config cfg;
+    int width;
+    int height;
+    int ratio;
+    bool live_det_en;
+    float rec_score;
+    float mask_score;
+    float det_score;
+    float live_score;
+    int min_pixel; /* in frame pixels, < 0 uses MIN_FACE_WIDTH */
+    bool region_en;
+    int region[4]; /* x, y, w, h in frame pixels */
+    int det_region[4]; /* the same region divided by ratio */
+};
+
+void face_config_publish(const struct face_config *cfg);
+void face_config_set_frame(int width, int height, int ratio);
+const struct face_config_snapshot *face_config_get(void);
+void face_config_put(const struct face_config_snapshot *s);
+/* a copy of the current snapshot, nothing to put */
+void face_config_read(struct face_config_snapshot *s);
+void face_config_copy(struct face_config *cfg);
+int face_config_min_pixel(const struct face_config_snapshot *s, int img_width);
 
 bool get_face_config_nor_height(int *height);
 bool get_face_config_nor_width(int *width);
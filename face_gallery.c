@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "face_common.h"
+#include "face_gallery.h"
+
+#define GALLERY_MAGIC "RKFG"
+#define GALLERY_VERSION 1
+#define GALLERY_ALIGN 4096
+
+struct face_gallery_header {
+    char magic[4];
+    int version;
+    int cnt;
+    int face_size;
+    int face_num;
+    int mask_size;
+    int mask_num;
+    unsigned int checksum;
+    struct face_gallery_stamp stamp;
+};
+
+static size_t face_gallery_align(size_t size)
+{
+    return (size + GALLERY_ALIGN - 1) & ~(size_t)(GALLERY_ALIGN - 1);
+}
+
+static size_t face_gallery_face_off(void)
+{
+    return face_gallery_align(sizeof(struct face_gallery_header));
+}
+
+static size_t face_gallery_mask_off(int cnt)
+{
+    return face_gallery_face_off() + face_gallery_align((size_t)cnt * sizeof(struct face_data));
+}
+
+static size_t face_gallery_len(int cnt)
+{
+    return face_gallery_mask_off(cnt) + face_gallery_align((size_t)cnt * sizeof(struct mask_data));
+}
+
+/* FNV-1a over 32 bit words, the entry sizes are multiples of 4 */
+static unsigned int face_gallery_checksum(unsigned int hash, const void *data, size_t size)
+{
+    const uint32_t *p = (const uint32_t *)data;
+
+    for (size_t i = 0; i < size / 4; i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+int face_gallery_stamp(const char *db_path, struct face_gallery_stamp *stamp)
+{
+    struct stat st;
+
+    memset(stamp, 0, sizeof(struct face_gallery_stamp));
+    if (stat(db_path, &st))
+        return -1;
+    stamp->size = st.st_size;
+    stamp->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+int face_gallery_map(struct face_gallery *gallery, const char *path, const char *db_path, int cnt)
+{
+    struct face_gallery_header header;
+    struct face_gallery_stamp stamp;
+    struct stat st;
+    unsigned int checksum;
+    void *addr;
+    int fd;
+
+    memset(gallery, 0, sizeof(struct face_gallery));
+    if (face_gallery_stamp(db_path, &stamp))
+        return -1;
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) || st.st_size != (off_t)face_gallery_len(cnt) ||
+            read(fd, &header, sizeof(header)) != sizeof(header) ||
+            memcmp(header.magic, GALLERY_MAGIC, sizeof(header.magic)) ||
+            header.version != GALLERY_VERSION || header.cnt != cnt ||
+            header.face_size != sizeof(struct face_data) || header.mask_size != sizeof(struct mask_data) ||
+            header.face_num < 0 || header.face_num > cnt || header.mask_num < 0 || header.mask_num > cnt ||
+            memcmp(&header.stamp, &stamp, sizeof(stamp))) {
+        printf("%s: %s is stale\n", __func__, path);
+        close(fd);
+        return -1;
+    }
+    /* private so that in place inserts and compaction stay in memory */
+    addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        printf("%s: mmap %s fail!\n", __func__, path);
+        return -1;
+    }
+
+    gallery->addr = addr;
+    gallery->len = st.st_size;
+    gallery->face = (char *)addr + face_gallery_face_off();
+    gallery->face_num = header.face_num;
+    gallery->mask = (char *)addr + face_gallery_mask_off(cnt);
+    gallery->mask_num = header.mask_num;
+
+    checksum = face_gallery_checksum(2166136261u, gallery->face, (size_t)header.face_num * header.face_size);
+    checksum = face_gallery_checksum(checksum, gallery->mask, (size_t)header.mask_num * header.mask_size);
+    if (checksum != header.checksum) {
+        printf("%s: %s checksum mismatch!\n", __func__, path);
+        face_gallery_unmap(gallery);
+        return -1;
+    }
+    return 0;
+}
+
+void face_gallery_unmap(struct face_gallery *gallery)
+{
+    if (gallery->addr)
+        munmap(gallery->addr, gallery->len);
+    memset(gallery, 0, sizeof(struct face_gallery));
+}
+
+static int face_gallery_write(int fd, off_t off, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+
+    while (size) {
+        ssize_t ret = pwrite(fd, p, size, off);
+        if (ret <= 0)
+            return -1;
+        p += ret;
+        off += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+/* written next to path and renamed over it, a reader never sees half a file */
+int face_gallery_save(const char *path, const struct face_gallery_stamp *stamp, int cnt,
+                      const void *face, int face_num, const void *mask, int mask_num)
+{
+    struct face_gallery_header header;
+    char tmp[NAME_LEN];
+    int fd;
+    int ret;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GALLERY_MAGIC, sizeof(header.magic));
+    header.version = GALLERY_VERSION;
+    header.cnt = cnt;
+    header.face_size = sizeof(struct face_data);
+    header.face_num = face_num;
+    header.mask_size = sizeof(struct mask_data);
+    header.mask_num = mask ? mask_num : 0;
+    header.checksum = face_gallery_checksum(2166136261u, face, (size_t)face_num * header.face_size);
+    header.checksum = face_gallery_checksum(header.checksum, mask, (size_t)header.mask_num * header.mask_size);
+    header.stamp = *stamp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("%s: open %s fail!\n", __func__, tmp);
+        return -1;
+    }
+    /* the unused tail of both regions stays a hole */
+    ret = ftruncate(fd, face_gallery_len(cnt));
+    if (!ret)
+        ret = face_gallery_write(fd, 0, &header, sizeof(header));
+    if (!ret)
+        ret = face_gallery_write(fd, face_gallery_face_off(), face, (size_t)face_num * header.face_size);
+    if (!ret)
+        ret = face_gallery_write(fd, face_gallery_mask_off(cnt), mask, (size_t)header.mask_num * header.mask_size);
+    if (!ret)
+        ret = fsync(fd);
+    close(fd);
+    if (ret || rename(tmp, path)) {
+        printf("%s: write %s fail!\n", __func__, path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __FACE_GALLERY_H__
+#define __FACE_GALLERY_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*
+ * Binary copy of the face library, page aligned so it can be mapped
+ * directly as g_face_data/g_mask_data at boot. The header keeps the size
+ * and mtime of the database it was written from, a mapping is refused
+ * when the database changed since. The mapping is private, writes to it
+ * never reach the file.
+ */
+struct face_gallery_stamp {
+    long long size;
+    long long mtime;
+};
+
+struct face_gallery {
+    void *addr;
+    size_t len;
+    void *face;
+    int face_num;
+    void *mask;
+    int mask_num;
+};
+
+int face_gallery_map(struct face_gallery *gallery, const char *path, const char *db_path, int cnt);
+void face_gallery_unmap(struct face_gallery *gallery);
+int face_gallery_stamp(const char *db_path, struct face_gallery_stamp *stamp);
+int face_gallery_save(const char *path, const struct face_gallery_stamp *stamp, int cnt,
+                      const void *face, int face_num, const void *mask, int mask_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
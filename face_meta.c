@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "face_meta.h"
+
+#define META_MIN_CAP 256
+#define META_EMPTY (-1)
+#define META_DEAD (-2)
+
+struct meta_entry {
+    int id;
+    unsigned int flags;
+    char *name;
+};
+
+/* open addressing with linear probing, ids are >= 0 */
+static struct meta_entry *g_meta;
+static unsigned int g_meta_cap;
+static unsigned int g_meta_num;
+static unsigned int g_meta_used;
+static pthread_mutex_t g_meta_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int face_meta_hash(int id)
+{
+    return ((unsigned int)id * 2654435761u) & (g_meta_cap - 1);
+}
+
+static struct meta_entry *face_meta_find(int id)
+{
+    unsigned int i;
+
+    if (!g_meta_cap)
+        return NULL;
+    for (i = face_meta_hash(id); g_meta[i].id != META_EMPTY; i = (i + 1) & (g_meta_cap - 1)) {
+        if (g_meta[i].id == id)
+            return &g_meta[i];
+    }
+    return NULL;
+}
+
+static int face_meta_resize(unsigned int cap)
+{
+    struct meta_entry *old = g_meta;
+    unsigned int old_cap = g_meta_cap;
+    struct meta_entry *meta;
+
+    meta = (struct meta_entry *)malloc(cap * sizeof(struct meta_entry));
+    if (!meta)
+        return -1;
+    for (unsigned int i = 0; i < cap; i++)
+        meta[i].id = META_EMPTY;
+
+    g_meta = meta;
+    g_meta_cap = cap;
+    g_meta_used = g_meta_num;
+    /* tombstones are left behind */
+    for (unsigned int i = 0; i < old_cap; i++) {
+        unsigned int j;
+
+        if (old[i].id < 0)
+            continue;
+        for (j = face_meta_hash(old[i].id); g_meta[j].id != META_EMPTY; j = (j + 1) & (cap - 1))
+            ;
+        g_meta[j] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+int face_meta_set(int id, const char *name)
+{
+    struct meta_entry *e;
+    char *n;
+    unsigned int i;
+
+    if (id < 0 || !name)
+        return -1;
+    n = strdup(name);
+    if (!n)
+        return -1;
+
+    pthread_mutex_lock(&g_meta_lock);
+    e = face_meta_find(id);
+    if (!e) {
+        /* keep the table at most 3/4 full, tombstones included */
+        if ((g_meta_used + 1) * 4 > g_meta_cap * 3) {
+            unsigned int cap = g_meta_cap ? g_meta_cap : META_MIN_CAP;
+
+            while ((g_meta_num + 1) * 2 > cap)
+                cap *= 2;
+            if (face_meta_resize(cap)) {
+                pthread_mutex_unlock(&g_meta_lock);
+                free(n);
+                return -1;
+            }
+        }
+        for (i = face_meta_hash(id); g_meta[i].id >= 0; i = (i + 1) & (g_meta_cap - 1))
+            ;
+        e = &g_meta[i];
+        if (e->id == META_EMPTY)
+            g_meta_used++;
+        e->id = id;
+        e->name = NULL;
+        g_meta_num++;
+    }
+    free(e->name);
+    e->name = n;
+    e->flags = strstr(n, "black_list") ? FACE_META_BLACK_LIST : 0;
+    pthread_mutex_unlock(&g_meta_lock);
+
+    return 0;
+}
+
+void face_meta_remove(int id)
+{
+    struct meta_entry *e;
+
+    pthread_mutex_lock(&g_meta_lock);
+    e = face_meta_find(id);
+    if (e) {
+        free(e->name);
+        e->name = NULL;
+        e->id = META_DEAD;
+        g_meta_num--;
+    }
+    pthread_mutex_unlock(&g_meta_lock);
+}
+
+void face_meta_clear(void)
+{
+    pthread_mutex_lock(&g_meta_lock);
+    for (unsigned int i = 0; i < g_meta_cap; i++) {
+        if (g_meta[i].id >= 0)
+            free(g_meta[i].name);
+    }
+    free(g_meta);
+    g_meta = NULL;
+    g_meta_cap = 0;
+    g_meta_num = 0;
+    g_meta_used = 0;
+    pthread_mutex_unlock(&g_meta_lock);
+}
+
+bool face_meta_get(int id, struct face_meta *meta)
+{
+    struct meta_entry *e;
+
+    pthread_mutex_lock(&g_meta_lock);
+    e = id >= 0 ? face_meta_find(id) : NULL;
+    if (e && meta) {
+        meta->id = id;
+        meta->flags = e->flags;
+        /* zero padded, callers compare whole names */
+        strncpy(meta->name, e->name, sizeof(meta->name) - 1);
+        meta->name[sizeof(meta->name) - 1] = 0;
+    }
+    pthread_mutex_unlock(&g_meta_lock);
+
+    return e != NULL;
+}
+
+int face_meta_count(void)
+{
+    int num;
+
+    pthread_mutex_lock(&g_meta_lock);
+    num = g_meta_num;
+    pthread_mutex_unlock(&g_meta_lock);
+    return num;
+}
@@ -0,0 +1,982 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <math.h>
+#include <pthread.h>
+#include <float.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SEARCH_NEON
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SEARCH_X86
+#endif
+
+#include "face_search.h"
+#include "rkfacial.h"
+
+#define U8_DIM ((int)sizeof(((rockface_feature_t *)0)->feature))
+#define F32_DIM ((int)(sizeof(((rockface_feature_float_t *)0)->feature) / sizeof(float)))
+
+/* pairs needed before the backend metric is trusted to be a scaled L2 */
+#define CALIBRATE_NUM 4
+#define CALIBRATE_TOLERANCE 1e-3
+
+/* IVF index: sqrt(N) lists trained on INDEX_SAMPLE faces per list */
+#define INDEX_SAMPLE 32
+#define INDEX_ITER 8
+#define INDEX_NPROBE 16
+#define INDEX_MAGIC "RKFI"
+#define INDEX_VERSION 1
+/* builds dropped by a compaction before the index is built with the lock held */
+#define INDEX_RETRY 3
+
+enum calibrate_state {
+    CALIBRATE_PENDING,
+    CALIBRATE_DONE,
+    CALIBRATE_UNSUPPORTED,
+};
+
+struct face_index {
+    int nlist;
+    char *centroid;
+    int **list;
+    int *num;
+    int *cap;
+    /* scratch of face_index_probe */
+    int *probe;
+    float *probe_ssd;
+};
+
+struct face_index_header {
+    char magic[4];
+    int version;
+    int type;
+    int vec_size;
+    int num;
+    int nlist;
+    unsigned int checksum;
+};
+
+struct face_library {
+    char *data;
+    int num;
+    size_t size;
+    size_t off;
+    face_search_compare_t compare;
+    enum calibrate_state state;
+    int calibrated;
+    float scale;
+    struct face_index index;
+    /* tombstones of removed entries, dropped by face_search_compact */
+    char *dead;
+    int dead_cap;
+    int dead_num;
+    /* bumped whenever entries move, an index built on an older copy is dropped */
+    unsigned int gen;
+    /* the saved index no longer matches the library */
+    int index_dirty;
+    char index_path[256];
+};
+
+static struct face_library g_lib[FACE_SEARCH_TYPE_NUM];
+/* face_search_index and face_search_save may write the same file */
+static pthread_mutex_t g_index_save_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_index_min;
+static int g_index_nprobe = INDEX_NPROBE;
+
+static unsigned int ssd_u8_c(const uint8_t *a, const uint8_t *b, int n)
+{
+    unsigned int sum = 0;
+
+    for (int i = 0; i < n; i++) {
+        int d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+static float ssd_f32_c(const float *a, const float *b, int n)
+{
+    float sum = 0;
+
+    for (int i = 0; i < n; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+#ifdef SEARCH_NEON
+static unsigned int ssd_u8_neon(const uint8_t *a, const uint8_t *b, int n)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    unsigned int sum;
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+        acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) +
+          vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+    return sum + ssd_u8_c(a + i, b + i, n - i);
+}
+
+static float ssd_f32_neon(const float *a, const float *b, int n)
+{
+    float32x4_t acc = vdupq_n_f32(0);
+    float sum;
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc = vmlaq_f32(acc, d, d);
+    }
+    sum = vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1) +
+          vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3);
+    return sum + ssd_f32_c(a + i, b + i, n - i);
+}
+#endif
+
+#ifdef SEARCH_X86
+__attribute__((target("sse2")))
+static unsigned int ssd_u8_sse2(const uint8_t *a, const uint8_t *b, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    unsigned int lane[4];
+    int i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        __m128i lo = _mm_unpacklo_epi8(d, zero);
+        __m128i hi = _mm_unpackhi_epi8(d, zero);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(lo, lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(hi, hi));
+    }
+    _mm_storeu_si128((__m128i *)lane, acc);
+    return lane[0] + lane[1] + lane[2] + lane[3] + ssd_u8_c(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static float ssd_f32_sse2(const float *a, const float *b, int n)
+{
+    __m128 acc = _mm_setzero_ps();
+    float lane[4];
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+    }
+    _mm_storeu_ps(lane, acc);
+    return lane[0] + lane[1] + lane[2] + lane[3] + ssd_f32_c(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static unsigned int ssd_u8_avx2(const uint8_t *a, const uint8_t *b, int n)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    unsigned int lane[8];
+    unsigned int sum = 0;
+    int i;
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+        __m256i lo = _mm256_unpacklo_epi8(d, zero);
+        __m256i hi = _mm256_unpackhi_epi8(d, zero);
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lo, lo));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(hi, hi));
+    }
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    for (int j = 0; j < 8; j++)
+        sum += lane[j];
+    return sum + ssd_u8_c(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static float ssd_f32_avx2(const float *a, const float *b, int n)
+{
+    __m256 acc = _mm256_setzero_ps();
+    float lane[8];
+    float sum = 0;
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(d, d));
+    }
+    _mm256_storeu_ps(lane, acc);
+    for (int j = 0; j < 8; j++)
+        sum += lane[j];
+    return sum + ssd_f32_c(a + i, b + i, n - i);
+}
+#endif
+
+static unsigned int (*g_ssd_u8)(const uint8_t *a, const uint8_t *b, int n);
+static float (*g_ssd_f32)(const float *a, const float *b, int n);
+static const char *g_kernel;
+
+static void face_search_kernel_init(void)
+{
+    if (g_kernel)
+        return;
+
+    g_ssd_u8 = ssd_u8_c;
+    g_ssd_f32 = ssd_f32_c;
+    g_kernel = "c";
+#if defined(SEARCH_NEON)
+    g_ssd_u8 = ssd_u8_neon;
+    g_ssd_f32 = ssd_f32_neon;
+    g_kernel = "neon";
+#elif defined(SEARCH_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        g_ssd_u8 = ssd_u8_avx2;
+        g_ssd_f32 = ssd_f32_avx2;
+        g_kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        g_ssd_u8 = ssd_u8_sse2;
+        g_ssd_f32 = ssd_f32_sse2;
+        g_kernel = "sse2";
+    }
+#endif
+}
+
+const char *face_search_kernel(void)
+{
+    face_search_kernel_init();
+    return g_kernel;
+}
+
+/* element vector of a feature struct */
+static void *face_search_vec(enum face_search_type type, void *feature)
+{
+    if (type == FACE_SEARCH_MASK)
+        return ((rockface_feature_float_t *)feature)->feature;
+    return ((rockface_feature_t *)feature)->feature;
+}
+
+static int face_search_vec_size(enum face_search_type type)
+{
+    return type == FACE_SEARCH_MASK ? F32_DIM * sizeof(float) : U8_DIM;
+}
+
+/* squared L2 distance of two element vectors */
+static float face_search_ssd(enum face_search_type type, const void *a, const void *b)
+{
+    if (type == FACE_SEARCH_MASK)
+        return g_ssd_f32((const float *)a, (const float *)b, F32_DIM);
+    return g_ssd_u8((const uint8_t *)a, (const uint8_t *)b, U8_DIM);
+}
+
+static void *face_search_entry(struct face_library *lib, int i)
+{
+    return lib->data + i * lib->size + lib->off;
+}
+
+static void face_index_free(struct face_index *idx)
+{
+    for (int i = 0; idx->list && i < idx->nlist; i++)
+        free(idx->list[i]);
+    free(idx->list);
+    free(idx->num);
+    free(idx->cap);
+    free(idx->centroid);
+    free(idx->probe);
+    free(idx->probe_ssd);
+    memset(idx, 0, sizeof(struct face_index));
+}
+
+static int face_index_alloc(struct face_index *idx, int nlist, int vec_size)
+{
+    idx->nlist = nlist;
+    idx->centroid = (char *)calloc(nlist, vec_size);
+    idx->list = (int **)calloc(nlist, sizeof(int *));
+    idx->num = (int *)calloc(nlist, sizeof(int));
+    idx->cap = (int *)calloc(nlist, sizeof(int));
+    idx->probe = (int *)calloc(nlist, sizeof(int));
+    idx->probe_ssd = (float *)calloc(nlist, sizeof(float));
+    if (!idx->centroid || !idx->list || !idx->num || !idx->cap || !idx->probe || !idx->probe_ssd) {
+        printf("%s: alloc %d lists fail!\n", __func__, nlist);
+        face_index_free(idx);
+        return -1;
+    }
+    return 0;
+}
+
+static int face_index_copy(struct face_index *dst, struct face_index *src, int vec_size)
+{
+    if (face_index_alloc(dst, src->nlist, vec_size))
+        return -1;
+    memcpy(dst->centroid, src->centroid, src->nlist * vec_size);
+    for (int i = 0; i < src->nlist; i++) {
+        dst->list[i] = (int *)malloc(src->num[i] * sizeof(int) + 1);
+        if (!dst->list[i]) {
+            face_index_free(dst);
+            return -1;
+        }
+        memcpy(dst->list[i], src->list[i], src->num[i] * sizeof(int));
+        dst->num[i] = src->num[i];
+        dst->cap[i] = src->num[i];
+    }
+    return 0;
+}
+
+static int face_index_add(struct face_index *idx, int list, int entry)
+{
+    if (idx->num[list] == idx->cap[list]) {
+        int cap = idx->cap[list] ? idx->cap[list] * 2 : 16;
+        int *p = (int *)realloc(idx->list[list], cap * sizeof(int));
+        if (!p)
+            return -1;
+        idx->list[list] = p;
+        idx->cap[list] = cap;
+    }
+    idx->list[list][idx->num[list]++] = entry;
+    return 0;
+}
+
+static int face_index_nearest(enum face_search_type type, struct face_index *idx, const void *vec)
+{
+    int vec_size = face_search_vec_size(type);
+    float best = FLT_MAX;
+    int nearest = 0;
+
+    for (int i = 0; i < idx->nlist; i++) {
+        float ssd = face_search_ssd(type, vec, idx->centroid + i * vec_size);
+        if (ssd < best) {
+            best = ssd;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+/* k-means on a strided sample of the library, then every entry goes to its nearest list */
+static int face_index_build(enum face_search_type type, struct face_library *lib)
+{
+    struct face_index *idx = &lib->index;
+    int vec_size = face_search_vec_size(type);
+    int dim = type == FACE_SEARCH_MASK ? F32_DIM : U8_DIM;
+    int nlist = (int)sqrtf(lib->num);
+    int sample = nlist * INDEX_SAMPLE < lib->num ? nlist * INDEX_SAMPLE : lib->num;
+    float *sum;
+    int *cnt;
+    int ret = -1;
+
+    if (nlist < 1)
+        nlist = 1;
+    if (face_index_alloc(idx, nlist, vec_size))
+        return -1;
+    sum = (float *)malloc(nlist * dim * sizeof(float));
+    cnt = (int *)malloc(nlist * sizeof(int));
+    if (!sum || !cnt)
+        goto exit;
+
+    for (int i = 0; i < nlist; i++)
+        memcpy(idx->centroid + i * vec_size,
+               face_search_vec(type, face_search_entry(lib, (long long)i * lib->num / nlist)), vec_size);
+
+    for (int iter = 0; iter < INDEX_ITER; iter++) {
+        memset(sum, 0, nlist * dim * sizeof(float));
+        memset(cnt, 0, nlist * sizeof(int));
+        for (int i = 0; i < sample; i++) {
+            void *vec = face_search_vec(type, face_search_entry(lib, (long long)i * lib->num / sample));
+            int c = face_index_nearest(type, idx, vec);
+            float *s = sum + c * dim;
+            cnt[c]++;
+            for (int j = 0; j < dim; j++)
+                s[j] += type == FACE_SEARCH_MASK ? ((float *)vec)[j] : ((uint8_t *)vec)[j];
+        }
+        for (int c = 0; c < nlist; c++) {
+            /* an empty list keeps its old centroid */
+            if (!cnt[c])
+                continue;
+            for (int j = 0; j < dim; j++) {
+                float v = sum[c * dim + j] / cnt[c];
+                if (type == FACE_SEARCH_MASK)
+                    ((float *)(idx->centroid + c * vec_size))[j] = v;
+                else
+                    ((uint8_t *)(idx->centroid + c * vec_size))[j] = (uint8_t)(v + 0.5f);
+            }
+        }
+    }
+
+    for (int i = 0; i < lib->num; i++) {
+        void *vec = face_search_vec(type, face_search_entry(lib, i));
+        if (face_index_add(idx, face_index_nearest(type, idx, vec), i))
+            goto exit;
+    }
+    ret = 0;
+
+exit:
+    free(sum);
+    free(cnt);
+    if (ret) {
+        printf("%s: build fail!\n", __func__);
+        face_index_free(idx);
+    }
+    return ret;
+}
+
+static unsigned int face_index_checksum(enum face_search_type type, struct face_library *lib)
+{
+    int vec_size = face_search_vec_size(type);
+    unsigned int hash = 2166136261u;
+
+    for (int i = 0; i < lib->num; i++) {
+        const uint8_t *p = (const uint8_t *)face_search_vec(type, face_search_entry(lib, i));
+        for (int j = 0; j < vec_size; j++)
+            hash = (hash ^ p[j]) * 16777619u;
+    }
+    return hash;
+}
+
+static int face_index_save(enum face_search_type type, struct face_library *lib, const char *path)
+{
+    struct face_index *idx = &lib->index;
+    struct face_index_header header;
+    char tmp[256];
+    FILE *fp;
+    int ret = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.type = type;
+    header.vec_size = face_search_vec_size(type);
+    header.num = lib->num;
+    header.nlist = idx->nlist;
+    header.checksum = face_index_checksum(type, lib);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    pthread_mutex_lock(&g_index_save_lock);
+    fp = fopen(tmp, "wb");
+    if (!fp) {
+        pthread_mutex_unlock(&g_index_save_lock);
+        printf("%s: open %s fail!\n", __func__, tmp);
+        return -1;
+    }
+    if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+            fwrite(idx->centroid, header.vec_size, idx->nlist, fp) != (size_t)idx->nlist ||
+            fwrite(idx->num, sizeof(int), idx->nlist, fp) != (size_t)idx->nlist)
+        ret = -1;
+    for (int i = 0; !ret && i < idx->nlist; i++) {
+        if (fwrite(idx->list[i], sizeof(int), idx->num[i], fp) != (size_t)idx->num[i])
+            ret = -1;
+    }
+    fclose(fp);
+    if (ret || rename(tmp, path)) {
+        printf("%s: write %s fail!\n", __func__, path);
+        unlink(tmp);
+        ret = -1;
+    }
+    pthread_mutex_unlock(&g_index_save_lock);
+    return ret;
+}
+
+static int face_index_load(enum face_search_type type, struct face_library *lib, const char *path)
+{
+    struct face_index *idx = &lib->index;
+    struct face_index_header header;
+    FILE *fp;
+    int ret = -1;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+            memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) ||
+            header.version != INDEX_VERSION || header.type != type ||
+            header.vec_size != face_search_vec_size(type) || header.num != lib->num ||
+            header.nlist <= 0 || header.nlist > lib->num ||
+            header.checksum != face_index_checksum(type, lib))
+        goto exit;
+    if (face_index_alloc(idx, header.nlist, header.vec_size))
+        goto exit;
+    if (fread(idx->centroid, header.vec_size, idx->nlist, fp) != (size_t)idx->nlist ||
+            fread(idx->cap, sizeof(int), idx->nlist, fp) != (size_t)idx->nlist)
+        goto exit;
+    for (int i = 0; i < idx->nlist; i++) {
+        int num = idx->cap[i];
+        idx->cap[i] = 0;
+        if (num < 0 || num > lib->num)
+            goto exit;
+        for (int j = 0; j < num; j++) {
+            int entry;
+            if (fread(&entry, sizeof(int), 1, fp) != 1 || entry < 0 || entry >= lib->num ||
+                    face_index_add(idx, i, entry))
+                goto exit;
+        }
+    }
+    ret = 0;
+
+exit:
+    fclose(fp);
+    if (ret)
+        face_index_free(idx);
+    return ret;
+}
+
+/* lock held, the copy is indexed or saved with the lock dropped */
+static int face_library_copy(struct face_library *lib, struct face_library *copy)
+{
+    memset(copy, 0, sizeof(struct face_library));
+    copy->data = (char *)malloc(lib->num * lib->size + 1);
+    if (!copy->data) {
+        printf("%s: alloc %d faces fail!\n", __func__, lib->num);
+        return -1;
+    }
+    memcpy(copy->data, lib->data, lib->num * lib->size);
+    copy->num = lib->num;
+    copy->size = lib->size;
+    copy->off = lib->off;
+    return 0;
+}
+
+static void face_library_free(struct face_library *copy)
+{
+    face_index_free(&copy->index);
+    free(copy->data);
+    memset(copy, 0, sizeof(struct face_library));
+}
+
+/* 1 when the library moved while the copy was indexed */
+static int face_search_index_copy(enum face_search_type type, pthread_mutex_t *lock)
+{
+    struct face_library *lib = &g_lib[type];
+    struct face_library copy;
+    struct timeval t0, t1;
+    char path[sizeof(lib->index_path)];
+    unsigned int gen;
+    int saved = 0;
+    int ret = 0;
+
+    if (lock)
+        pthread_mutex_lock(lock);
+    if (lib->index.nlist || !g_index_min || lib->num < g_index_min || face_library_copy(lib, &copy)) {
+        if (lock)
+            pthread_mutex_unlock(lock);
+        return 0;
+    }
+    gen = lib->gen;
+    memcpy(path, lib->index_path, sizeof(path));
+    if (lock)
+        pthread_mutex_unlock(lock);
+
+    gettimeofday(&t0, NULL);
+    if (path[0] && !face_index_load(type, &copy, path)) {
+        printf("%s: load %s, %d lists\n", __func__, path, copy.index.nlist);
+        saved = 1;
+    } else {
+        if (face_index_build(type, &copy)) {
+            face_library_free(&copy);
+            return -1;
+        }
+        gettimeofday(&t1, NULL);
+        printf("%s: build %d lists over %d faces in %ld ms\n", __func__, copy.index.nlist, copy.num,
+               (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000);
+        if (path[0])
+            saved = !face_index_save(type, &copy, path);
+    }
+
+    if (lock)
+        pthread_mutex_lock(lock);
+    if (lib->gen != gen) {
+        ret = 1;
+    } else if (!lib->index.nlist) {
+        lib->index = copy.index;
+        memset(&copy.index, 0, sizeof(struct face_index));
+        /* appended while the lock was dropped */
+        for (int i = copy.num; i < lib->num; i++) {
+            void *vec = face_search_vec(type, face_search_entry(lib, i));
+            if (face_index_add(&lib->index, face_index_nearest(type, &lib->index, vec), i)) {
+                face_index_free(&lib->index);
+                ret = -1;
+                break;
+            }
+        }
+        lib->index_dirty = !saved || lib->num != copy.num || lib->dead_num;
+    }
+    if (lock)
+        pthread_mutex_unlock(lock);
+    face_library_free(&copy);
+    return ret;
+}
+
+/* lock not held, it is only taken to copy the library and to swap the index in */
+int face_search_index(enum face_search_type type, const char *path, pthread_mutex_t *lock)
+{
+    struct face_library *lib = &g_lib[type];
+    int ret = 1;
+
+    if (lock)
+        pthread_mutex_lock(lock);
+    snprintf(lib->index_path, sizeof(lib->index_path), "%s", path ? path : "");
+    if (lock)
+        pthread_mutex_unlock(lock);
+    for (int i = 0; ret > 0 && i < INDEX_RETRY; i++)
+        ret = face_search_index_copy(type, lock);
+    if (ret > 0 && lock) {
+        printf("%s: library keeps moving, build with the lock held\n", __func__);
+        pthread_mutex_lock(lock);
+        ret = face_search_index_copy(type, NULL);
+        pthread_mutex_unlock(lock);
+    }
+    return ret;
+}
+
+/* lock held, it is dropped while the index goes to flash */
+int face_search_save(enum face_search_type type, pthread_mutex_t *lock)
+{
+    struct face_library *lib = &g_lib[type];
+    struct face_library copy;
+    char path[sizeof(lib->index_path)];
+    int ret;
+
+    /* the tombstones are not in the database, the next boot would not match */
+    if (!lib->index_dirty || !lib->index.nlist || lib->dead_num || !lib->index_path[0])
+        return 0;
+    if (face_library_copy(lib, &copy))
+        return -1;
+    if (face_index_copy(&copy.index, &lib->index, face_search_vec_size(type))) {
+        face_library_free(&copy);
+        return -1;
+    }
+    memcpy(path, lib->index_path, sizeof(path));
+    /* a change while the file is written marks it dirty again */
+    lib->index_dirty = 0;
+    if (lock)
+        pthread_mutex_unlock(lock);
+
+    ret = face_index_save(type, &copy, path);
+    face_library_free(&copy);
+
+    if (lock)
+        pthread_mutex_lock(lock);
+    /* a failed save is retried on the next call */
+    if (ret)
+        lib->index_dirty = 1;
+    return ret;
+}
+
+void set_face_index(int min_num, int nprobe)
+{
+    g_index_min = min_num > 0 ? min_num : 0;
+    g_index_nprobe = nprobe > 0 ? nprobe : INDEX_NPROBE;
+}
+
+void face_search_init(enum face_search_type type, void *data, int num, size_t size, size_t off,
+                      face_search_compare_t compare)
+{
+    struct face_library *lib = &g_lib[type];
+
+    unsigned int gen = lib->gen;
+
+    face_search_kernel_init();
+    face_index_free(&lib->index);
+    free(lib->dead);
+    memset(lib, 0, sizeof(struct face_library));
+    lib->gen = gen + 1;
+    lib->data = (char *)data;
+    lib->num = num;
+    lib->size = size;
+    lib->off = off;
+    lib->compare = compare;
+    lib->state = compare ? CALIBRATE_PENDING : CALIBRATE_UNSUPPORTED;
+}
+
+void face_search_release(enum face_search_type type)
+{
+    unsigned int gen = g_lib[type].gen;
+
+    face_index_free(&g_lib[type].index);
+    free(g_lib[type].dead);
+    memset(&g_lib[type], 0, sizeof(struct face_library));
+    g_lib[type].gen = gen + 1;
+}
+
+int face_search_add(enum face_search_type type)
+{
+    struct face_library *lib = &g_lib[type];
+    struct face_index *idx = &lib->index;
+    int i = lib->num;
+
+    if (!lib->data)
+        return -1;
+    if (lib->dead && i >= lib->dead_cap) {
+        int cap = lib->dead_cap * 2 > i + 1 ? lib->dead_cap * 2 : i + 1;
+        char *p = (char *)realloc(lib->dead, cap);
+        if (!p)
+            return -1;
+        memset(p + lib->dead_cap, 0, cap - lib->dead_cap);
+        lib->dead = p;
+        lib->dead_cap = cap;
+    }
+    if (idx->nlist &&
+            face_index_add(idx, face_index_nearest(type, idx, face_search_vec(type, face_search_entry(lib, i))), i))
+        return -1;
+    lib->num++;
+    lib->index_dirty = 1;
+    return i;
+}
+
+void face_search_remove(enum face_search_type type, int index)
+{
+    struct face_library *lib = &g_lib[type];
+
+    if (index < 0 || index >= lib->num)
+        return;
+    if (!lib->dead) {
+        lib->dead_cap = lib->num;
+        lib->dead = (char *)calloc(lib->dead_cap, 1);
+        if (!lib->dead) {
+            lib->dead_cap = 0;
+            return;
+        }
+    }
+    if (!lib->dead[index]) {
+        lib->dead[index] = 1;
+        lib->dead_num++;
+        lib->index_dirty = 1;
+    }
+}
+
+int face_search_dead(enum face_search_type type)
+{
+    return g_lib[type].dead_num;
+}
+
+/* move the live entries down in place, the index lists follow them */
+int face_search_compact(enum face_search_type type)
+{
+    struct face_library *lib = &g_lib[type];
+    struct face_index *idx = &lib->index;
+    int *map = NULL;
+    int num = 0;
+
+    if (!lib->dead_num)
+        return lib->num;
+    if (idx->nlist) {
+        map = (int *)malloc(lib->num * sizeof(int));
+        if (!map) {
+            printf("%s: alloc fail!\n", __func__);
+            return -1;
+        }
+    }
+    for (int i = 0; i < lib->num; i++) {
+        if (lib->dead[i]) {
+            if (map)
+                map[i] = -1;
+            continue;
+        }
+        if (num != i)
+            memcpy(lib->data + num * lib->size, lib->data + i * lib->size, lib->size);
+        if (map)
+            map[i] = num;
+        num++;
+    }
+    memset(lib->data + num * lib->size, 0, (lib->num - num) * lib->size);
+    for (int l = 0; map && l < idx->nlist; l++) {
+        int cnt = 0;
+        for (int j = 0; j < idx->num[l]; j++) {
+            if (map[idx->list[l][j]] >= 0)
+                idx->list[l][cnt++] = map[idx->list[l][j]];
+        }
+        idx->num[l] = cnt;
+    }
+    free(map);
+    memset(lib->dead, 0, lib->dead_cap);
+    lib->dead_num = 0;
+    lib->num = num;
+    lib->gen++;
+    lib->index_dirty = 1;
+    return num;
+}
+
+/*
+ * Learn the factor between our distance and the backend one from the pairs
+ * (feature, library entry) until CALIBRATE_NUM of them agree.
+ */
+static int face_search_calibrate(enum face_search_type type, struct face_library *lib, void *feature)
+{
+    for (int i = 0; i < lib->num && lib->calibrated < CALIBRATE_NUM; i++) {
+        void *entry = face_search_entry(lib, i);
+        float ssd;
+        float similarity, scale;
+
+        if (lib->dead && lib->dead[i])
+            continue;
+        ssd = face_search_ssd(type, face_search_vec(type, feature), face_search_vec(type, entry));
+        if (ssd <= 0)
+            continue;
+        if (lib->compare((rockface_feature_t *)feature, (rockface_feature_t *)entry, &similarity)
+                != ROCKFACE_RET_SUCCESS)
+            goto unsupported;
+        scale = similarity / sqrtf(ssd);
+        if (lib->calibrated && fabsf(scale - lib->scale) > lib->scale * CALIBRATE_TOLERANCE)
+            goto unsupported;
+        if (!lib->calibrated)
+            lib->scale = scale;
+        lib->calibrated++;
+    }
+    if (lib->calibrated >= CALIBRATE_NUM) {
+        lib->state = CALIBRATE_DONE;
+        printf("%s: %s search with %s kernel, scale %g\n", __func__,
+               type == FACE_SEARCH_MASK ? "mask" : "normal", g_kernel, lib->scale);
+    }
+    return 0;
+
+unsupported:
+    printf("%s: backend distance is not L2, use backend search\n", __func__);
+    lib->state = CALIBRATE_UNSUPPORTED;
+    return -1;
+}
+
+/* keep match[] sorted by squared distance, at most k of them */
+static void face_search_match_add(struct face_search_match *match, int *cnt, int k,
+                                  char *data, int index, float ssd)
+{
+    int pos;
+
+    if (*cnt == k) {
+        if (ssd >= match[k - 1].distance)
+            return;
+        pos = k - 1;
+    } else {
+        pos = (*cnt)++;
+    }
+    while (pos > 0 && match[pos - 1].distance > ssd) {
+        match[pos] = match[pos - 1];
+        pos--;
+    }
+    match[pos].data = data;
+    match[pos].index = index;
+    match[pos].distance = ssd;
+}
+
+/* the nprobe lists with the nearest centroids */
+static int face_index_probe(enum face_search_type type, struct face_index *idx, const void *vec)
+{
+    int vec_size = face_search_vec_size(type);
+    int nprobe = g_index_nprobe < idx->nlist ? g_index_nprobe : idx->nlist;
+    int cnt = 0;
+
+    for (int i = 0; i < idx->nlist; i++) {
+        float ssd = face_search_ssd(type, vec, idx->centroid + i * vec_size);
+        int pos;
+
+        if (cnt == nprobe) {
+            if (ssd >= idx->probe_ssd[nprobe - 1])
+                continue;
+            pos = nprobe - 1;
+        } else {
+            pos = cnt++;
+        }
+        while (pos > 0 && idx->probe_ssd[pos - 1] > ssd) {
+            idx->probe[pos] = idx->probe[pos - 1];
+            idx->probe_ssd[pos] = idx->probe_ssd[pos - 1];
+            pos--;
+        }
+        idx->probe[pos] = i;
+        idx->probe_ssd[pos] = ssd;
+    }
+    return cnt;
+}
+
+int face_search_topk(enum face_search_type type, void *feature, float threshold,
+                     struct face_search_match *match, int k)
+{
+    struct face_library *lib = &g_lib[type];
+    struct face_index *idx = &lib->index;
+    void *vec = face_search_vec(type, feature);
+    float limit;
+    int cnt = 0;
+
+    if (lib->state == CALIBRATE_UNSUPPORTED)
+        return -2;
+    if (!lib->data || k <= 0 || threshold <= 0)
+        return 0;
+    if (lib->state == CALIBRATE_PENDING && face_search_calibrate(type, lib, feature))
+        return -2;
+    /* one pair does not make a scale, the backend decides until CALIBRATE_NUM agree */
+    if (lib->state != CALIBRATE_DONE)
+        return -2;
+
+    /* compare in the squared domain */
+    limit = (threshold / lib->scale) * (threshold / lib->scale);
+
+    if (idx->nlist) {
+        /* distances of the probed entries are exact, only recall is approximate */
+        int nprobe = face_index_probe(type, idx, vec);
+        for (int p = 0; p < nprobe; p++) {
+            int list = idx->probe[p];
+            for (int j = 0; j < idx->num[list]; j++) {
+                int i = idx->list[list][j];
+                float ssd;
+                if (lib->dead && lib->dead[i])
+                    continue;
+                ssd = face_search_ssd(type, vec, face_search_vec(type, face_search_entry(lib, i)));
+                if (ssd < limit)
+                    face_search_match_add(match, &cnt, k, lib->data + i * lib->size, i, ssd);
+            }
+        }
+    } else {
+        for (int i = 0; i < lib->num; i++) {
+            float ssd;
+            if (lib->dead && lib->dead[i])
+                continue;
+            ssd = face_search_ssd(type, vec, face_search_vec(type, face_search_entry(lib, i)));
+            if (ssd < limit)
+                face_search_match_add(match, &cnt, k, lib->data + i * lib->size, i, ssd);
+        }
+    }
+
+    for (int i = 0; i < cnt; i++)
+        match[i].distance = lib->scale * sqrtf(match[i].distance);
+    return cnt;
+}
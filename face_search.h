@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __FACE_SEARCH_H__
+#define __FACE_SEARCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <pthread.h>
+#include <rockface/rockface.h>
+
+/*
+ * Brute force 1:N search over the features kept in g_face_data/g_mask_data,
+ * in place, nothing is copied. The distance is the L2 distance of the
+ * feature elements, scaled to the backend metric once per library from a
+ * few feature_compare calls, so the usual thresholds apply unchanged. If
+ * the backend metric turns out not to be a scaled L2 distance, or while
+ * the scale is still being learned, the search reports -2 and the caller
+ * has to use the backend search instead.
+ *
+ * Libraries of at least set_face_index() min_num faces are searched through
+ * an IVF index: k-means lists over the features, only the nprobe lists with
+ * the nearest centroids are scanned. Distances stay exact, a miss only costs
+ * recall. face_search_index() loads the index from path when it matches the
+ * library, otherwise builds it and saves it there. It copies the library
+ * under lock and runs k-means on the copy with lock dropped, the search
+ * stays brute force until the index is swapped in. An add, remove or
+ * compact marks the saved index dirty, face_search_save() rewrites it
+ * once there are no tombstones left.
+ *
+ * The library can change in place: face_search_add() takes the entry the
+ * caller wrote right after the last one, face_search_remove() only marks
+ * an entry dead, face_search_compact() drops the dead entries by moving
+ * the live ones down and returns the new number of entries.
+ */
+enum face_search_type {
+    FACE_SEARCH_NORMAL,
+    FACE_SEARCH_MASK,
+    FACE_SEARCH_TYPE_NUM,
+};
+
+struct face_search_match {
+    void *data;
+    int index;
+    float distance;
+};
+
+typedef rockface_ret_t (*face_search_compare_t)(rockface_feature_t *a, rockface_feature_t *b, float *similarity);
+
+void face_search_init(enum face_search_type type, void *data, int num, size_t size, size_t off,
+                      face_search_compare_t compare);
+void face_search_release(enum face_search_type type);
+int face_search_index(enum face_search_type type, const char *path, pthread_mutex_t *lock);
+int face_search_save(enum face_search_type type, pthread_mutex_t *lock);
+int face_search_add(enum face_search_type type);
+void face_search_remove(enum face_search_type type, int index);
+int face_search_dead(enum face_search_type type);
+int face_search_compact(enum face_search_type type);
+int face_search_topk(enum face_search_type type, void *feature, float threshold,
+                     struct face_search_match *match, int k);
+const char *face_search_kernel(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
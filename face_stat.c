@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "face_stat.h"
+
+/*
+ * Log-linear histogram in microseconds: values below 16us get one bucket
+ * each, above that every power of two is split into 8 linear sub buckets,
+ * so the reported percentiles are within 12.5% of the real value.
+ */
+#define STAT_LINEAR 16
+#define STAT_SUB_BITS 3
+#define STAT_SUB (1 << STAT_SUB_BITS)
+#define STAT_MIN_EXP 4
+#define STAT_BUCKETS (STAT_LINEAR + (32 - STAT_MIN_EXP) * STAT_SUB)
+
+struct face_stat {
+    unsigned int max_us;
+    unsigned long long cpu_ns;
+    unsigned int bucket[STAT_BUCKETS];
+};
+
+static struct face_stat g_stat[FACE_STAGE_NUM];
+
+static const char *g_stage_name[FACE_STAGE_NUM] = {
+    "detect",
+    "track",
+    "landmark5",
+    "landmark106",
+    "mask_classifier",
+    "align",
+    "feature_extract",
+    "feature_search",
+    "liveness",
+    "rga_detect",
+    "rga_feature",
+    "rga_ir",
+    "rga_display",
+    "rga_snapshot",
+    "rga_image",
+    "snapshot_encode",
+    "convert",
+};
+
+static int stat_bucket(unsigned int us)
+{
+    int exp;
+
+    if (us < STAT_LINEAR)
+        return us;
+    exp = 31 - __builtin_clz(us);
+    return STAT_LINEAR + (exp - STAT_MIN_EXP) * STAT_SUB +
+           ((us >> (exp - STAT_SUB_BITS)) & (STAT_SUB - 1));
+}
+
+static unsigned int stat_bucket_value(int index)
+{
+    int exp, sub;
+
+    if (index < STAT_LINEAR)
+        return index;
+    exp = (index - STAT_LINEAR) / STAT_SUB + STAT_MIN_EXP;
+    sub = (index - STAT_LINEAR) % STAT_SUB;
+    /* upper bound of the bucket */
+    return (((unsigned int)(STAT_SUB + sub + 1)) << (exp - STAT_SUB_BITS)) - 1;
+}
+
+static long long timespec_diff_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) * 1000000000LL + (t1->tv_nsec - t0->tv_nsec);
+}
+
+void face_stat_begin(struct face_stat_timer *t)
+{
+    clock_gettime(CLOCK_MONOTONIC, &t->t0);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t->c0);
+}
+
+void face_stat_end(struct face_stat_timer *t, enum face_stage stage)
+{
+    struct timespec t1, c1;
+    struct face_stat *s = &g_stat[stage];
+    long long ns;
+    unsigned int us, max;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c1);
+
+    ns = timespec_diff_ns(&t->t0, &t1);
+    us = ns > 0 ? ns / 1000 : 0;
+    __atomic_add_fetch(&s->bucket[stat_bucket(us)], 1, __ATOMIC_RELAXED);
+    ns = timespec_diff_ns(&t->c0, &c1);
+    if (ns > 0)
+        __atomic_add_fetch(&s->cpu_ns, ns, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&s->max_us, __ATOMIC_RELAXED);
+    while (us > max && !__atomic_compare_exchange_n(&s->max_us, &max, us, 1,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static unsigned int stat_percentile(unsigned int *bucket, unsigned int total, int pct, unsigned int max)
+{
+    unsigned long long target = ((unsigned long long)total * pct + 99) / 100;
+    unsigned long long sum = 0;
+    unsigned int value;
+
+    if (!total)
+        return 0;
+    for (int i = 0; i < STAT_BUCKETS; i++) {
+        sum += bucket[i];
+        if (sum >= target) {
+            value = stat_bucket_value(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+void rockface_get_stage_stat(struct face_stage_stat *stat, int num)
+{
+    unsigned int bucket[STAT_BUCKETS];
+    unsigned int total;
+
+    if (num > FACE_STAGE_NUM)
+        num = FACE_STAGE_NUM;
+    for (int i = 0; i < num; i++) {
+        struct face_stat *s = &g_stat[i];
+
+        total = 0;
+        for (int j = 0; j < STAT_BUCKETS; j++) {
+            bucket[j] = __atomic_load_n(&s->bucket[j], __ATOMIC_RELAXED);
+            total += bucket[j];
+        }
+        memset(&stat[i], 0, sizeof(struct face_stage_stat));
+        stat[i].count = total;
+        stat[i].max_us = __atomic_load_n(&s->max_us, __ATOMIC_RELAXED);
+        stat[i].cpu_us = __atomic_load_n(&s->cpu_ns, __ATOMIC_RELAXED) / 1000;
+        stat[i].p50_us = stat_percentile(bucket, total, 50, stat[i].max_us);
+        stat[i].p90_us = stat_percentile(bucket, total, 90, stat[i].max_us);
+        stat[i].p99_us = stat_percentile(bucket, total, 99, stat[i].max_us);
+    }
+}
+
+void rockface_reset_stage_stat(void)
+{
+    for (int i = 0; i < FACE_STAGE_NUM; i++) {
+        struct face_stat *s = &g_stat[i];
+
+        for (int j = 0; j < STAT_BUCKETS; j++)
+            __atomic_store_n(&s->bucket[j], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->max_us, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->cpu_ns, 0, __ATOMIC_RELAXED);
+    }
+}
+
+const char *rockface_get_stage_name(enum face_stage stage)
+{
+    if (stage < 0 || stage >= FACE_STAGE_NUM)
+        return "unknown";
+    return g_stage_name[stage];
+}
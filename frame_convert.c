@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+
+#include "frame_convert.h"
+
+/* rotated rows converted together, their source lines stay in cache */
+#define FRAME_CONVERT_BAND 32
+
+#define CLIP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
+
+bool frame_convert_supported(RgaSURF_FORMAT fmt, int rotation)
+{
+    if (fmt != RK_FORMAT_YCbCr_420_SP && fmt != RK_FORMAT_YCbCr_422_SP)
+        return false;
+    return rotation == 0 || rotation == HAL_TRANSFORM_ROT_90 || rotation == HAL_TRANSFORM_ROT_270;
+}
+
+static void frame_convert_sync(int fd, unsigned long long flags)
+{
+    struct dma_buf_sync sync;
+
+    if (fd < 0)
+        return;
+    sync.flags = flags | DMA_BUF_SYNC_READ;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+static inline void frame_convert_yuv(int y, int u, int v, unsigned char *rgb)
+{
+    int yy = (y - 16) * 298;
+
+    u -= 128;
+    v -= 128;
+    rgb[0] = CLIP((yy + 409 * v + 128) >> 8);
+    rgb[1] = CLIP((yy - 100 * u - 208 * v + 128) >> 8);
+    rgb[2] = CLIP((yy + 516 * u + 128) >> 8);
+}
+
+static inline void frame_convert_pixel(const unsigned char *y, const unsigned char *uv, unsigned char *rgb)
+{
+    frame_convert_yuv(*y, uv[0], uv[1], rgb);
+}
+
+/* source position of rotated (u, v) is (x0 + u * xu + v * xv, y0 + u * yu + v * yv) */
+struct frame_convert_map {
+    int x0, xu, xv;
+    int y0, yu, yv;
+};
+
+/*
+ * Each step x step block of the rotated frame is a step x step block of
+ * the source, its Y and UV means give one pixel of the small frame. A
+ * band of step source lines is first summed column by column, the blocks
+ * of the band then add up step of those sums.
+ */
+static void frame_convert_small(struct frame_convert *c, const struct frame_convert_map *m,
+                                const unsigned char *y_plane, const unsigned char *uv_plane,
+                                int uv_shift, int sw, int sh)
+{
+    bool swap = m->yu != 0;
+    int step = c->step;
+    int ni = swap ? sw : sh, nj = swap ? sh : sw;
+    int n = step * step;
+    unsigned short acc[c->width];
+    unsigned short uv_acc[c->width];
+
+    for (int i = 0; i < ni; i++) {
+        int u = (swap ? i : 0) * step, v = (swap ? 0 : i) * step;
+        int ya = m->y0 + u * m->yu + v * m->yv, yb = ya + (step - 1) * (m->yu + m->yv);
+        int sy = ya < yb ? ya : yb;
+        int cy0 = sy >> uv_shift, cy1 = (sy + step - 1) >> uv_shift;
+
+        memset(acc, 0, sizeof(acc));
+        for (int r = 0; r < step; r++) {
+            const unsigned char *p = y_plane + (sy + r) * c->width;
+
+            for (int x = 0; x < c->width; x++)
+                acc[x] += p[x];
+        }
+        memset(uv_acc, 0, sizeof(uv_acc));
+        for (int r = cy0; r <= cy1; r++) {
+            const unsigned char *p = uv_plane + r * c->width;
+
+            for (int x = 0; x < c->width; x++)
+                uv_acc[x] += p[x];
+        }
+
+        for (int j = 0; j < nj; j++) {
+            int su = swap ? i : j, sv = swap ? j : i;
+            int xa = m->x0 + su * step * m->xu + sv * step * m->xv, xb = xa + (step - 1) * (m->xu + m->xv);
+            int sx = xa < xb ? xa : xb;
+            int cx0 = sx >> 1, cx1 = (sx + step - 1) >> 1;
+            int cn = (cx1 - cx0 + 1) * (cy1 - cy0 + 1);
+            unsigned int ys = 0, us = 0, vs = 0;
+
+            for (int k = 0; k < step; k++)
+                ys += acc[sx + k];
+            for (int k = cx0; k <= cx1; k++) {
+                us += uv_acc[k * 2];
+                vs += uv_acc[k * 2 + 1];
+            }
+            frame_convert_yuv((ys + n / 2) / n, (us + cn / 2) / cn, (vs + cn / 2) / cn,
+                              c->small + (sv * sw + su) * 3);
+        }
+    }
+}
+
+int frame_convert_run(struct frame_convert *c)
+{
+    const unsigned char *y_plane = (const unsigned char *)c->src;
+    const unsigned char *uv_plane = y_plane + c->width * c->height;
+    int uv_shift = c->fmt == RK_FORMAT_YCbCr_422_SP ? 0 : 1;
+    bool swap = c->rotation == HAL_TRANSFORM_ROT_90 || c->rotation == HAL_TRANSFORM_ROT_270;
+    int rw = swap ? c->height : c->width;
+    int rh = swap ? c->width : c->height;
+    int step = c->small ? c->step : 1;
+    int sw = rw / step, sh = rh / step;
+    struct frame_convert_map m = { 0, 1, 0, 0, 0, 1 };
+
+    if (!c->src || !frame_convert_supported(c->fmt, c->rotation) || (!c->rgb && !c->small))
+        return -1;
+    if (c->small && c->step <= 0)
+        return -1;
+    if (c->rgb && (c->x < 0 || c->y < 0 || c->w <= 0 || c->h <= 0 || c->x + c->w > rw || c->y + c->h > rh))
+        return -1;
+
+    if (c->rotation == HAL_TRANSFORM_ROT_90) {
+        m.xu = 0;
+        m.xv = 1;
+        m.y0 = c->height - 1;
+        m.yu = -1;
+        m.yv = 0;
+    } else if (c->rotation == HAL_TRANSFORM_ROT_270) {
+        m.x0 = c->width - 1;
+        m.xu = 0;
+        m.xv = -1;
+        m.yu = 1;
+        m.yv = 0;
+    }
+
+    frame_convert_sync(c->src_fd, DMA_BUF_SYNC_START);
+    for (int v0 = 0; c->rgb && v0 < rh; v0 += FRAME_CONVERT_BAND) {
+        int v1 = v0 + FRAME_CONVERT_BAND < rh ? v0 + FRAME_CONVERT_BAND : rh;
+        int r0 = v0 > c->y ? v0 : c->y;
+        int r1 = v1 < c->y + c->h ? v1 : c->y + c->h;
+
+        if (r0 >= r1)
+            continue;
+        for (int u = c->x; u < c->x + c->w; u++) {
+            int sxu = m.x0 + u * m.xu, syu = m.y0 + u * m.yu;
+            unsigned char *rgb = c->rgb + (u - c->x) * 3;
+
+            for (int v = r0; v < r1; v++) {
+                int sx = sxu + v * m.xv, sy = syu + v * m.yv;
+
+                frame_convert_pixel(y_plane + sy * c->width + sx,
+                                    uv_plane + (sy >> uv_shift) * c->width + (sx & ~1),
+                                    rgb + (v - c->y) * c->w * 3);
+            }
+        }
+    }
+    if (c->small)
+        frame_convert_small(c, &m, y_plane, uv_plane, uv_shift, sw, sh);
+    frame_convert_sync(c->src_fd, DMA_BUF_SYNC_END);
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __FRAME_CONVERT_H__
+#define __FRAME_CONVERT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <rga/RgaApi.h>
+
+/*
+ * Rotate a YUV420SP/YUV422SP frame and convert it to RGB888 at full
+ * resolution and at an integer downscale in one call. Outputs are laid
+ * out in the rotated frame.
+ */
+struct frame_convert {
+    void *src;
+    int src_fd;
+    int width;
+    int height;
+    RgaSURF_FORMAT fmt;
+    int rotation;
+    /* full resolution crop at x, y, NULL to skip */
+    unsigned char *rgb;
+    int x;
+    int y;
+    int w;
+    int h;
+    /* the whole rotated frame, the mean of each step x step block, NULL to skip */
+    unsigned char *small;
+    int step;
+};
+
+bool frame_convert_supported(RgaSURF_FORMAT fmt, int rotation);
+int frame_convert_run(struct frame_convert *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "frame_mailbox.h"
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_post_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_idle_cond = PTHREAD_COND_INITIALIZER;
+static struct mailbox_frame *g_slot;
+static display_callback g_slot_cb;
+static struct mailbox_frame *g_busy;
+static bool g_run;
+static pthread_t g_tid;
+
+/* return a frame of the pool that nobody holds, with one reference */
+struct mailbox_frame *mailbox_frame_alloc(struct mailbox_frame *pool, int num)
+{
+    for (int i = 0; i < num; i++) {
+        int ref = 0;
+        if (__atomic_compare_exchange_n(&pool[i].ref, &ref, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return &pool[i];
+    }
+
+    return NULL;
+}
+
+void mailbox_frame_get(struct mailbox_frame *frame)
+{
+    __atomic_add_fetch(&frame->ref, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * The last holder releases before the count drops to 0, so the frame
+ * cannot be handed out again by mailbox_frame_alloc while in release.
+ */
+void mailbox_frame_put(struct mailbox_frame *frame)
+{
+    int ref = __atomic_load_n(&frame->ref, __ATOMIC_ACQUIRE);
+
+    while (ref > 1) {
+        if (__atomic_compare_exchange_n(&frame->ref, &ref, ref - 1, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return;
+    }
+    if (frame->release)
+        frame->release(frame);
+    __atomic_store_n(&frame->ref, 0, __ATOMIC_RELEASE);
+}
+
+static void *frame_mailbox_thread(void *arg)
+{
+    struct mailbox_frame *frame;
+    display_callback cb;
+
+    while (1) {
+        pthread_mutex_lock(&g_lock);
+        while (g_run && !g_slot)
+            pthread_cond_wait(&g_post_cond, &g_lock);
+        if (!g_run) {
+            pthread_mutex_unlock(&g_lock);
+            break;
+        }
+        frame = g_slot;
+        cb = g_slot_cb;
+        g_slot = NULL;
+        g_busy = frame;
+        pthread_mutex_unlock(&g_lock);
+
+        cb(frame->ptr, frame->fd, frame->fmt, frame->width, frame->height, frame->rotation);
+        /* released before idle, so flush returns with the buffer given back */
+        mailbox_frame_put(frame);
+
+        pthread_mutex_lock(&g_lock);
+        g_busy = NULL;
+        pthread_cond_broadcast(&g_idle_cond);
+        pthread_mutex_unlock(&g_lock);
+    }
+
+    pthread_exit(NULL);
+}
+
+int frame_mailbox_init(void)
+{
+    g_run = true;
+    if (pthread_create(&g_tid, NULL, frame_mailbox_thread, NULL)) {
+        printf("%s: pthread_create fail\n", __func__);
+        g_run = false;
+        return -1;
+    }
+
+    return 0;
+}
+
+void frame_mailbox_exit(void)
+{
+    if (!g_tid)
+        return;
+
+    pthread_mutex_lock(&g_lock);
+    g_run = false;
+    pthread_cond_signal(&g_post_cond);
+    pthread_mutex_unlock(&g_lock);
+    pthread_join(g_tid, NULL);
+    g_tid = 0;
+    frame_mailbox_flush();
+}
+
+/* without the display thread the callback runs in the caller as before */
+void frame_mailbox_post(struct mailbox_frame *frame, display_callback cb)
+{
+    struct mailbox_frame *old;
+
+    pthread_mutex_lock(&g_lock);
+    if (!g_run) {
+        pthread_mutex_unlock(&g_lock);
+        cb(frame->ptr, frame->fd, frame->fmt, frame->width, frame->height, frame->rotation);
+        return;
+    }
+    mailbox_frame_get(frame);
+    old = g_slot;
+    g_slot = frame;
+    g_slot_cb = cb;
+    pthread_cond_signal(&g_post_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    if (old)
+        mailbox_frame_put(old);
+}
+
+/* drop the pending frame and wait for the one being displayed */
+void frame_mailbox_flush(void)
+{
+    struct mailbox_frame *old;
+
+    pthread_mutex_lock(&g_lock);
+    old = g_slot;
+    g_slot = NULL;
+    while (g_busy)
+        pthread_cond_wait(&g_idle_cond, &g_lock);
+    pthread_mutex_unlock(&g_lock);
+
+    if (old)
+        mailbox_frame_put(old);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __FRAME_MAILBOX_H__
+#define __FRAME_MAILBOX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rkfacial.h"
+
+/*
+ * Camera frame shared between a capture thread and the display thread.
+ * The capture thread holds the first reference, release is called when
+ * the last one is dropped and hands the buffer back to the camera.
+ */
+struct mailbox_frame {
+    void *ptr;
+    int fd;
+    int fmt;
+    int width;
+    int height;
+    int rotation;
+    int ref;
+    void (*release)(struct mailbox_frame *frame);
+    void *priv;
+};
+
+struct mailbox_frame *mailbox_frame_alloc(struct mailbox_frame *pool, int num);
+void mailbox_frame_get(struct mailbox_frame *frame);
+void mailbox_frame_put(struct mailbox_frame *frame);
+
+/*
+ * Single slot, latest wins: a posted frame replaces the one not yet
+ * taken by the display thread, so display never throttles capture.
+ */
+int frame_mailbox_init(void);
+void frame_mailbox_exit(void);
+void frame_mailbox_post(struct mailbox_frame *frame, display_callback cb);
+void frame_mailbox_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "frame_ring.h"
+
+int frame_ring_init(struct frame_ring *r, unsigned int depth)
+{
+    unsigned int size = 1;
+
+    while (size < depth)
+        size <<= 1;
+
+    r->cell = (struct frame_ring_cell *)calloc(size, sizeof(struct frame_ring_cell));
+    if (!r->cell) {
+        printf("%s: alloc %u cells fail!\n", __func__, size);
+        return -1;
+    }
+    for (unsigned int i = 0; i < size; i++)
+        r->cell[i].seq = i;
+    r->mask = size - 1;
+    r->head = 0;
+    r->tail = 0;
+
+    return 0;
+}
+
+void frame_ring_deinit(struct frame_ring *r)
+{
+    if (r->cell) {
+        free(r->cell);
+        r->cell = NULL;
+    }
+}
+
+/* return -1 when the ring is full */
+int frame_ring_push(struct frame_ring *r, void *data)
+{
+    struct frame_ring_cell *cell;
+    unsigned int pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    while (1) {
+        cell = &r->cell[pos & r->mask];
+        unsigned int seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int diff = (int)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    cell->data = data;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* return NULL when the ring is empty */
+void *frame_ring_pop(struct frame_ring *r)
+{
+    struct frame_ring_cell *cell;
+    void *data;
+    unsigned int pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    while (1) {
+        cell = &r->cell[pos & r->mask];
+        unsigned int seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int diff = (int)(seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+        }
+    }
+    data = cell->data;
+    __atomic_store_n(&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+
+    return data;
+}
+
+unsigned int frame_ring_count(struct frame_ring *r)
+{
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+    return (int)(head - tail) > 0 ? head - tail : 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free ring of pointers, safe for any number of producers
+ * and consumers. Capacity is rounded up to a power of two, cells are
+ * preallocated at init so push/pop never allocate.
+ */
+struct frame_ring_cell {
+    unsigned int seq;
+    void *data;
+};
+
+struct frame_ring {
+    struct frame_ring_cell *cell;
+    unsigned int mask;
+    unsigned int head;
+    unsigned int tail;
+};
+
+int frame_ring_init(struct frame_ring *r, unsigned int depth);
+void frame_ring_deinit(struct frame_ring *r);
+int frame_ring_push(struct frame_ring *r, void *data);
+void *frame_ring_pop(struct frame_ring *r);
+unsigned int frame_ring_count(struct frame_ring *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
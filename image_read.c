@@ -30,9 +30,12 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+#include <stdlib.h>
+
 #include "image_read.h"
-#include "vpu_decode.h"
+#include "codec_pool.h"
 #include "rga_control.h"
+#include "face_stat.h"
 
 static int mjpeg_get_resolutin(FILE *fp, int *width, int *height)
 {
@@ -69,15 +72,17 @@ static int mjpeg_get_resolutin(FILE *fp, int *width, int *height)
 
 static int _decode(int width, int height, void *data, size_t size, int out_fd, void* out_data, int *fmt, int *hor_stride, int *ver_stride)
 {
-    int ret = -1;
-    struct vpu_decode dec;
-    memset(&dec, 0, sizeof(dec));
-    if (!vpu_decode_jpeg_init(&dec, width, height))
-        ret = vpu_decode_jpeg_doing(&dec, data, size, out_fd, out_data);
-    *fmt = (MPP_FMT_YUV422SP != dec.fmt ? RK_FORMAT_YCbCr_420_SP : RK_FORMAT_YCbCr_422_SP);
-    *hor_stride = dec.hor_stride;
-    *ver_stride = dec.ver_stride;
-    vpu_decode_jpeg_done(&dec);
+    int ret;
+    struct codec_ctx *ctx;
+
+    ctx = codec_pool_get(CODEC_JPEG_DEC, width, height, MPP_FMT_YUV420SP, 0);
+    if (!ctx)
+        return -1;
+    ret = codec_jpeg_decode(ctx, data, size, out_fd, out_data);
+    *fmt = (MPP_FMT_YUV422SP != ctx->fmt ? RK_FORMAT_YCbCr_420_SP : RK_FORMAT_YCbCr_422_SP);
+    *hor_stride = ctx->hor_stride;
+    *ver_stride = ctx->ver_stride;
+    codec_pool_put(ctx, !ret);
     return ret;
 }
 
@@ -147,6 +152,8 @@ int image_read(const char *path, rockface_image_t *img, bo_t *rgb_bo, int *rgb_f
     int width = 0, height = 0;
     int fmt;
     int hor_stride, ver_stride;
+    int blit;
+    struct face_stat_timer timer;
 
     if (image_read_begin(path, &dec_bo, &dec_fd, &width, &height, &fmt, &hor_stride, &ver_stride)) {
         ret = -2;
@@ -160,16 +167,15 @@ int image_read(const char *path, rockface_image_t *img, bo_t *rgb_bo, int *rgb_f
 
     rga_info_t src, dst;
     memset(&src, 0, sizeof(rga_info_t));
-    src.fd = -1;
-    src.virAddr = dec_bo.ptr;
-    src.mmuFlag = 1;
+    rga_control_set_buf(&src, dec_bo.ptr, dec_fd);
     rga_set_rect(&src.rect, 0, 0, width, height, hor_stride, ver_stride, fmt);
     memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = rgb_bo->ptr;
-    dst.mmuFlag = 1;
+    rga_control_set_buf(&dst, rgb_bo->ptr, *rgb_fd);
     rga_set_rect(&dst.rect, 0, 0, hor_stride, ver_stride, hor_stride, ver_stride, RK_FORMAT_RGB_888);
-    if (c_RkRgaBlit(&src, &dst, NULL)) {
+    face_stat_begin(&timer);
+    blit = rga_control_blit(&src, &dst);
+    face_stat_end(&timer, FACE_STAGE_RGA_IMAGE);
+    if (blit) {
         printf("%s: rga fail\n", __func__);
         goto exit0;
     }
@@ -32,9 +32,21 @@
  */
 #include <rga/RgaApi.h>
 #include <stdio.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+
+#include "rga_control.h"
 
 extern int c_RkRgaFree(bo_t *bo_info);
 
+/* read by every blit setup, cleared from whichever thread sees the driver refuse a dma-buf */
+static bool g_dmabuf = true;
+
+void set_rga_dmabuf(bool en)
+{
+    __atomic_store_n(&g_dmabuf, en, __ATOMIC_RELAXED);
+}
+
 int _rga_control_buffer_init(bo_t *bo, int *buf_fd, int width, int height, int bpp, int cache)
 {
     int ret;
@@ -71,12 +83,12 @@ int _rga_control_buffer_init(bo_t *bo, int *buf_fd, int width, int height, int b
 
 int rga_control_buffer_init(bo_t *bo, int *buf_fd, int width, int height, int bpp)
 {
-    _rga_control_buffer_init(bo, buf_fd, width, height, bpp, 1);
+    return _rga_control_buffer_init(bo, buf_fd, width, height, bpp, 1);
 }
 
 int rga_control_buffer_init_nocache(bo_t *bo, int *buf_fd, int width, int height, int bpp)
 {
-    _rga_control_buffer_init(bo, buf_fd, width, height, bpp, 0);
+    return _rga_control_buffer_init(bo, buf_fd, width, height, bpp, 0);
 }
 
 void rga_control_buffer_deinit(bo_t *bo, int buf_fd)
@@ -92,3 +104,50 @@ void rga_control_buffer_deinit(bo_t *bo, int buf_fd)
     if (ret)
         printf("c_RkRgaFree error : %s\n", strerror(errno));
 }
+
+/*
+ * librga takes the dma-buf fd first and only falls back to the address
+ * (and its cache maintenance) when fd is -1, so keep both when we have them.
+ */
+void rga_control_set_buf(rga_info_t *info, void *ptr, int fd)
+{
+    info->fd = __atomic_load_n(&g_dmabuf, __ATOMIC_RELAXED) ? fd : -1;
+    info->virAddr = ptr;
+    info->mmuFlag = 1;
+}
+
+/* the CPU reads what the RGA wrote through the fd, drop its stale lines */
+static void rga_control_sync(int fd)
+{
+    struct dma_buf_sync sync;
+
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync))
+        return;
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+int rga_control_blit(rga_info_t *src, rga_info_t *dst)
+{
+    int ret;
+
+    ret = c_RkRgaBlit(src, dst, NULL);
+    if (!ret) {
+        if (dst->fd >= 0 && dst->virAddr)
+            rga_control_sync(dst->fd);
+        return 0;
+    }
+    if ((src->fd < 0 && dst->fd < 0) || !src->virAddr || !dst->virAddr)
+        return ret;
+
+    src->fd = -1;
+    dst->fd = -1;
+    ret = c_RkRgaBlit(src, dst, NULL);
+    if (ret)
+        return ret;
+    /* only the dma-buf was refused, stay on addresses from now on */
+    if (__atomic_exchange_n(&g_dmabuf, false, __ATOMIC_RELAXED))
+        printf("%s: dma-buf blit fail, use virtual address\n", __func__);
+    return 0;
+}
@@ -37,11 +37,14 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <rga/RgaApi.h>
 
 int rga_control_buffer_init(bo_t *bo, int *buf_fd, int width, int height, int bpp);
 int rga_control_buffer_init_nocache(bo_t *bo, int *buf_fd, int width, int height, int bpp);
 void rga_control_buffer_deinit(bo_t *bo, int buf_fd);
+void rga_control_set_buf(rga_info_t *info, void *ptr, int fd);
+int rga_control_blit(rga_info_t *src, rga_info_t *dst);
 
 #ifdef __cplusplus
 }
@@ -35,6 +35,7 @@
 #include <stddef.h>
 #include <xf86drmMode.h>
 #include <sys/mman.h>
+#include <poll.h>
 #include <unistd.h>
 #include "rkdrm_display.h"
 
@@ -381,6 +382,65 @@ static drmModePlanePtr drmGetPlaneByType(int fd, int crtc_index, int type)
     return plane;
 }
 
+static bool drmPlaneHasFormat(drmModePlanePtr p, uint32_t format)
+{
+    int i;
+
+    for (i = 0; i < p->count_formats; i++) {
+        if (p->formats[i] == format)
+            return true;
+    }
+
+    return false;
+}
+
+int drmInitBoxPlane(struct drm_dev *dev, uint32_t format)
+{
+    drmModePlanePtr plane = NULL;
+    drmModePlaneResPtr plane_res;
+    int fd = dev->drm_fd;
+    int zpos;
+    int i;
+
+    plane_res = drmModeGetPlaneResources(fd);
+    if (!plane_res)
+        return -ENODEV;
+    for (i = 0; i < plane_res->count_planes; i++) {
+        drmModePlanePtr p = drmModeGetPlane(fd, plane_res->planes[i]);
+
+        if (!p)
+            continue;
+        if ((p->possible_crtcs & (1 << dev->crtc_index)) &&
+            p->plane_id != dev->plane_primary.p->plane_id &&
+            p->plane_id != dev->plane_overlay.p->plane_id &&
+            drmGetPlaneType(fd, p) == DRM_PLANE_TYPE_OVERLAY &&
+            drmPlaneHasFormat(p, format)) {
+            plane = p;
+            break;
+        }
+        drmModeFreePlane(p);
+    }
+    drmModeFreePlaneResources(plane_res);
+
+    if (!plane)
+        return -ENODEV;
+
+    dev->plane_box.p = plane;
+    drmFillPlaneProp(fd, &dev->plane_box);
+
+    /* above the video plane and the ui on the primary plane */
+    zpos = 2;
+    if (zpos > dev->plane_box.zpos_max ||
+        !drm_plane_set_property(fd, plane, "ZPOS", zpos)) {
+        printf("%s: set ZPOS property failed!\n", __func__);
+        drmModeFreePlane(plane);
+        dev->plane_box.p = NULL;
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
 drmModeConnectorPtr drmFoundConn(int fd, drmModeResPtr res)
 {
     drmModeConnectorPtr connector = NULL;
@@ -597,6 +657,8 @@ int drmDeinit(struct drm_dev *dev)
         drmModeFreePlane(dev->plane_primary.p);
     if (dev->plane_overlay.p)
         drmModeFreePlane(dev->plane_overlay.p);
+    if (dev->plane_box.p)
+        drmModeFreePlane(dev->plane_box.p);
     if (dev->dpms_prop)
         drmModeFreeProperty(dev->dpms_prop);
     if (dev->crtc)
@@ -609,29 +671,65 @@ int drmDeinit(struct drm_dev *dev)
     return 0;
 }
 
+static int drmAtomicAddPlane(drmModeAtomicReq *req, drmModeCrtcPtr crtc,
+                             drmModePlanePtr plane,
+                             struct plane_prop *plane_prop, int fb_id,
+                             int src_x, int src_y, int crtc_x, int crtc_y,
+                             int width, int height)
+{
+    int crtc_id = fb_id ? crtc->crtc_id : 0;
+    int ret;
+
+#define DRM_ATOMIC_ADD_PROP(object_id, value) \
+    ret = drmModeAtomicAddProperty(req, plane->plane_id, object_id, value); \
+    if (ret < 0) { \
+        printf("Failed to add prop[%d] to [%d]", value, object_id); \
+        return ret; \
+    }
+    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_id, crtc_id);
+    DRM_ATOMIC_ADD_PROP(plane_prop->fb_id, fb_id);
+    DRM_ATOMIC_ADD_PROP(plane_prop->src_x, src_x << 16);
+    DRM_ATOMIC_ADD_PROP(plane_prop->src_y, src_y << 16);
+    DRM_ATOMIC_ADD_PROP(plane_prop->src_w, width << 16);
+    DRM_ATOMIC_ADD_PROP(plane_prop->src_h, height << 16);
+    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_x, crtc_x);
+    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_y, crtc_y);
+    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_w, width);
+    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_h, height);
+#undef DRM_ATOMIC_ADD_PROP
+
+    return 0;
+}
+
 int drmCommit(struct drm_buf *buffer, int width, int height,
               int x_off, int y_off, struct drm_dev *dev, int plane_type)
+{
+    return drmCommitBox(buffer, width, height, x_off, y_off, dev,
+                        plane_type, NULL, 0, 0, 0, 0, NULL);
+}
+
+int drmCommitBox(struct drm_buf *buffer, int width, int height,
+                 int x_off, int y_off, struct drm_dev *dev, int plane_type,
+                 struct drm_buf *box, int box_x, int box_y,
+                 int box_w, int box_h, void *flip_data)
 {
     drmModeAtomicReq *req;
     drmModeCrtcPtr crtc = dev->crtc;
     drmModePlanePtr plane;
     struct plane_prop *plane_prop;
-    int plane_zpos;
     uint32_t flags = 0;
     int ret;
 
-    if (dev->drm_fd < 0 || !buffer) {
+    if (dev->drm_fd < 0 || !buffer || (box && !dev->plane_box.p)) {
         printf("%s: invalid parameters\n", __func__);
         return -EINVAL;
     }
 
     if (plane_type == DRM_PLANE_TYPE_PRIMARY) {
         plane = dev->plane_primary.p;
-        plane_zpos = dev->plane_primary.zpos_max;
         plane_prop = &dev->plane_primary.plane_prop;
     } else {
         plane = dev->plane_overlay.p;
-        plane_zpos = dev->plane_overlay.zpos_max;
         plane_prop = &dev->plane_overlay.plane_prop;
     }
 
@@ -640,28 +738,56 @@ int drmCommit(struct drm_buf *buffer, int width, int height,
 
     req = drmModeAtomicAlloc();
 
-#define DRM_ATOMIC_ADD_PROP(object_id, value) \
-    ret = drmModeAtomicAddProperty(req, plane->plane_id, object_id, value); \
-    if (ret < 0) \
-        printf("Failed to add prop[%d] to [%d]", value, object_id);
-    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_id, crtc->crtc_id);
-    DRM_ATOMIC_ADD_PROP(plane_prop->fb_id, buffer->fb_id);
-    DRM_ATOMIC_ADD_PROP(plane_prop->src_x, 0);
-    DRM_ATOMIC_ADD_PROP(plane_prop->src_y, 0);
-    DRM_ATOMIC_ADD_PROP(plane_prop->src_w, width << 16);
-    DRM_ATOMIC_ADD_PROP(plane_prop->src_h, height << 16);
-    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_x, x_off);
-    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_y, y_off);
-    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_w, width);
-    DRM_ATOMIC_ADD_PROP(plane_prop->crtc_h, height);
-    //DRM_ATOMIC_ADD_PROP(plane_prop->zpos, plane_zpos);
+    ret = drmAtomicAddPlane(req, crtc, plane, plane_prop, buffer->fb_id,
+                            0, 0, x_off, y_off, width, height);
+    /* the box plane only joins the request when its content changed */
+    if (!ret && box) {
+        if (box_w > 0 && box_h > 0)
+            ret = drmAtomicAddPlane(req, crtc, dev->plane_box.p,
+                                    &dev->plane_box.plane_prop, box->fb_id,
+                                    box_x, box_y, box_x, box_y, box_w, box_h);
+        else
+            ret = drmAtomicAddPlane(req, crtc, dev->plane_box.p,
+                                    &dev->plane_box.plane_prop, 0,
+                                    0, 0, 0, 0, 0, 0);
+    }
 
 //    flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
-    ret = drmModeAtomicCommit(dev->drm_fd, req, flags, NULL);
-    if (ret)
-        printf("atomic: couldn't commit new state: %s\n", strerror(errno));
+    /* return at once, the flip is reported through drmWaitFlip */
+    if (flip_data)
+        flags |= DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+    if (!ret) {
+        ret = drmModeAtomicCommit(dev->drm_fd, req, flags, flip_data);
+        if (ret)
+            printf("atomic: couldn't commit new state: %s\n", strerror(errno));
+    }
 
     drmModeAtomicFree(req);
 
     return ret;
 }
+
+int drmWaitFlip(struct drm_dev *dev, int timeout_ms, drm_flip_handler handler)
+{
+    drmEventContext ctx;
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = dev->drm_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret <= 0)
+        return ret < 0 && errno != EINTR ? -errno : 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.version = 2;
+    ctx.page_flip_handler = handler;
+    ret = drmHandleEvent(dev->drm_fd, &ctx);
+    if (ret) {
+        printf("%s: handle event failed: %s\n", __func__, strerror(errno));
+        return -errno;
+    }
+
+    return 1;
+}
@@ -87,8 +87,13 @@ struct drm_dev {
 
   struct drm_dev_plane plane_primary;
   struct drm_dev_plane plane_overlay;
+  struct drm_dev_plane plane_box;
 };
 
+typedef void (*drm_flip_handler)(int fd, unsigned int sequence,
+                                 unsigned int tv_sec, unsigned int tv_usec,
+                                 void *user_data);
+
 int drmGetBuffer(int fd, int width, int height, int format,
                  struct drm_buf *buffer);
 int drmPutBuffer(int fd, struct drm_buf *buffer);
@@ -96,6 +101,12 @@ int drmInit(struct drm_dev *dev);
 int drmDeinit(struct drm_dev *dev);
 int drmCommit(struct drm_buf *buffer, int width, int height, int x_off,
               int y_off, struct drm_dev *dev, int plane_type);
+int drmInitBoxPlane(struct drm_dev *dev, uint32_t format);
+int drmCommitBox(struct drm_buf *buffer, int width, int height, int x_off,
+                 int y_off, struct drm_dev *dev, int plane_type,
+                 struct drm_buf *box, int box_x, int box_y,
+                 int box_w, int box_h, void *flip_data);
+int drmWaitFlip(struct drm_dev *dev, int timeout_ms, drm_flip_handler handler);
 int drmSetDpmsMode(uint32_t dpms_mode, struct drm_dev *dev);
 
 #endif
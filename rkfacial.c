@@ -50,6 +50,7 @@
 #include "video_common.h"
 #include "usb_camera.h"
 #include "db_monitor.h"
+#include "frame_mailbox.h"
 #include "rkfacial.h"
 
 extern int aiq_control_alloc(void);
@@ -62,6 +63,8 @@ int rkfacial_init(void)
     if (c_RkRgaInit())
         printf("%s: rga init fail!\n", __func__);
 
+    frame_mailbox_init();
+
 #ifdef CAMERA_ENGINE_RKAIQ
     aiq_control_alloc();
     for (int i = 0; i < 10; i++) {
@@ -106,6 +109,8 @@ void rkfacial_exit(void)
 
     usb_camera_exit();
 
+    frame_mailbox_exit();
+
     rockface_control_exit();
 
     play_wav_thread_exit();
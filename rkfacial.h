@@ -41,6 +41,7 @@ struct user_info {
     char sAddress[32];
     unsigned int iAccessCardNumber;
     enum user_state state;
+    /* queued to the snapshot thread, may not be written yet, empty when dropped */
     char snap_path[256];
     rockface_det_t ir_face;
     rockface_det_t rgb_face;
@@ -70,12 +71,99 @@ void rockface_start_test(void);
 typedef void (*get_test_callback)(struct test_result *test);
 void register_get_test_callback(get_test_callback cb);
 
+enum face_stage {
+    FACE_STAGE_DETECT,
+    FACE_STAGE_TRACK,
+    FACE_STAGE_LANDMARK5,
+    FACE_STAGE_LANDMARK106,
+    FACE_STAGE_MASK_CLASSIFIER,
+    FACE_STAGE_ALIGN,
+    FACE_STAGE_EXTRACT,
+    FACE_STAGE_SEARCH,
+    FACE_STAGE_LIVENESS,
+    FACE_STAGE_RGA_DETECT,
+    FACE_STAGE_RGA_FEATURE,
+    FACE_STAGE_RGA_IR,
+    FACE_STAGE_RGA_DISPLAY,
+    FACE_STAGE_RGA_SNAPSHOT,
+    FACE_STAGE_RGA_IMAGE,
+    FACE_STAGE_SNAPSHOT_ENCODE,
+    FACE_STAGE_CONVERT,
+    FACE_STAGE_NUM,
+};
+
+/* always collected, latency in us, cpu_us is the cpu time of the calling threads */
+struct face_stage_stat {
+    unsigned int count;
+    unsigned int p50_us;
+    unsigned int p90_us;
+    unsigned int p99_us;
+    unsigned int max_us;
+    unsigned long long cpu_us;
+};
+
+void rockface_get_stage_stat(struct face_stage_stat *stat, int num);
+void rockface_reset_stage_stat(void);
+const char *rockface_get_stage_name(enum face_stage stage);
+
 typedef void (*display_callback)(void *ptr, int fd, int fmt, int w, int h, int rotation);
 
 void set_rgb_param(int width, int height, display_callback cb, bool expo);
 void set_ir_param(int width, int height, display_callback cb);
 void set_usb_param(int width, int height, display_callback cb);
 void set_face_param(int width, int height, int cnt);
+
+enum det_queue_policy {
+    DET_QUEUE_DROP_NEWEST,
+    DET_QUEUE_REPLACE_OLDEST,
+};
+
+struct det_queue_stat {
+    int depth;
+    enum det_queue_policy policy;
+    int ready;
+    unsigned int drop_newest;
+    unsigned int replace_oldest;
+};
+
+/* must be called before rkfacial_init */
+void set_face_det_queue(int depth, enum det_queue_policy policy);
+void set_face_det_worker(int num);
+/*
+ * convert only the area around the last detected face for feature
+ * extraction, snapshots then crop from that area as well
+ */
+void set_face_feature_roi(bool en);
+/*
+ * build the detect and feature frames on the CPU instead of two RGA jobs,
+ * the detect frame box averages the camera frame, YUV420SP/YUV422SP
+ * sources only; experimental, the C code has not been measured on device
+ */
+void set_face_convert_fused(bool en);
+/* blit by dma-buf fd where the buffer has one, default true */
+void set_rga_dmabuf(bool en);
+/* "rockface" or "mock", the first one built in is used by default */
+int set_face_backend(const char *name);
+/*
+ * index galleries of at least min_num faces (0: never), nprobe lists are
+ * scanned per search, more is slower with better recall
+ */
+void set_face_index(int min_num, int nprobe);
+void get_face_det_queue_stat(struct det_queue_stat *stat);
+
+/* snapshots are encoded and saved by a writer thread behind a bounded queue */
+struct snapshot_queue_stat {
+    int depth;
+    int queued;
+    int max_queued;
+    unsigned int written;
+    unsigned int dropped;
+    unsigned int failed;
+};
+
+/* must be called before rkfacial_init */
+void set_snapshot_queue(int depth);
+void get_snapshot_queue_stat(struct snapshot_queue_stat *stat);
 void set_rgb_display(display_callback cb);
 void set_ir_display(display_callback cb);
 void set_usb_display(display_callback cb);
@@ -83,6 +171,13 @@ void set_usb_display(display_callback cb);
 void set_rgb_rotation(int angle);
 void set_ir_rotation(int angle);
 void set_usb_rotation(int angle);
+/*
+ * use raw NV12/NV16/YUYV when the camera gives min_fps at the size, 0 for
+ * MJPEG only, the default until raw capture has been tried on cameras
+ */
+void set_usb_raw(int min_fps);
+/* open this device instead of probing for a usb camera */
+void set_usb_device(const char *dev);
 
 int rkfacial_init(void);
 void rkfacial_exit(void);
@@ -37,12 +37,12 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/inotify.h>
+#include <limits.h>
 #include <pthread.h>
 #include <errno.h>
 #include <math.h>
 
-#include <list>
-
 #include "face_common.h"
 #include "database.h"
 #include "rockface_control.h"
@@ -56,6 +56,14 @@
 #include "rkfacial.h"
 #include "display.h"
 #include "image_read.h"
+#include "frame_ring.h"
+#include "face_stat.h"
+#include "face_backend.h"
+#include "face_search.h"
+#include "face_gallery.h"
+#include "codec_pool.h"
+#include "face_meta.h"
+#include "frame_convert.h"
 
 #define TEST_RESULT_INC(x) \
     do { \
@@ -65,19 +73,13 @@
 
 #define DEFAULT_FACE_NUMBER 1000
 #define DEFAULT_FACE_PATH "/userdata"
-#define FACE_DETECT_SCORE 0.55 /* range 0 - 1.0, higher score means higher expectation */
-
-#define FACE_MASK_SIMILARITY_SCORE 1.05 /* suggest range 1.05 ~ 1.12, lower score means need higher similarity to recognize */
 #define FACE_SIMILARITY_CONVERT(f) powf(2.0, -((f)))
-#define FACE_SIMILARITY_SCORE 1.0 /* suggest range 0.7 ~ 1.3, lower score means need higher similarity to recognize */
 #define FACE_SIMILARITY_SCORE_REGISTER 0.5
 #define FACE_SCORE_REGISTER 0.99 /* range 0 - 1.0, higher score means higher expectation */
 #define FACE_REGISTER_CNT 5
-#define FACE_REAL_SCORE 0.5 /* range 0 - 1.0, higher score means higher expectation */
 #define LICENCE_PATH PRE_PATH "/key.lic"
 #define BAK_LICENCE_PATH BAK_PATH "/key.lic"
 #define FACE_DATA_PATH "/usr/lib"
-#define MIN_FACE_WIDTH(w) ((w) / 5)
 #define FACE_TRACK_FRAME 0
 #define FACE_RETRACK_TIME 1
 #define SNAP_TIME 3
@@ -88,22 +90,62 @@
 
 #define FACE_BLUR 0.85
 
+/* the feature ROI grows the last face box by 1/FEATURE_ROI_EXPAND per side */
+#define FEATURE_ROI_EXPAND 2
+
 #define DET_INTERVAL_TIME 1
 
+#define ENROLL_DECODE_NUM 2
+#define ENROLL_QUEUE_DEPTH 4
+#define ENROLL_COMMIT_NUM 256
+
+#define GALLERY_COMPACT_SEC 10
+#define GALLERY_COMPACT_RATIO 8 /* compact early once 1/8 of the entries are dead */
+
 struct face_buf {
     rockface_image_t img;
     rockface_det_t face;
     bo_t bo;
     int fd;
     int id;
+    /* filled by the detect workers */
+    rockface_det_array_t array;
+    int det;
+    bool track;
+    unsigned int seq;
+    /* part of the rotated frame held in img, the whole frame unless cropped */
+    rockface_rect_t roi;
 };
 
-static struct face_buf g_feature;
-static struct face_buf g_detect[DET_BUFFER_NUM];
-static pthread_mutex_t g_det_lock = PTHREAD_MUTEX_INITIALIZER;
-static std::list<struct face_buf*> g_det_free;
-static std::list<struct face_buf*> g_det_ready;
+struct det_worker {
+    pthread_t tid;
+    rockface_handle_t handle;
+};
 
+static struct face_buf g_feature;
+static bool g_feature_roi;
+static bool g_convert_fused;
+static pthread_mutex_t g_feature_roi_lock = PTHREAD_MUTEX_INITIALIZER;
+static rockface_rect_t g_feature_box;
+static struct face_buf *g_detect;
+static int g_det_num = DET_BUFFER_NUM;
+static enum det_queue_policy g_det_policy = DET_QUEUE_DROP_NEWEST;
+static struct frame_ring g_det_free;
+static struct frame_ring g_det_ready;
+static unsigned int g_det_drop_newest;
+static unsigned int g_det_replace_oldest;
+
+static int g_det_worker_num = 1;
+static struct det_worker *g_det_worker;
+static pthread_mutex_t g_det_seq_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int g_det_seq;
+static struct face_buf **g_det_reorder;
+static unsigned int g_det_next_seq;
+static pthread_mutex_t g_det_reorder_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_det_reorder_cond = PTHREAD_COND_INITIALIZER;
+
+/* detect throttle, shared by the detect workers and the register paths */
+static pthread_mutex_t g_det_time_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct timeval g_last_det_tv;
 static struct timeval g_last_reg_tv;
 
@@ -115,6 +157,7 @@ static void *g_mask_data = NULL;
 static int g_mask_index = 0;
 #endif
 
+static const struct face_backend *g_backend;
 static rockface_handle_t face_handle;
 static int g_total_cnt;
 
@@ -126,8 +169,8 @@ static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
 static bool g_feature_flag;
 static pthread_t g_detect_tid;
 static pthread_mutex_t g_detect_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* broadcast whenever g_det_ready gains a frame, waiters recheck the ring */
 static pthread_cond_t g_detect_cond = PTHREAD_COND_INITIALIZER;
-static bool g_detect_flag;
 static int g_rgb_track = -1;
 static pthread_mutex_t g_rgb_track_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -157,6 +200,18 @@ static bool g_delete = false;
 static struct snapshot g_snap;
 
 static pthread_mutex_t g_lib_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the backend library lags behind inserts and deletes until it is needed */
+static bool g_lib_dirty;
+static pthread_t g_compact_tid;
+static pthread_cond_t g_compact_cond = PTHREAD_COND_INITIALIZER;
+/* GALLERY_PATH lags behind the library, it is rewritten on the compaction tick */
+static struct face_gallery g_gallery;
+static unsigned int g_gallery_gen;
+static unsigned int g_gallery_saved;
+/* sqlite writes whose library update has not landed yet, the gallery is not stamped meanwhile */
+static int g_db_writes;
+/* the database holds users the library does not, only a reload brings them back in step */
+static bool g_gallery_stale;
 
 bool g_face_en;
 int g_face_width;
@@ -175,6 +230,24 @@ static int g_detect_en = 1;
 static int g_identity_en = 0;
 static char g_identity_path[256];
 
+/* reference feature of g_identity_path, dropped when inotify sees the file change */
+struct identity_cache {
+    bool valid;
+    int ret;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    rockface_feature_t feature;
+    rockface_feature_float_t mask;
+    float mask_score;
+};
+static struct identity_cache g_identity;
+static pthread_mutex_t g_identity_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_identity_fd = -1;
+static int g_identity_wd = -1;
+static char g_identity_name[NAME_MAX + 1];
+
 void rockface_control_set_detect_en(int en)
 {
     if (en) {
@@ -190,11 +263,49 @@ void rockface_control_set_detect_en(int en)
     g_detect_en = en;
 }
 
+/* watch the directory so a reference replaced by rename is seen too */
+static void rockface_control_watch_identity(void)
+{
+    char dir[sizeof(g_identity_path)];
+    char *slash;
+
+    if (g_identity_fd < 0)
+        g_identity_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_identity_fd < 0)
+        return;
+    if (g_identity_wd >= 0) {
+        inotify_rm_watch(g_identity_fd, g_identity_wd);
+        g_identity_wd = -1;
+    }
+
+    snprintf(dir, sizeof(dir), "%s", g_identity_path);
+    slash = strrchr(dir, '/');
+    if (slash) {
+        snprintf(g_identity_name, sizeof(g_identity_name), "%s", slash + 1);
+        if (slash == dir)
+            slash++;
+        *slash = 0;
+    } else {
+        snprintf(g_identity_name, sizeof(g_identity_name), "%s", dir);
+        snprintf(dir, sizeof(dir), ".");
+    }
+    g_identity_wd = inotify_add_watch(g_identity_fd, dir,
+                                      IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+    if (g_identity_wd < 0)
+        printf("%s: watch %s failed, %s\n", __func__, dir, strerror(errno));
+}
+
 void rockface_control_set_identity_en(int en, char *path)
 {
-    if (path)
+    pthread_mutex_lock(&g_identity_lock);
+    if (path) {
         strncpy(g_identity_path, path, sizeof(g_identity_path) - 1);
+        g_identity.valid = false;
+        if (en)
+            rockface_control_watch_identity();
+    }
     g_identity_en = en;
+    pthread_mutex_unlock(&g_identity_lock);
 }
 
 void rockface_start_test(void)
@@ -255,6 +366,39 @@ void set_face_param(int width, int height, int cnt)
     g_face_height = width > height ? width : height;
     g_face_cnt = cnt;
     g_ratio = tmp / DET_WIDTH;
+    face_config_set_frame(g_face_width, g_face_height, g_ratio);
+}
+
+void set_face_det_queue(int depth, enum det_queue_policy policy)
+{
+    g_det_num = depth > 0 ? depth : DET_BUFFER_NUM;
+    g_det_policy = policy;
+}
+
+void set_face_det_worker(int num)
+{
+    g_det_worker_num = num > 0 ? num : 1;
+}
+
+void set_face_feature_roi(bool en)
+{
+    g_feature_roi = en;
+}
+
+void set_face_convert_fused(bool en)
+{
+    g_convert_fused = en;
+}
+
+void get_face_det_queue_stat(struct det_queue_stat *stat)
+{
+    memset(stat, 0, sizeof(struct det_queue_stat));
+    stat->depth = g_det_num;
+    stat->policy = g_det_policy;
+    if (g_detect)
+        stat->ready = frame_ring_count(&g_det_ready);
+    stat->drop_newest = __atomic_load_n(&g_det_drop_newest, __ATOMIC_RELAXED);
+    stat->replace_oldest = __atomic_load_n(&g_det_replace_oldest, __ATOMIC_RELAXED);
 }
 
 static void check_pre_path(const char *pre)
@@ -303,65 +447,39 @@ void rockface_control_init_thread(void)
         printf("%s fail!\n", __func__);
 }
 
-static int get_min_pixel(int img_width)
-{
-    int pixel;
-    int min_pixel;
-    if (get_face_config_min_pixel(&pixel))
-        min_pixel = pixel * img_width / g_face_width;
-    else
-        min_pixel = MIN_FACE_WIDTH(img_width);
-    return min_pixel;
-}
-
 static float get_face_recognition_score(void)
 {
-    int th;
-    float score;
-    if (get_face_config_face_rec_th(&th)) {
-        th = th < 1 ? 1 : th;
-        th = th > 100 ? 100 : th;
-        score = log(100.0 / (th * 1.0)) / log(2);
-    } else {
-        score = FACE_SIMILARITY_SCORE;
-    }
+    const struct face_config_snapshot *cfg = face_config_get();
+    float score = cfg->rec_score;
+
+    face_config_put(cfg);
     return score;
 }
 
 static float get_face_mask_recognition_score(void)
 {
-    int th;
-    float score;
-    if (get_face_config_face_mask_th(&th)) {
-        th = th < 1 ? 1 : th;
-        th = th > 100 ? 100 : th;
-        score = log(100.0 / (th * 1.0)) / log(2);
-    } else {
-        score = FACE_MASK_SIMILARITY_SCORE;
-    }
+    const struct face_config_snapshot *cfg = face_config_get();
+    float score = cfg->mask_score;
+
+    face_config_put(cfg);
     return score;
 }
 
-
 static float get_face_detect_score(void)
 {
-    int th;
-    float score;
-    if (get_face_config_face_det_th(&th))
-        score = th * 1.0 / 100.0;
-    else
-        score = FACE_DETECT_SCORE;
+    const struct face_config_snapshot *cfg = face_config_get();
+    float score = cfg->det_score;
+
+    face_config_put(cfg);
     return score;
 }
 
 static float get_live_detect_score(void)
 {
-    int th;
-    float score;
-    if (get_face_config_live_det_th(&th))
-        score = th * 1.0 / 100.0;
-    else
-        score = FACE_REAL_SCORE;
+    const struct face_config_snapshot *cfg = face_config_get();
+    float score = cfg->live_score;
+
+    face_config_put(cfg);
     return score;
 }
 
@@ -388,85 +506,75 @@ static rockface_det_t *get_max_face(rockface_det_array_t *face_array)
     return max_face;
 }
 
-static bool check_face_region(rockface_rect_t *box, int img_width, int img_height)
+static bool check_face_region(const struct face_config_snapshot *cfg, rockface_rect_t *box,
+                              int img_width, int img_height)
 {
-    int x, y, w, h, nw, nh;
-
-    if (!get_face_config_corner_x(&x))
-        x = 0;
-    if (!get_face_config_corner_y(&y))
-        y = 0;
-    if (!get_face_config_det_width(&w))
-        w = g_face_width;
-    if (!get_face_config_det_height(&h))
-        h = g_face_height;
-    if (!get_face_config_nor_width(&nw))
-        nw = g_face_width;
-    if (!get_face_config_nor_height(&nh))
-        nh = g_face_height;
-
-    x = x * g_face_width / nw;
-    y = y * g_face_height / nh;
-    w = w * g_face_width / nw;
-    h = h * g_face_height / nh;
-
-    if (x + w > g_face_width)
-        w = g_face_width - x;
-    if (y + h > g_face_height)
-        h = g_face_height - y;
+    const int *r = img_width == DET_WIDTH ? cfg->det_region : cfg->region;
 
-    if (w <= 0 || h <= 0)
+    if (!cfg->region_en)
         return false;
 
-    if (img_width == DET_WIDTH) {
-        x /= g_ratio;
-        y /= g_ratio;
-        w /= g_ratio;
-        h /= g_ratio;
-    }
-
-    if (box->left <= x || box->top <= y || box->right >= x + w || box->bottom >= y + h)
+    if (box->left <= r[0] || box->top <= r[1] || box->right >= r[0] + r[2] || box->bottom >= r[1] + r[3])
         return false;
 
     return true;
 }
 
-static int _rockface_control_detect(rockface_image_t *image, rockface_det_t *out_face, int *track)
+static int rockface_control_detect_array(rockface_handle_t handle, rockface_image_t *image,
+                                         rockface_det_array_t *face_array, bool track)
 {
-    int r = 0;
     rockface_ret_t ret;
-    rockface_det_array_t face_array0;
-    rockface_det_array_t face_array;
+    struct face_stat_timer timer;
 
     if (track) {
         struct timeval tv;
+        bool skip;
         gettimeofday(&tv, NULL);
-        if (tv.tv_sec - g_last_reg_tv.tv_sec <= DET_INTERVAL_TIME &&
-                tv.tv_sec - g_last_det_tv.tv_sec <= DET_INTERVAL_TIME)
+        pthread_mutex_lock(&g_det_time_lock);
+        skip = tv.tv_sec - g_last_reg_tv.tv_sec <= DET_INTERVAL_TIME &&
+               tv.tv_sec - g_last_det_tv.tv_sec <= DET_INTERVAL_TIME;
+        if (!skip)
+            g_last_det_tv = tv;
+        pthread_mutex_unlock(&g_det_time_lock);
+        if (skip)
             return -1;
-        gettimeofday(&g_last_det_tv, NULL);
     }
 
-    memset(&face_array0, 0, sizeof(rockface_det_array_t));
-    memset(&face_array, 0, sizeof(rockface_det_array_t));
-    memset(out_face, 0, sizeof(rockface_det_t));
+    memset(face_array, 0, sizeof(rockface_det_array_t));
 
     TEST_RESULT_INC(rgb_detect_total);
-    ret = rockface_detect(face_handle, image, &face_array0);
+    face_stat_begin(&timer);
+    ret = g_backend->detect(handle, image, face_array);
+    face_stat_end(&timer, FACE_STAGE_DETECT);
     if (ret != ROCKFACE_RET_SUCCESS) {
         if (!track)
             printf("rockface_detect fail!\n");
         return -1;
     }
 
+    return 0;
+}
+
+static int rockface_control_detect_select(rockface_image_t *image, rockface_det_array_t *face_array0,
+                                          rockface_det_t *out_face, int *track)
+{
+    int r = 0;
+    rockface_ret_t ret;
+    struct face_stat_timer timer;
+    rockface_det_array_t face_array;
+
+    memset(&face_array, 0, sizeof(rockface_det_array_t));
+
     if (track) {
         TEST_RESULT_INC(rgb_track_total);
-        ret = rockface_track(face_handle, image, FACE_TRACK_FRAME, &face_array0, &face_array);
+        face_stat_begin(&timer);
+        ret = g_backend->track(face_handle, image, FACE_TRACK_FRAME, face_array0, &face_array);
+        face_stat_end(&timer, FACE_STAGE_TRACK);
         if (ret != ROCKFACE_RET_SUCCESS)
             return -1;
         TEST_RESULT_INC(rgb_track_ok);
     } else {
-        memcpy(&face_array, &face_array0, sizeof(rockface_det_array_t));
+        memcpy(&face_array, face_array0, sizeof(rockface_det_array_t));
     }
 
     rockface_det_t* face = get_max_face(&face_array);
@@ -475,9 +583,11 @@ static int _rockface_control_detect(rockface_image_t *image, rockface_det_t *out
             printf("rockface_detect fail: face is NULL!\n");
         return -1;
     }
-    if (face->score < get_face_detect_score()) {
+    struct face_config_snapshot cfg;
+    face_config_read(&cfg);
+    if (face->score < cfg.det_score) {
         if (!track)
-            printf("rockface_detect fail: face score %f, less than %f!\n", face->score, get_face_detect_score());
+            printf("rockface_detect fail: face score %f, less than %f!\n", face->score, cfg.det_score);
         return -1;
     }
     rockface_rect_t *box = &face->box;
@@ -489,9 +599,9 @@ static int _rockface_control_detect(rockface_image_t *image, rockface_det_t *out
     }
 
     if (track) {
-        if (face->box.right - face->box.left <= get_min_pixel(image->width))
+        if (face->box.right - face->box.left <= face_config_min_pixel(&cfg, image->width))
             return -1;
-        if (!check_face_region(&face->box, image->width, image->height))
+        if (!check_face_region(&cfg, &face->box, image->width, image->height))
             return -1;
     }
 
@@ -510,12 +620,36 @@ static int _rockface_control_detect(rockface_image_t *image, rockface_det_t *out
     return r;
 }
 
-static int rockface_control_detect(rockface_image_t *image, rockface_det_t *face)
+static int _rockface_control_detect(rockface_handle_t handle, rockface_image_t *image,
+                                    rockface_det_t *out_face, int *track)
+{
+    rockface_det_array_t face_array;
+
+    memset(out_face, 0, sizeof(rockface_det_t));
+    if (rockface_control_detect_array(handle, image, &face_array, track ? true : false))
+        return -1;
+
+    return rockface_control_detect_select(image, &face_array, out_face, track);
+}
+
+static bool rockface_control_detect_track_en(void)
+{
+    return (g_test.en || g_ir_save_real || g_ir_save_fake) ? false : true;
+}
+
+/* run the parallel part of detection, the result is consumed by rockface_control_detect */
+static void rockface_control_detect_buf(rockface_handle_t handle, struct face_buf *buf)
+{
+    buf->track = rockface_control_detect_track_en();
+    buf->det = rockface_control_detect_array(handle, &buf->img, &buf->array, buf->track);
+}
+
+static int rockface_control_detect(struct face_buf *buf)
 {
     int ret;
     static struct timeval t0;
     struct timeval t1;
-    bool en;
+    rockface_det_t *face = &buf->face;
 
     memset(face, 0, sizeof(rockface_det_t));
 
@@ -528,8 +662,11 @@ static int rockface_control_detect(rockface_image_t *image, rockface_det_t *face
         gettimeofday(&t0, NULL);
     }
     pthread_mutex_unlock(&g_rgb_track_mutex);
-    en = (g_test.en || g_ir_save_real || g_ir_save_fake) ? true : false;
-    ret = _rockface_control_detect(image, face, en ? NULL : &g_rgb_track);
+    if (buf->det)
+        ret = -1;
+    else
+        ret = rockface_control_detect_select(&buf->img, &buf->array, face,
+                                             buf->track ? &g_rgb_track : NULL);
     if (face->score > get_face_detect_score()) {
         int left, top, right, bottom;
         int width, height;
@@ -558,21 +695,280 @@ static int rockface_control_init_library(void *data, int num, size_t size, size_
 {
     rockface_ret_t ret;
 
-    ret = rockface_face_library_init2(face_handle, mask ? ROCKFACE_RECOG_MASK : ROCKFACE_RECOG_NORMAL, data, num, size, off);
+    ret = g_backend->library_init(face_handle, mask ? ROCKFACE_RECOG_MASK : ROCKFACE_RECOG_NORMAL, data, num, size, off);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: int library error %d!\n", __func__, ret);
         return -1;
     }
+    face_search_init(mask ? FACE_SEARCH_MASK : FACE_SEARCH_NORMAL, data, num, size, off,
+                     g_backend->feature_compare);
 
     return 0;
 }
 
+/* g_lib_lock not held, k-means runs on a copy and recognition goes on meanwhile */
+static void rockface_control_index_library(void)
+{
+    face_search_index(FACE_SEARCH_NORMAL, PRE_PATH "/face_index", &g_lib_lock);
+#ifdef FACE_MASK
+    face_search_index(FACE_SEARCH_MASK, PRE_PATH "/face_index_mask", &g_lib_lock);
+#endif
+}
+
+/* g_lib_lock held, it is dropped while the index goes to flash */
+static void rockface_control_save_index(void)
+{
+    face_search_save(FACE_SEARCH_NORMAL, &g_lib_lock);
+#ifdef FACE_MASK
+    face_search_save(FACE_SEARCH_MASK, &g_lib_lock);
+#endif
+}
+
 static void rockface_control_release_library(void)
 {
-    rockface_face_library_release(face_handle);
+    face_search_release(FACE_SEARCH_NORMAL);
+    face_search_release(FACE_SEARCH_MASK);
+    g_backend->library_release(face_handle);
 }
 
-static int rockface_control_get_feature(rockface_image_t *in_image,
+/* g_lib_lock held, drop the tombstones of deleted users */
+static void rockface_control_compact_library(void)
+{
+    int num;
+
+    if (face_search_dead(FACE_SEARCH_NORMAL)) {
+        num = face_search_compact(FACE_SEARCH_NORMAL);
+        if (num >= 0)
+            g_face_index = num;
+        g_lib_dirty = true;
+    }
+#ifdef FACE_MASK
+    if (face_search_dead(FACE_SEARCH_MASK)) {
+        num = face_search_compact(FACE_SEARCH_MASK);
+        if (num >= 0)
+            g_mask_index = num;
+        g_lib_dirty = true;
+    }
+#endif
+}
+
+/* g_lib_lock held, the backend library only sees compacted data */
+static void rockface_control_sync_library(void)
+{
+    if (!g_lib_dirty)
+        return;
+    rockface_control_compact_library();
+    g_backend->library_release(face_handle);
+    g_backend->library_init(face_handle, ROCKFACE_RECOG_NORMAL, g_face_data, g_face_index,
+                            sizeof(struct face_data), 0);
+#ifdef FACE_MASK
+    g_backend->library_init(face_handle, ROCKFACE_RECOG_MASK, g_mask_data, g_mask_index,
+                            sizeof(struct mask_data), 0);
+#endif
+    g_lib_dirty = false;
+}
+
+/* g_lib_lock held, the entries of id become tombstones */
+static void rockface_control_remove_library(int id)
+{
+    struct face_data *face = (struct face_data *)g_face_data;
+
+    for (int i = 0; i < g_face_index; i++) {
+        if (face[i].id == id) {
+            face_search_remove(FACE_SEARCH_NORMAL, i);
+            face[i].id = -1;
+            g_lib_dirty = true;
+            g_gallery_gen++;
+        }
+    }
+#ifdef FACE_MASK
+    struct mask_data *mask = (struct mask_data *)g_mask_data;
+
+    for (int i = 0; i < g_mask_index; i++) {
+        if (mask[i].id == id) {
+            face_search_remove(FACE_SEARCH_MASK, i);
+            mask[i].id = -1;
+            g_lib_dirty = true;
+            g_gallery_gen++;
+        }
+    }
+#endif
+    if (face_search_dead(FACE_SEARCH_NORMAL) * GALLERY_COMPACT_RATIO >= g_face_index)
+        pthread_cond_signal(&g_compact_cond);
+}
+
+/* g_lib_lock held, append one user after the last entry */
+static int rockface_control_append_library(int id, void *feature, void *mask_feature)
+{
+    struct face_data *face;
+
+    if (g_face_index >= g_face_cnt)
+        rockface_control_compact_library();
+    if (g_face_index >= g_face_cnt) {
+        printf("%s: face library is full!\n", __func__);
+        return -1;
+    }
+    face = (struct face_data *)g_face_data + g_face_index;
+    memset(face, 0, sizeof(struct face_data));
+    if (feature)
+        memcpy(&face->feature, feature, sizeof(rockface_feature_t));
+    face->id = id;
+    if (face_search_add(FACE_SEARCH_NORMAL) < 0)
+        return -1;
+    g_face_index++;
+#ifdef FACE_MASK
+    struct mask_data *mask = (struct mask_data *)g_mask_data + g_mask_index;
+
+    memset(mask, 0, sizeof(struct mask_data));
+    if (mask_feature)
+        memcpy(&mask->feature, mask_feature, sizeof(rockface_feature_float_t));
+    mask->id = id;
+    if (face_search_add(FACE_SEARCH_MASK) < 0)
+        return -1;
+    g_mask_index++;
+#endif
+    g_lib_dirty = true;
+    g_gallery_gen++;
+    return 0;
+}
+
+static void rockface_control_insert_library(int id, void *feature, void *mask_feature)
+{
+    int ret;
+
+    pthread_mutex_lock(&g_lib_lock);
+    rockface_control_remove_library(id);
+    ret = rockface_control_append_library(id, feature, mask_feature);
+    pthread_mutex_unlock(&g_lib_lock);
+    /* the in-memory library is out of step with the database */
+    if (ret)
+        rockface_control_database();
+}
+
+static void rockface_control_delete_library(int id)
+{
+    pthread_mutex_lock(&g_lib_lock);
+    rockface_control_remove_library(id);
+    pthread_mutex_unlock(&g_lib_lock);
+}
+
+/* g_lib_lock held, it is dropped while the copy goes to flash */
+static void rockface_control_save_gallery(void)
+{
+    struct face_gallery_stamp stamp;
+    void *face = NULL;
+    void *mask = NULL;
+    int face_num = g_face_index;
+    int mask_num = 0;
+    unsigned int gen = g_gallery_gen;
+    int ret;
+
+    if (gen == g_gallery_saved || g_db_writes)
+        return;
+    if (g_gallery_stale) {
+        unlink(GALLERY_PATH);
+        g_gallery_saved = gen;
+        return;
+    }
+    /* stamped before the copy, a database change after it leaves the file stale */
+    if (face_gallery_stamp(DATABASE_PATH, &stamp))
+        return;
+    face = malloc(face_num * sizeof(struct face_data) + 1);
+    if (!face)
+        return;
+    memcpy(face, g_face_data, face_num * sizeof(struct face_data));
+#ifdef FACE_MASK
+    mask_num = g_mask_index;
+    mask = malloc(mask_num * sizeof(struct mask_data) + 1);
+    if (!mask) {
+        free(face);
+        return;
+    }
+    memcpy(mask, g_mask_data, mask_num * sizeof(struct mask_data));
+#endif
+    pthread_mutex_unlock(&g_lib_lock);
+
+    ret = face_gallery_save(GALLERY_PATH, &stamp, g_face_cnt, face, face_num, mask, mask_num);
+    if (ret)
+        unlink(GALLERY_PATH);
+    free(face);
+    free(mask);
+
+    pthread_mutex_lock(&g_lib_lock);
+    /* a failed save is retried on the next tick */
+    if (!ret)
+        g_gallery_saved = gen;
+}
+
+/* the library is updated after the sqlite write, keep the gallery from being stamped in between */
+static void rockface_control_db_begin(void)
+{
+    pthread_mutex_lock(&g_lib_lock);
+    g_db_writes++;
+    pthread_mutex_unlock(&g_lib_lock);
+}
+
+/* synced is false when the library was left behind the database */
+static void rockface_control_db_end(bool synced)
+{
+    pthread_mutex_lock(&g_lib_lock);
+    g_db_writes--;
+    if (!synced)
+        g_gallery_stale = true;
+    g_gallery_gen++;
+    pthread_mutex_unlock(&g_lib_lock);
+}
+
+static void *rockface_control_compact_thread(void *arg)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&g_lib_lock);
+    while (g_run) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += GALLERY_COMPACT_SEC;
+        pthread_cond_timedwait(&g_compact_cond, &g_lib_lock, &ts);
+        if (!g_run)
+            break;
+        rockface_control_compact_library();
+        rockface_control_save_gallery();
+        rockface_control_save_index();
+    }
+    pthread_mutex_unlock(&g_lib_lock);
+
+    return NULL;
+}
+
+/* in-tree search first, the backend one only if its metric is not supported */
+static rockface_ret_t rockface_control_feature_search(rockface_feature_t *feature, bool mask, float threshold,
+                                                      rockface_search_result_t *result)
+{
+    struct face_search_match match;
+    int ret;
+
+    ret = face_search_topk(mask ? FACE_SEARCH_MASK : FACE_SEARCH_NORMAL, feature, threshold, &match, 1);
+    if (ret == -2) {
+        rockface_control_sync_library();
+        return g_backend->feature_search(face_handle, feature, threshold, result);
+    }
+    if (ret <= 0)
+        return ROCKFACE_RET_FAIL;
+
+    result->face_data = match.data;
+    result->similarity = match.distance;
+    return ROCKFACE_RET_SUCCESS;
+}
+
+/* g_lib_lock held, result->face_data points into the library and goes stale once it is dropped */
+static int rockface_control_result_id(rockface_search_result_t *result, bool mask)
+{
+    if (mask)
+        return ((struct mask_data *)result->face_data)->id;
+    return ((struct face_data *)result->face_data)->id;
+}
+
+static int rockface_control_get_feature(rockface_handle_t handle,
+                                        rockface_image_t *in_image,
                                         rockface_feature_t *out_feature,
                                         rockface_feature_float_t *mask_feature,
                                         rockface_det_t *in_face,
@@ -580,13 +976,16 @@ static int rockface_control_get_feature(rockface_image_t *in_image,
                                         float *mask_score)
 {
     rockface_ret_t ret;
+    struct face_stat_timer timer;
 
     memset(out_feature, 0, sizeof(rockface_feature_t));
     memset(mask_feature, 0, sizeof(rockface_feature_float_t));
 
     rockface_landmark_t landmark;
     TEST_RESULT_INC(rgb_landmark_total);
-    ret = rockface_landmark5(face_handle, in_image, &(in_face->box), &landmark);
+    face_stat_begin(&timer);
+    ret = g_backend->landmark5(handle, in_image, &(in_face->box), &landmark);
+    face_stat_end(&timer, FACE_STAGE_LANDMARK5);
     if (ret != ROCKFACE_RET_SUCCESS || landmark.score < 0.3) {
         if (reg)
             printf("rockface_landmark5 fail!\n");
@@ -596,7 +995,9 @@ static int rockface_control_get_feature(rockface_image_t *in_image,
 
     rockface_landmark_t landmark106;
     rockface_angle_t angle;
-    ret = rockface_landmark106(face_handle, in_image, &(in_face->box),  &landmark, &landmark106, &angle);
+    face_stat_begin(&timer);
+    ret = g_backend->landmark106(handle, in_image, &(in_face->box),  &landmark, &landmark106, &angle);
+    face_stat_end(&timer, FACE_STAGE_LANDMARK106);
     if (ret != ROCKFACE_RET_SUCCESS || angle.pitch > 30.0 || angle.pitch < -30.0 ||
             angle.yaw > 30.0 || angle.yaw < -30.0 || angle.roll > 30.0 || angle.roll < -30.0)
         return -1;
@@ -605,7 +1006,9 @@ static int rockface_control_get_feature(rockface_image_t *in_image,
     if (reg) {
         *mask_score = 0.0;
     } else {
-        ret = rockface_mask_classifier(face_handle, in_image, &(in_face->box), mask_score);
+        face_stat_begin(&timer);
+        ret = g_backend->mask_classifier(handle, in_image, &(in_face->box), mask_score);
+        face_stat_end(&timer, FACE_STAGE_MASK_CLASSIFIER);
         if (ret != ROCKFACE_RET_SUCCESS) {
             printf("rockface_mask_classifier error");
             return -1;
@@ -619,7 +1022,9 @@ static int rockface_control_get_feature(rockface_image_t *in_image,
         rockface_image_t out_img;
         memset(&out_img, 0, sizeof(rockface_image_t));
         TEST_RESULT_INC(rgb_align_total);
-        ret = rockface_align(face_handle, in_image, &(in_face->box), &landmark, &out_img);
+        face_stat_begin(&timer);
+        ret = g_backend->align(handle, in_image, &(in_face->box), &landmark, &out_img);
+        face_stat_end(&timer, FACE_STAGE_ALIGN);
         if (ret != ROCKFACE_RET_SUCCESS) {
             if (reg)
                 printf("rockface_align fail!\n");
@@ -628,8 +1033,10 @@ static int rockface_control_get_feature(rockface_image_t *in_image,
         TEST_RESULT_INC(rgb_align_ok);
 
         TEST_RESULT_INC(rgb_extract_total);
-        ret = rockface_feature_extract(face_handle, &out_img, out_feature);
-        rockface_image_release(&out_img);
+        face_stat_begin(&timer);
+        ret = g_backend->feature_extract(handle, &out_img, out_feature);
+        face_stat_end(&timer, FACE_STAGE_EXTRACT);
+        g_backend->image_release(&out_img);
         if (ret != ROCKFACE_RET_SUCCESS) {
             if (reg)
                 printf("rockface_feature_extract fail!\n");
@@ -640,7 +1047,9 @@ static int rockface_control_get_feature(rockface_image_t *in_image,
 
 #ifdef FACE_MASK
     if (reg || *mask_score >= 0.5) {
-        ret = rockface_mask_feature_extract(face_handle, in_image, &in_face->box, reg ? 0 : 1, mask_feature);
+        face_stat_begin(&timer);
+        ret = g_backend->mask_feature_extract(handle, in_image, &in_face->box, reg ? 0 : 1, mask_feature);
+        face_stat_end(&timer, FACE_STAGE_EXTRACT);
         if (ret != ROCKFACE_RET_SUCCESS) {
             if (reg)
                 printf("rockface_mask_feature_extract fail!\n");
@@ -652,6 +1061,33 @@ static int rockface_control_get_feature(rockface_image_t *in_image,
     return 0;
 }
 
+/* hardware decode first, the backend decoder if that fails, returns 0 or 1 for which one */
+static int rockface_control_read_image(const char *path, rockface_image_t *img, bo_t *rgb_bo,
+                                       int *rgb_fd)
+{
+    int read;
+
+    read = image_read(path, img, rgb_bo, rgb_fd);
+    if (read) {
+        if (read != -2)
+            image_read_deinit(rgb_bo, rgb_fd);
+
+        /* use software decode */
+        if (g_backend->image_read(path, img, 1))
+            return -1;
+        return 1;
+    }
+    return 0;
+}
+
+static void rockface_control_release_image(int read, rockface_image_t *img, bo_t *rgb_bo, int *rgb_fd)
+{
+    if (!read)
+        image_read_deinit(rgb_bo, rgb_fd);
+    else if (read > 0)
+        g_backend->image_release(img);
+}
+
 int rockface_control_get_path_feature(const char *path, void *feature, void *mask_feature, float *mask_score)
 {
     int ret = -1;
@@ -667,22 +1103,71 @@ int rockface_control_get_path_feature(const char *path, void *feature, void *mas
     while (access(path, F_OK) && --cnt)
         usleep(100000);
 
-    /* try hardware decode */
-    read = image_read(path, &in_img, &rgb_bo, &rgb_fd);
-    if (read) {
-        if (read != -2)
-            image_read_deinit(&rgb_bo, &rgb_fd);
+    read = rockface_control_read_image(path, &in_img, &rgb_bo, &rgb_fd);
+    if (read < 0)
+        return -1;
+    if (!_rockface_control_detect(face_handle, &in_img, &face, NULL))
+        ret = rockface_control_get_feature(face_handle, &in_img, out_feature, out_mask, &face, true, mask_score);
+    rockface_control_release_image(read, &in_img, &rgb_bo, &rgb_fd);
+    return ret;
+}
 
-        /* use software decode */
-        if (rockface_image_read(path, &in_img, 1))
-            return -1;
+static bool rockface_control_identity_stale(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    struct stat st;
+    bool stale = !g_identity.valid;
+    ssize_t len;
+
+    if (g_identity_wd < 0) {
+        /* no inotify, compare the file on every use */
+        if (stat(g_identity_path, &st))
+            memset(&st, 0, sizeof(st));
+        return stale || st.st_dev != g_identity.dev || st.st_ino != g_identity.ino ||
+               st.st_size != g_identity.size || st.st_mtim.tv_sec != g_identity.mtime.tv_sec ||
+               st.st_mtim.tv_nsec != g_identity.mtime.tv_nsec;
     }
-    if (!_rockface_control_detect(&in_img, &face, NULL))
-        ret = rockface_control_get_feature(&in_img, out_feature, out_mask, &face, true, mask_score);
-    if (!read)
-        image_read_deinit(&rgb_bo, &rgb_fd);
-    else
-        rockface_image_release(&in_img);
+
+    while ((len = read(g_identity_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + event->len) {
+            event = (struct inotify_event *)p;
+            if ((event->mask & IN_Q_OVERFLOW) ||
+                    (event->len && !strcmp(event->name, g_identity_name)))
+                stale = true;
+        }
+    }
+    return stale;
+}
+
+/* the reference is extracted once, a missing file is retried when it shows up */
+static int rockface_control_identity_feature(rockface_feature_t *feature,
+                                             rockface_feature_float_t *mask, float *mask_score)
+{
+    struct stat st;
+    int ret;
+
+    pthread_mutex_lock(&g_identity_lock);
+    if (rockface_control_identity_stale()) {
+        memset(&g_identity, 0, sizeof(g_identity));
+        g_identity.ret = -1;
+        if (!stat(g_identity_path, &st)) {
+            g_identity.dev = st.st_dev;
+            g_identity.ino = st.st_ino;
+            g_identity.size = st.st_size;
+            g_identity.mtime = st.st_mtim;
+            g_identity.ret = rockface_control_get_path_feature(g_identity_path, &g_identity.feature,
+                                                               &g_identity.mask, &g_identity.mask_score);
+        }
+        g_identity.valid = true;
+    }
+    ret = g_identity.ret;
+    if (!ret) {
+        memcpy(feature, &g_identity.feature, sizeof(rockface_feature_t));
+        memcpy(mask, &g_identity.mask, sizeof(rockface_feature_float_t));
+        *mask_score = g_identity.mask_score;
+    }
+    pthread_mutex_unlock(&g_identity_lock);
     return ret;
 }
 
@@ -697,31 +1182,53 @@ void rockface_set_user_info(struct user_info *info, enum user_state state,
         memcpy(&info->rgb_face, rgb_face, sizeof(rockface_det_t));
 }
 
-static bool rockface_control_search(rockface_image_t *image, void *data, int *index, int cnt,
+#ifdef USE_WEB_SERVER
+struct control_record {
+    int id;
+    char status[64];
+    char similarity[64];
+};
+
+/* snapshot callbacks, run on the snapshot writer thread */
+static void rockface_control_record_snapshot(const char *name, void *arg)
+{
+    db_monitor_snapshot_record_set((char *)name);
+}
+
+static void rockface_control_record_control(const char *name, void *arg)
+{
+    struct control_record *record = (struct control_record *)arg;
+
+    db_monitor_control_record_set(record->id, (char *)name, record->status, record->similarity);
+}
+#endif
+
+static bool rockface_control_search(rockface_image_t *image, int image_fd, void *data, int *index, int cnt,
                               size_t size, size_t offset, rockface_det_t *face, int reg,
-                              struct face_data **face_data, struct mask_data **mask_data, float *similarity)
+                              int *id, char *has_mask, float *similarity)
 {
     rockface_ret_t ret;
     rockface_search_result_t result;
     rockface_feature_t feature;
     rockface_feature_float_t mask;
     float mask_score;
+    struct face_stat_timer timer;
 
-    if (rockface_control_get_feature(image, &feature, &mask, face, false, &mask_score) == 0) {
+    if (rockface_control_get_feature(face_handle, image, &feature, &mask, face, false, &mask_score) == 0) {
         //printf("g_total_cnt = %d\n", ++g_total_cnt);
         if (g_identity_en) {
             rockface_feature_t f;
             rockface_feature_float_t m;
             float s;
-            if (!rockface_control_get_path_feature(g_identity_path, &f, &m, &s)) {
+            if (!rockface_control_identity_feature(&f, &m, &s)) {
                 float simi;
                 bool pass = false;
                 if (mask_score < 0.5) {
-                    rockface_feature_compare((rockface_feature_t *)&feature, (rockface_feature_t *)&f, &simi);
+                    g_backend->feature_compare((rockface_feature_t *)&feature, (rockface_feature_t *)&f, &simi);
                     if (simi < get_face_recognition_score())
                         pass = true;
                 } else {
-                    rockface_feature_compare((rockface_feature_t *)&mask, (rockface_feature_t *)&m, &simi);
+                    g_backend->feature_compare((rockface_feature_t *)&mask, (rockface_feature_t *)&m, &simi);
                     if (simi < get_face_mask_recognition_score())
                         pass = true;
                 }
@@ -739,16 +1246,16 @@ static bool rockface_control_search(rockface_image_t *image, void *data, int *in
         }
         pthread_mutex_lock(&g_lib_lock);
         TEST_RESULT_INC(rgb_search_total);
-        ret = rockface_feature_search(face_handle,
-                mask_score < 0.5 ? &feature : (rockface_feature_t *)&mask,
+        face_stat_begin(&timer);
+        ret = rockface_control_feature_search(mask_score < 0.5 ? &feature : (rockface_feature_t *)&mask,
+                mask_score >= 0.5,
                 mask_score < 0.5 ? get_face_recognition_score() : get_face_mask_recognition_score(), &result);
+        face_stat_end(&timer, FACE_STAGE_SEARCH);
         if (ret == ROCKFACE_RET_SUCCESS) {
             TEST_RESULT_INC(rgb_search_ok);
             *similarity = result.similarity;
-            if (mask_score < 0.5)
-                *face_data = (struct face_data *)result.face_data;
-            else
-                *mask_data = (struct mask_data *)result.face_data;
+            *id = rockface_control_result_id(&result, mask_score >= 0.5);
+            *has_mask = mask_score >= 0.5 ? 1 : 0;
             pthread_mutex_unlock(&g_lib_lock);
             if (g_register && ++g_register_cnt > FACE_REGISTER_CNT) {
                 g_register = false;
@@ -767,9 +1274,13 @@ static bool rockface_control_search(rockface_image_t *image, void *data, int *in
             }
             snprintf(name, sizeof(name), "%s/%s_%d.jpg", g_white_list, USER_NAME, id);
 #ifdef USE_WEB_SERVER
+            /* the user keeps name as its picture, it is written before the user is added */
             strncpy(g_snap.name, name, sizeof(g_snap.name));
-            if (!snapshot_run(&g_snap, image, NULL, RK_FORMAT_RGB_888, 0, 0))
-                printf("save %s success\n", name);
+            if (snapshot_save(&g_snap, image, image_fd, RK_FORMAT_RGB_888)) {
+                printf("save %s fail\n", name);
+                return false;
+            }
+            printf("save %s success\n", name);
 #endif
 
             if (mask_score < 0.5)
@@ -784,8 +1295,8 @@ static bool rockface_control_search(rockface_image_t *image, void *data, int *in
         }
 #ifdef USE_WEB_SERVER
         memset(g_snap.name, 0, sizeof(g_snap.name));
-        if (!snapshot_run(&g_snap, image, face, RK_FORMAT_RGB_888, SNAP_TIME, 'S'))
-            db_monitor_snapshot_record_set(g_snap.name);
+        snapshot_run(&g_snap, image, image_fd, face, RK_FORMAT_RGB_888, SNAP_TIME, 'S',
+                     rockface_control_record_snapshot, NULL, 0);
 #endif
     }
 
@@ -806,23 +1317,44 @@ void rockface_control_set_register(void)
         g_register = true;
 }
 
+static int rockface_control_blit(rga_info_t *src, rga_info_t *dst, enum face_stage stage)
+{
+    int ret;
+    struct face_stat_timer timer;
+
+    face_stat_begin(&timer);
+    ret = rga_control_blit(src, dst);
+    face_stat_end(&timer, stage);
+
+    return ret;
+}
+
+/* any number of detect workers wait here, the ring itself is the predicate */
 static void rockface_control_detect_wait(void)
 {
     pthread_mutex_lock(&g_detect_mutex);
-    if (g_detect_flag)
+    while (g_run && !frame_ring_count(&g_det_ready))
         pthread_cond_wait(&g_detect_cond, &g_detect_mutex);
-    g_detect_flag = true;
     pthread_mutex_unlock(&g_detect_mutex);
 }
 
+/* after the push, so a waiter that checked the ring before it is still asleep */
 static void rockface_control_detect_signal(void)
 {
     pthread_mutex_lock(&g_detect_mutex);
-    g_detect_flag = false;
-    pthread_cond_signal(&g_detect_cond);
+    pthread_cond_broadcast(&g_detect_cond);
     pthread_mutex_unlock(&g_detect_mutex);
 }
 
+static void rockface_control_detect_broadcast(void)
+{
+    rockface_control_detect_signal();
+
+    pthread_mutex_lock(&g_det_reorder_lock);
+    pthread_cond_broadcast(&g_det_reorder_cond);
+    pthread_mutex_unlock(&g_det_reorder_lock);
+}
+
 static int rockface_control_wait(void)
 {
     int ret;
@@ -846,15 +1378,45 @@ static int rockface_control_wait(void)
     return ret;
 }
 
-static void rockface_control_signal(void)
-{
-    pthread_mutex_lock(&g_mutex);
-    g_feature_flag = false;
-    pthread_cond_signal(&g_cond);
-    pthread_mutex_unlock(&g_mutex);
+static void rockface_control_signal(void)
+{
+    pthread_mutex_lock(&g_mutex);
+    g_feature_flag = false;
+    pthread_cond_signal(&g_cond);
+    pthread_mutex_unlock(&g_mutex);
+}
+
+static struct face_buf *rockface_control_detect_get(void)
+{
+    struct face_buf *buf;
+
+    buf = (struct face_buf *)frame_ring_pop(&g_det_free);
+    if (!buf && g_det_policy == DET_QUEUE_REPLACE_OLDEST) {
+        /* reuse the oldest frame still waiting for the detect thread */
+        buf = (struct face_buf *)frame_ring_pop(&g_det_ready);
+        if (buf)
+            __atomic_add_fetch(&g_det_replace_oldest, 1, __ATOMIC_RELAXED);
+    }
+    if (!buf)
+        __atomic_add_fetch(&g_det_drop_newest, 1, __ATOMIC_RELAXED);
+
+    return buf;
+}
+
+static void rockface_control_detect_put(struct face_buf *buf, int id)
+{
+    memset(&buf->img, 0, sizeof(rockface_image_t));
+    buf->img.width = DET_WIDTH;
+    buf->img.height = DET_HEIGHT;
+    buf->img.pixel_format = ROCKFACE_PIXEL_FORMAT_RGB888;
+    buf->img.data = (uint8_t *)buf->bo.ptr;
+    buf->id = id;
+
+    frame_ring_push(&g_det_ready, buf);
+    rockface_control_detect_signal();
 }
 
-int rockface_control_convert_detect(void *ptr, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id)
+int rockface_control_convert_detect(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id)
 {
     rga_info_t src, dst;
     struct face_buf *buf;
@@ -862,90 +1424,226 @@ int rockface_control_convert_detect(void *ptr, int width, int height, RgaSURF_FO
     if (!g_run || !g_detect_en)
         return -1;
 
-    pthread_mutex_lock(&g_det_lock);
-    if (g_det_free.empty()) {
-        pthread_mutex_unlock(&g_det_lock);
+    buf = rockface_control_detect_get();
+    if (!buf)
         return -1;
-    } else {
-        buf = g_det_free.front();
-        g_det_free.pop_front();
-        pthread_mutex_unlock(&g_det_lock);
-    }
 
     memset(&src, 0, sizeof(rga_info_t));
-    src.fd = -1;
-    src.virAddr = ptr;
-    src.mmuFlag = 1;
+    rga_control_set_buf(&src, ptr, fd);
     src.rotation = rotation;
     rga_set_rect(&src.rect, 0, 0, width, height, width, height, fmt);
     memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = buf->bo.ptr;
-    dst.mmuFlag = 1;
+    rga_control_set_buf(&dst, buf->bo.ptr, buf->fd);
     rga_set_rect(&dst.rect, 0, 0, DET_WIDTH, DET_HEIGHT,
                  DET_WIDTH, DET_HEIGHT, RK_FORMAT_RGB_888);
-    if (c_RkRgaBlit(&src, &dst, NULL)) {
+    if (rockface_control_blit(&src, &dst, FACE_STAGE_RGA_DETECT)) {
         printf("%s: rga fail\n", __func__);
         goto exit;
     }
-    memset(&buf->img, 0, sizeof(rockface_image_t));
-    buf->img.width = DET_WIDTH;
-    buf->img.height = DET_HEIGHT;
-    buf->img.pixel_format = ROCKFACE_PIXEL_FORMAT_RGB888;
-    buf->img.data = (uint8_t *)buf->bo.ptr;
-    buf->id = id;
-
-    pthread_mutex_lock(&g_det_lock);
-    g_det_ready.push_back(buf);
-    pthread_mutex_unlock(&g_det_lock);
-    rockface_control_detect_signal();
+    rockface_control_detect_put(buf, id);
 
     return 0;
 
 exit:
-    pthread_mutex_lock(&g_det_lock);
-    g_det_free.push_back(buf);
-    pthread_mutex_unlock(&g_det_lock);
+    frame_ring_push(&g_det_free, buf);
     return -1;
 }
 
-int rockface_control_convert_feature(void *ptr, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id)
+/* last face seen by the detect thread in full frame coordinates, NULL when gone */
+static void rockface_control_feature_box(rockface_det_t *face)
+{
+    pthread_mutex_lock(&g_feature_roi_lock);
+    if (face) {
+        g_feature_box.left = face->box.left * g_ratio;
+        g_feature_box.top = face->box.top * g_ratio;
+        g_feature_box.right = face->box.right * g_ratio;
+        g_feature_box.bottom = face->box.bottom * g_ratio;
+    } else {
+        memset(&g_feature_box, 0, sizeof(g_feature_box));
+    }
+    pthread_mutex_unlock(&g_feature_roi_lock);
+}
+
+/*
+ * Crop the feature frame around the last detected face. Registration keeps
+ * the whole frame because its snapshot is the full picture.
+ */
+static bool rockface_control_feature_roi(int width, int height, rockface_rect_t *roi)
+{
+    rockface_rect_t box;
+    int dw, dh;
+
+    if (!g_feature_roi || g_register)
+        return false;
+
+    pthread_mutex_lock(&g_feature_roi_lock);
+    memcpy(&box, &g_feature_box, sizeof(box));
+    pthread_mutex_unlock(&g_feature_roi_lock);
+    if (box.right <= box.left || box.bottom <= box.top)
+        return false;
+
+    dw = (box.right - box.left) / FEATURE_ROI_EXPAND;
+    dh = (box.bottom - box.top) / FEATURE_ROI_EXPAND;
+    roi->left = (box.left - dw > 0 ? box.left - dw : 0) & ~1;
+    roi->top = (box.top - dh > 0 ? box.top - dh : 0) & ~1;
+    roi->right = (box.right + dw < width ? box.right + dw : width) & ~1;
+    roi->bottom = (box.bottom + dh < height ? box.bottom + dh : height) & ~1;
+
+    return roi->right > roi->left && roi->bottom > roi->top;
+}
+
+/* map a rect of the rotated frame back to the width x height source */
+static void rockface_control_rotate_rect(int rotation, int width, int height,
+                                         int *x, int *y, int *w, int *h)
+{
+    int rx = *x, ry = *y, rw = *w, rh = *h;
+
+    switch (rotation) {
+    case HAL_TRANSFORM_ROT_90:
+        *x = ry;
+        *y = height - rx - rw;
+        *w = rh;
+        *h = rw;
+        break;
+    case HAL_TRANSFORM_ROT_270:
+        *x = width - ry - rh;
+        *y = rx;
+        *w = rh;
+        *h = rw;
+        break;
+    default:
+        break;
+    }
+}
+
+int rockface_control_convert_feature(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id)
 {
     rga_info_t src, dst;
+    rockface_rect_t roi;
+    int x, y, w, h;
     if (!g_feature_flag || g_feature.id)
         return -1;
+    if (!rockface_control_feature_roi(height, width, &roi)) {
+        roi.left = 0;
+        roi.top = 0;
+        roi.right = height;
+        roi.bottom = width;
+    }
+    x = roi.left;
+    y = roi.top;
+    w = roi.right - roi.left;
+    h = roi.bottom - roi.top;
+    rockface_control_rotate_rect(rotation, width, height, &x, &y, &w, &h);
     memset(&src, 0, sizeof(rga_info_t));
-    src.fd = -1;
-    src.virAddr = ptr;
-    src.mmuFlag = 1;
+    rga_control_set_buf(&src, ptr, fd);
     src.rotation = rotation;
-    rga_set_rect(&src.rect, 0, 0, width, height, width, height, fmt);
+    rga_set_rect(&src.rect, x, y, w, h, width, height, fmt);
     memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = g_feature.bo.ptr;
-    dst.mmuFlag = 1;
-    rga_set_rect(&dst.rect, 0, 0, height, width, height, width, RK_FORMAT_RGB_888);
-    if (c_RkRgaBlit(&src, &dst, NULL)) {
+    rga_control_set_buf(&dst, g_feature.bo.ptr, g_feature.fd);
+    w = roi.right - roi.left;
+    h = roi.bottom - roi.top;
+    rga_set_rect(&dst.rect, 0, 0, w, h, w, h, RK_FORMAT_RGB_888);
+    if (rockface_control_blit(&src, &dst, FACE_STAGE_RGA_FEATURE)) {
         printf("%s: rga fail\n", __func__);
         return -1;
     }
     memset(&g_feature.img, 0, sizeof(g_feature.img));
-    g_feature.img.width = height;
-    g_feature.img.height = width;
+    g_feature.img.width = w;
+    g_feature.img.height = h;
     g_feature.img.pixel_format = ROCKFACE_PIXEL_FORMAT_RGB888;
     g_feature.img.data = (uint8_t *)g_feature.bo.ptr;
+    memcpy(&g_feature.roi, &roi, sizeof(roi));
     g_feature.id = id;
 
     return 0;
 }
 
+/*
+ * Detect and feature frames of one camera frame. With the fused converter
+ * both come out of a single CPU pass over the source instead of two RGA
+ * jobs that each read it.
+ */
+int rockface_control_convert(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id)
+{
+    struct frame_convert c;
+    struct face_stat_timer timer;
+    struct face_buf *buf;
+    rockface_rect_t roi;
+    bool swap = rotation == HAL_TRANSFORM_ROT_90 || rotation == HAL_TRANSFORM_ROT_270;
+    int rw = swap ? height : width;
+    int rh = swap ? width : height;
+    bool feature;
+    int ret;
+
+    if (!g_convert_fused || !frame_convert_supported(fmt, rotation) || g_ratio <= 0 ||
+        rw != DET_WIDTH * g_ratio || rh != DET_HEIGHT * g_ratio) {
+        if (rockface_control_convert_detect(ptr, fd, width, height, fmt, rotation, id))
+            return -1;
+        return rockface_control_convert_feature(ptr, fd, width, height, fmt, rotation, id);
+    }
+
+    if (!g_run || !g_detect_en)
+        return -1;
+    buf = rockface_control_detect_get();
+    if (!buf)
+        return -1;
+
+    memset(&c, 0, sizeof(c));
+    c.src = ptr;
+    c.src_fd = fd;
+    c.width = width;
+    c.height = height;
+    c.fmt = fmt;
+    c.rotation = rotation;
+    c.small = (unsigned char *)buf->bo.ptr;
+    c.step = g_ratio;
+    feature = g_feature_flag && !g_feature.id;
+    if (feature) {
+        if (!rockface_control_feature_roi(rw, rh, &roi)) {
+            roi.left = 0;
+            roi.top = 0;
+            roi.right = rw;
+            roi.bottom = rh;
+        }
+        c.rgb = (unsigned char *)g_feature.bo.ptr;
+        c.x = roi.left;
+        c.y = roi.top;
+        c.w = roi.right - roi.left;
+        c.h = roi.bottom - roi.top;
+    }
+    face_stat_begin(&timer);
+    ret = frame_convert_run(&c);
+    face_stat_end(&timer, FACE_STAGE_CONVERT);
+    if (ret) {
+        printf("%s: convert fail\n", __func__);
+        frame_ring_push(&g_det_free, buf);
+        return -1;
+    }
+
+    if (feature) {
+        memset(&g_feature.img, 0, sizeof(g_feature.img));
+        g_feature.img.width = c.w;
+        g_feature.img.height = c.h;
+        g_feature.img.pixel_format = ROCKFACE_PIXEL_FORMAT_RGB888;
+        g_feature.img.data = (uint8_t *)g_feature.bo.ptr;
+        memcpy(&g_feature.roi, &roi, sizeof(roi));
+        g_feature.id = id;
+    }
+    rockface_control_detect_put(buf, id);
+
+    return 0;
+}
+
 static bool rockface_control_liveness_ir(void)
 {
     rockface_ret_t ret;
     rockface_liveness_t result;
+    struct face_stat_timer timer;
 
     TEST_RESULT_INC(ir_liveness_total);
-    ret = rockface_liveness_detect(face_handle, &g_ir_img, &g_ir_face.box, &result);
+    face_stat_begin(&timer);
+    ret = g_backend->liveness_detect(face_handle, &g_ir_img, &g_ir_face.box, &result);
+    face_stat_end(&timer, FACE_STAGE_LIVENESS);
     if (ret != ROCKFACE_RET_SUCCESS)
         return false;
 
@@ -956,26 +1654,23 @@ static bool rockface_control_liveness_ir(void)
     return true;
 }
 
-static bool rockface_control_detect_ir(void *ptr, int width, int height, RgaSURF_FORMAT fmt, int rotation)
+static bool rockface_control_detect_ir(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation)
 {
     rockface_ret_t ret;
     rockface_det_array_t face_array;
+    struct face_stat_timer timer;
 
     int src_w = width, src_h = height;
     int dst_w = DET_WIDTH, dst_h = DET_HEIGHT;
     rga_info_t src, dst;
     memset(&src, 0, sizeof(rga_info_t));
-    src.fd = -1;
-    src.virAddr = ptr;
-    src.mmuFlag = 1;
+    rga_control_set_buf(&src, ptr, fd);
     src.rotation = rotation;
     rga_set_rect(&src.rect, 0, 0, src_w, src_h, src_w, src_h, fmt);
     memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = g_ir_det_bo.ptr;
-    dst.mmuFlag = 1;
+    rga_control_set_buf(&dst, g_ir_det_bo.ptr, g_ir_det_fd);
     rga_set_rect(&dst.rect, 0, 0, dst_w, dst_h, dst_w, dst_h, RK_FORMAT_RGB_888);
-    if (c_RkRgaBlit(&src, &dst, NULL)) {
+    if (rockface_control_blit(&src, &dst, FACE_STAGE_RGA_IR)) {
         printf("%s: rga fail\n", __func__);
         return false;
     }
@@ -988,16 +1683,20 @@ static bool rockface_control_detect_ir(void *ptr, int width, int height, RgaSURF
     ir_det_img.data = (uint8_t *)g_ir_det_bo.ptr;
     rockface_output_test();
     TEST_RESULT_INC(ir_detect_total);
-    ret = rockface_detect(face_handle, &ir_det_img, &face_array);
+    face_stat_begin(&timer);
+    ret = g_backend->detect(face_handle, &ir_det_img, &face_array);
+    face_stat_end(&timer, FACE_STAGE_DETECT);
     if (ret != ROCKFACE_RET_SUCCESS)
         return false;
 
+    struct face_config_snapshot cfg;
+    face_config_read(&cfg);
     rockface_det_t* face = get_max_face(&face_array);
-    if (face == NULL || face->score < get_face_detect_score() ||
-        face->box.right - face->box.left <= get_min_pixel(ir_det_img.width))
+    if (face == NULL || face->score < cfg.det_score ||
+        face->box.right - face->box.left <= face_config_min_pixel(&cfg, ir_det_img.width))
         return false;
 
-    if (!check_face_region(&face->box, ir_det_img.width, ir_det_img.height))
+    if (!check_face_region(&cfg, &face->box, ir_det_img.width, ir_det_img.height))
         return false;
 
     face->box.left *= g_ratio;
@@ -1019,7 +1718,7 @@ static void save_ir(const char *path)
     save_file(g_ir_bo.ptr, g_ir_img.width * g_ir_img.height, path, ext);
 }
 
-int rockface_control_convert_ir(void *ptr, int width, int height, RgaSURF_FORMAT fmt, int rotation)
+int rockface_control_convert_ir(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation)
 {
     int ret = -1;
     rga_info_t src, dst;
@@ -1030,7 +1729,7 @@ int rockface_control_convert_ir(void *ptr, int width, int height, RgaSURF_FORMAT
     if (g_ir_state != IR_STATE_PREPARED)
         return ret;
 
-    if (!rockface_control_detect_ir(ptr, width, height, fmt, rotation))
+    if (!rockface_control_detect_ir(ptr, fd, width, height, fmt, rotation))
         goto exit;
 
     memset(&g_ir_img, 0, sizeof(rockface_image_t));
@@ -1052,18 +1751,14 @@ int rockface_control_convert_ir(void *ptr, int width, int height, RgaSURF_FORMAT
     }
 
     memset(&src, 0, sizeof(rga_info_t));
-    src.fd = -1;
-    src.virAddr = ptr;
-    src.mmuFlag = 1;
+    rga_control_set_buf(&src, ptr, fd);
     src.rotation = rotation;
     rga_set_rect(&src.rect, 0, 0, width, height, width, height, fmt);
     memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = g_ir_bo.ptr;
-    dst.mmuFlag = 1;
+    rga_control_set_buf(&dst, g_ir_bo.ptr, g_ir_fd);
     rga_set_rect(&dst.rect, 0, 0, g_ir_img.width, g_ir_img.height,
                  g_ir_img.width, g_ir_img.height, fmt);
-    if (c_RkRgaBlit(&src, &dst, NULL)) {
+    if (rockface_control_blit(&src, &dst, FACE_STAGE_RGA_IR)) {
         printf("%s: rga fail\n", __func__);
         goto exit;
     }
@@ -1108,6 +1803,67 @@ exit:
     return ret;
 }
 
+/*
+ * With more than one detect worker, rockface_detect runs in parallel on
+ * per-worker handles. Frames get a sequence number when they are taken from
+ * the ready ring and are handed back to the detect thread in that order, so
+ * rockface_track and the g_feature.id handoff still see frames in order.
+ * In-flight frames never exceed g_det_num, so seq % g_det_num is unique.
+ */
+static void *rockface_control_det_worker_thread(void *arg)
+{
+    struct det_worker *worker = (struct det_worker *)arg;
+    struct face_buf *buf;
+
+    while (g_run) {
+        pthread_mutex_lock(&g_det_seq_lock);
+        buf = (struct face_buf *)frame_ring_pop(&g_det_ready);
+        if (buf)
+            buf->seq = g_det_seq++;
+        pthread_mutex_unlock(&g_det_seq_lock);
+        if (!buf) {
+            rockface_control_detect_wait();
+            continue;
+        }
+
+        rockface_control_detect_buf(worker->handle, buf);
+
+        pthread_mutex_lock(&g_det_reorder_lock);
+        g_det_reorder[buf->seq % g_det_num] = buf;
+        pthread_cond_broadcast(&g_det_reorder_cond);
+        pthread_mutex_unlock(&g_det_reorder_lock);
+    }
+
+    pthread_exit(NULL);
+}
+
+static struct face_buf *rockface_control_detect_next(void)
+{
+    struct face_buf *buf;
+
+    if (g_det_worker_num <= 1) {
+        buf = (struct face_buf *)frame_ring_pop(&g_det_ready);
+        if (!buf) {
+            rockface_control_detect_wait();
+            return NULL;
+        }
+        rockface_control_detect_buf(face_handle, buf);
+        return buf;
+    }
+
+    pthread_mutex_lock(&g_det_reorder_lock);
+    while (g_run && !g_det_reorder[g_det_next_seq % g_det_num])
+        pthread_cond_wait(&g_det_reorder_cond, &g_det_reorder_lock);
+    buf = g_det_reorder[g_det_next_seq % g_det_num];
+    if (buf) {
+        g_det_reorder[g_det_next_seq % g_det_num] = NULL;
+        g_det_next_seq++;
+    }
+    pthread_mutex_unlock(&g_det_reorder_lock);
+
+    return buf;
+}
+
 static void *rockface_control_detect_thread(void *arg)
 {
     rockface_ret_t ret;
@@ -1115,30 +1871,20 @@ static void *rockface_control_detect_thread(void *arg)
     int det;
     struct face_buf *buf = NULL;
     int live_det_en;
+    const struct face_config_snapshot *cfg;
 
     while (g_run) {
-        if (buf) {
-            pthread_mutex_lock(&g_det_lock);
-            g_det_free.push_back(buf);
-            pthread_mutex_unlock(&g_det_lock);
-        }
-        buf = NULL;
-        pthread_mutex_lock(&g_det_lock);
-        if (g_det_ready.empty()) {
-            pthread_mutex_unlock(&g_det_lock);
-            rockface_control_detect_wait();
-        } else {
-            buf = g_det_ready.front();
-            g_det_ready.pop_front();
-            pthread_mutex_unlock(&g_det_lock);
-        }
+        if (buf)
+            frame_ring_push(&g_det_free, buf);
+        buf = rockface_control_detect_next();
         if (!buf)
             continue;
 
         if (!g_run)
             break;
 
-        det = rockface_control_detect(&buf->img, &buf->face);
+        det = rockface_control_detect(buf);
+        rockface_control_feature_box(buf->face.score > get_face_detect_score() ? &buf->face : NULL);
         if (det) {
             if (det == -1)
                 memset(last_name, 0, sizeof(last_name));
@@ -1146,8 +1892,9 @@ static void *rockface_control_detect_thread(void *arg)
             continue;
         }
 
-        if (!get_face_config_live_det_en(&live_det_en))
-            live_det_en = true;
+        cfg = face_config_get();
+        live_det_en = cfg->live_det_en;
+        face_config_put(cfg);
         if (!g_feature_flag || (live_det_en && g_ir_state != IR_STATE_CANCELED))
             continue;
 
@@ -1158,6 +1905,10 @@ static void *rockface_control_detect_thread(void *arg)
             g_feature.face.box.right = buf->face.box.right * g_ratio;
             g_feature.face.box.bottom = buf->face.box.bottom * g_ratio;
             g_feature.id = 0;
+            if (g_feature.face.box.left < g_feature.roi.left || g_feature.face.box.top < g_feature.roi.top ||
+                g_feature.face.box.right >= g_feature.roi.right ||
+                g_feature.face.box.bottom >= g_feature.roi.bottom)
+                continue;
             pthread_mutex_lock(&g_rgb_track_mutex);
             g_rgb_track = buf->face.id;
             pthread_mutex_unlock(&g_rgb_track_mutex);
@@ -1167,7 +1918,7 @@ static void *rockface_control_detect_thread(void *arg)
                 g_ir_state = IR_STATE_PREPARED;
 #ifdef IR_TEST_DATA
                 if (!camir_control_run()) {
-                    rockface_control_convert_ir(g_test_bo.ptr, g_face_width, g_face_height,
+                    rockface_control_convert_ir(g_test_bo.ptr, g_test_fd, g_face_width, g_face_height,
                                                 RK_FORMAT_YCbCr_420_SP, 0);
                     g_ir_state = IR_STATE_CANCELED;
                 }
@@ -1186,14 +1937,12 @@ static void *rockface_control_detect_thread(void *arg)
 static void *rockface_control_feature_thread(void *arg)
 {
     int index;
-    struct face_data *result;
-    struct mask_data *mask;
     rockface_det_t face;
     struct timeval t0, t1;
     int del_timeout = 0;
     int reg_timeout = 0;
     bool ret;
-    char result_name[NAME_LEN];
+    struct face_meta meta;
     int timeout;
     float similar;
     int id;
@@ -1239,22 +1988,16 @@ static void *rockface_control_feature_thread(void *arg)
         if (timeout == ETIMEDOUT)
             continue;
         memcpy(&face, &g_feature.face, sizeof(face));
+        face.box.left -= g_feature.roi.left;
+        face.box.top -= g_feature.roi.top;
+        face.box.right -= g_feature.roi.left;
+        face.box.bottom -= g_feature.roi.top;
         gettimeofday(&t0, NULL);
-        result = NULL;
-        mask = NULL;
-        ret = (struct face_data*)rockface_control_search(&g_feature.img, g_face_data, &g_face_index,
-                        g_face_cnt, sizeof(struct face_data), 0, &face, reg_timeout, &result, &mask,
+        id = -1;
+        has_mask = 0;
+        ret = rockface_control_search(&g_feature.img, g_feature.fd, g_face_data, &g_face_index,
+                        g_face_cnt, sizeof(struct face_data), 0, &face, reg_timeout, &id, &has_mask,
                         &similar);
-        if (result) {
-            id = result->id;
-            has_mask = 0;
-        } else if (mask) {
-            id = mask->id;
-            has_mask = 1;
-        } else {
-            id = -1;
-            has_mask = 0;
-        }
         gettimeofday(&t1, NULL);
         if (g_delete && del_timeout && id >= 0) {
             rockface_control_delete(id, NULL, true, true);
@@ -1267,16 +2010,16 @@ static void *rockface_control_feature_thread(void *arg)
                 rkfacial_paint_info_cb(&info, true);
             }
         } else if (id >= 0 && face.score > get_face_detect_score()) {
-            if (database_is_id_exist(id, result_name, NAME_LEN)) {
-                if (!g_register && memcmp(last_name, result_name, sizeof(last_name))) {
+            if (face_meta_get(id, &meta)) {
+                if (!g_register && memcmp(last_name, meta.name, sizeof(last_name))) {
                     char status[64];
                     char similarity[64];
                     char mark;
-                    printf("name: %s\n", result_name);
+                    printf("name: %s\n", meta.name);
                     memset(last_name, 0, sizeof(last_name));
-                    strncpy(last_name, result_name, sizeof(last_name) - 1);
-                    if (strstr(result_name, "black_list")) {
-                        printf("%s in black_list\n", result_name);
+                    strncpy(last_name, meta.name, sizeof(last_name) - 1);
+                    if (meta.flags & FACE_META_BLACK_LIST) {
+                        printf("%s in black_list\n", meta.name);
                         snprintf(status, sizeof(status), "close");
                         mark = 'B';
                     } else {
@@ -1286,20 +2029,23 @@ static void *rockface_control_feature_thread(void *arg)
                     }
                     snprintf(similarity, sizeof(similarity), "%f", FACE_SIMILARITY_CONVERT(similar));
 #ifdef USE_WEB_SERVER
+                    struct control_record record;
+                    record.id = id;
+                    snprintf(record.status, sizeof(record.status), "%s", status);
+                    snprintf(record.similarity, sizeof(record.similarity), "%s", similarity);
                     memset(g_snap.name, 0, sizeof(g_snap.name));
-                    if (!snapshot_run(&g_snap, &g_feature.img, &face, RK_FORMAT_RGB_888, 0, mark))
-                        db_monitor_control_record_set(id, g_snap.name,
-                                status, similarity);
+                    snapshot_run(&g_snap, &g_feature.img, g_feature.fd, &face, RK_FORMAT_RGB_888, 0, mark,
+                                 rockface_control_record_control, &record, sizeof(record));
 #endif
                 }
                 if (rkfacial_paint_info_cb) {
                     struct user_info info;
                     enum user_state state = USER_STATE_REAL_REGISTERED_WHITE;
-                    if (strstr(result_name, "black_list"))
+                    if (meta.flags & FACE_META_BLACK_LIST)
                         state = USER_STATE_REAL_REGISTERED_BLACK;
                     rockface_set_user_info(&info, state, &g_ir_face, &g_feature.face);
                     info.has_mask = has_mask;
-                    strncpy(info.sPicturePath, result_name, sizeof(info.sPicturePath) - 1);
+                    strncpy(info.sPicturePath, meta.name, sizeof(info.sPicturePath) - 1);
                     db_monitor_get_user_info(&info, id);
                     strncpy(info.snap_path, g_snap.name, sizeof(info.snap_path) - 1);
                     rkfacial_paint_info_cb(&info, true);
@@ -1313,7 +2059,7 @@ static void *rockface_control_feature_thread(void *arg)
             }
             if (rkfacial_paint_face_cb) {
                 int x, y, w, h;
-                face_convert(g_feature.face, &x, &y, &w, &h, g_feature.img.width, g_feature.img.height);
+                face_convert(face, &x, &y, &w, &h, g_feature.img.width, g_feature.img.height);
                 if (w && h)
                     rkfacial_paint_face_cb(g_feature.bo.ptr, RK_FORMAT_RGB_888, g_feature.img.width, g_feature.img.height,
                                            x, y, w, h);
@@ -1329,6 +2075,31 @@ static void *rockface_control_feature_thread(void *arg)
     pthread_exit(NULL);
 }
 
+static int rockface_control_init_detector(rockface_handle_t *handle)
+{
+    rockface_ret_t ret;
+
+    *handle = g_backend->create_handle();
+
+    ret = g_backend->set_licence(*handle, LICENCE_PATH);
+    if (ret != ROCKFACE_RET_SUCCESS) {
+        printf("%s: authorization error %d!\n", __func__, ret);
+        return -1;
+    }
+    ret = g_backend->set_data_path(*handle, FACE_DATA_PATH);
+    if (ret != ROCKFACE_RET_SUCCESS) {
+        printf("%s: set data path error %d!\n", __func__, ret);
+        return -1;
+    }
+    ret = g_backend->init_detector(*handle, 5);
+    if (ret != ROCKFACE_RET_SUCCESS) {
+        printf("%s: init detector error %d!\n", __func__, ret);
+        return -1;
+    }
+
+    return 0;
+}
+
 int rockface_control_init(void)
 {
     int width = g_face_width;
@@ -1339,7 +2110,9 @@ int rockface_control_init(void)
     if (!g_face_en)
         return 0;
 
-    face_handle = rockface_create_handle();
+    g_backend = face_backend_get();
+    printf("%s: %s backend\n", __func__, g_backend->name);
+    face_handle = g_backend->create_handle();
 
     if (access(LICENCE_PATH, F_OK)) {
         check_pre_path(BAK_PATH);
@@ -1349,55 +2122,55 @@ int rockface_control_init(void)
         }
     }
 
-    ret = rockface_set_licence(face_handle, LICENCE_PATH);
+    ret = g_backend->set_licence(face_handle, LICENCE_PATH);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: authorization error %d!\n", __func__, ret);
         play_wav_signal(AUTHORIZE_FAIL_WAV);
     }
-    ret = rockface_set_data_path(face_handle, FACE_DATA_PATH);
+    ret = g_backend->set_data_path(face_handle, FACE_DATA_PATH);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: set data path error %d!\n", __func__, ret);
         return -1;
     }
 
-    ret = rockface_init_recognizer(face_handle);
+    ret = g_backend->init_recognizer(face_handle);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: init recognizer error %d!\n", __func__, ret);
         return -1;
     }
 
-    ret = rockface_init_detector2(face_handle, 5);
+    ret = g_backend->init_detector(face_handle, 5);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: init detector error %d!\n", __func__, ret);
         return -1;
     }
 
-    ret = rockface_init_landmark(face_handle, 5);
+    ret = g_backend->init_landmark(face_handle, 5);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: init landmark error %d!\n", __func__, ret);
         return -1;
     }
 
-    ret = rockface_init_landmark(face_handle, 106);
+    ret = g_backend->init_landmark(face_handle, 106);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: init landmark106 error %d!\n", __func__, ret);
         return -1;
     }
 
-    ret = rockface_init_liveness_detector(face_handle);
+    ret = g_backend->init_liveness_detector(face_handle);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: init liveness detector error %d!\n", __func__, ret);
         return -1;
     }
 
 #ifdef FACE_MASK
-    ret = rockface_init_mask_recognizer(face_handle);
+    ret = g_backend->init_mask_recognizer(face_handle);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: init mask recognizer error %d!\n", __func__, ret);
         return -1;
     }
 
-    ret = rockface_init_mask_classifier(face_handle);
+    ret = g_backend->init_mask_classifier(face_handle);
     if (ret != ROCKFACE_RET_SUCCESS) {
         printf("%s: init mask classifier error %d!\n", __func__, ret);
         return -1;
@@ -1406,18 +2179,6 @@ int rockface_control_init(void)
 
     if (g_face_cnt <= 0)
         g_face_cnt = DEFAULT_FACE_NUMBER;
-    g_face_data = calloc(g_face_cnt, sizeof(struct face_data));
-    if (!g_face_data) {
-        printf("face data alloc failed!\n");
-        return -1;
-    }
-#ifdef FACE_MASK
-    g_mask_data = calloc(g_face_cnt, sizeof(struct mask_data));
-    if (!g_mask_data) {
-        printf("face data alloc failed!\n");
-        return -1;
-    }
-#endif
 
     if (access(DATABASE_PATH, F_OK)) {
         check_pre_path(BAK_PATH);
@@ -1426,25 +2187,53 @@ int rockface_control_init(void)
             system(cmd);
         }
     }
-    if (access(DATABASE_PATH, F_OK) == 0) {
-        printf("load face feature from %s\n", DATABASE_PATH);
-        if (database_init())
+    if (access(DATABASE_PATH, F_OK) == 0 &&
+            !face_gallery_map(&g_gallery, GALLERY_PATH, DATABASE_PATH, g_face_cnt)) {
+        printf("load face feature from %s\n", GALLERY_PATH);
+        g_face_data = g_gallery.face;
+        g_face_index = g_gallery.face_num;
+#ifdef FACE_MASK
+        g_mask_data = g_gallery.mask;
+        g_mask_index = g_gallery.mask_num;
+#endif
+    } else {
+        g_face_data = calloc(g_face_cnt, sizeof(struct face_data));
+        if (!g_face_data) {
+            printf("face data alloc failed!\n");
+            return -1;
+        }
+#ifdef FACE_MASK
+        g_mask_data = calloc(g_face_cnt, sizeof(struct mask_data));
+        if (!g_mask_data) {
+            printf("face data alloc failed!\n");
             return -1;
-        g_face_index += database_get_data(g_face_data, g_face_cnt, sizeof(rockface_feature_t), 0,
-                                          sizeof(int), sizeof(rockface_feature_t), 0);
+        }
+#endif
+        if (access(DATABASE_PATH, F_OK) == 0) {
+            printf("load face feature from %s\n", DATABASE_PATH);
+            if (database_init())
+                return -1;
+            g_face_index += database_get_data(g_face_data, g_face_cnt, sizeof(rockface_feature_t), 0,
+                                              sizeof(int), sizeof(rockface_feature_t), 0);
 #ifdef FACE_MASK
-        g_mask_index += database_get_data(g_mask_data, g_face_cnt, sizeof(rockface_feature_float_t), 0,
-                                          sizeof(int), sizeof(rockface_feature_float_t), 1);
+            g_mask_index += database_get_data(g_mask_data, g_face_cnt, sizeof(rockface_feature_float_t), 0,
+                                              sizeof(int), sizeof(rockface_feature_float_t), 1);
 #endif
-        database_exit();
+            database_exit();
+        }
+        g_gallery_gen++;
     }
 
     if (database_init())
         return -1;
 #ifndef USE_WEB_SERVER
     printf("load face feature from %s\n", DEFAULT_FACE_PATH);
-    g_face_index += load_feature(DEFAULT_FACE_PATH, ".jpg",
-                        (struct face_data*)g_face_data + g_face_index, g_face_cnt - g_face_index);
+    int num = load_feature(DEFAULT_FACE_PATH, ".jpg",
+                           (struct face_data*)g_face_data + g_face_index, g_face_cnt - g_face_index);
+    if (num > 0) {
+        g_face_index += num;
+        g_gallery_gen++;
+    }
 #endif
     printf("face number is %d\n", g_face_index);
     sync();
@@ -1454,13 +2243,22 @@ int rockface_control_init(void)
     if (rockface_control_init_library(g_mask_data, g_mask_index, sizeof(struct mask_data), 0, 1))
         return -1;
 #endif
+    rockface_control_index_library();
+    pthread_mutex_lock(&g_lib_lock);
+    rockface_control_save_gallery();
+    pthread_mutex_unlock(&g_lib_lock);
 
-    for (int i = 0; i < DET_BUFFER_NUM; i++) {
+    g_detect = (struct face_buf *)calloc(g_det_num, sizeof(struct face_buf));
+    if (!g_detect) {
+        printf("detect buffer alloc failed!\n");
+        return -1;
+    }
+    if (frame_ring_init(&g_det_free, g_det_num) || frame_ring_init(&g_det_ready, g_det_num))
+        return -1;
+    for (int i = 0; i < g_det_num; i++) {
         if (rga_control_buffer_init(&g_detect[i].bo, &g_detect[i].fd, DET_WIDTH, DET_HEIGHT, 24))
             return -1;
-        pthread_mutex_lock(&g_det_lock);
-        g_det_free.push_back(&g_detect[i]);
-        pthread_mutex_unlock(&g_det_lock);
+        frame_ring_push(&g_det_free, &g_detect[i]);
     }
 
     if (rga_control_buffer_init(&g_feature.bo, &g_feature.fd, width, height, 24))
@@ -1483,7 +2281,34 @@ int rockface_control_init(void)
     if (rga_control_buffer_init(&g_ir_det_bo, &g_ir_det_fd, DET_WIDTH, DET_HEIGHT, 24))
         return -1;
 
+    if (g_det_worker_num > g_det_num)
+        g_det_worker_num = g_det_num;
+    if (g_det_worker_num > 1) {
+        g_det_reorder = (struct face_buf **)calloc(g_det_num, sizeof(struct face_buf *));
+        g_det_worker = (struct det_worker *)calloc(g_det_worker_num, sizeof(struct det_worker));
+        if (!g_det_reorder || !g_det_worker) {
+            printf("detect worker alloc failed!\n");
+            return -1;
+        }
+        for (int i = 0; i < g_det_worker_num; i++) {
+            if (rockface_control_init_detector(&g_det_worker[i].handle))
+                return -1;
+        }
+    }
+
+    if (snapshot_init()) {
+        printf("%s: snapshot init error!\n", __func__);
+        return -1;
+    }
+
     g_run = true;
+    for (int i = 0; g_det_worker_num > 1 && i < g_det_worker_num; i++) {
+        if (pthread_create(&g_det_worker[i].tid, NULL, rockface_control_det_worker_thread, &g_det_worker[i])) {
+            printf("%s: pthread_create error!\n", __func__);
+            g_run = false;
+            return -1;
+        }
+    }
     if (pthread_create(&g_detect_tid, NULL, rockface_control_detect_thread, NULL)) {
         printf("%s: pthread_create error!\n", __func__);
         g_run = false;
@@ -1494,6 +2319,11 @@ int rockface_control_init(void)
         g_run = false;
         return -1;
     }
+    if (pthread_create(&g_compact_tid, NULL, rockface_control_compact_thread, NULL)) {
+        printf("%s: pthread_create error!\n", __func__);
+        g_run = false;
+        return -1;
+    }
 
     return 0;
 }
@@ -1504,43 +2334,88 @@ void rockface_control_exit(void)
         return;
 
     g_run = false;
-    rockface_control_detect_signal();
+    rockface_control_detect_broadcast();
     if (g_detect_tid) {
         pthread_join(g_detect_tid, NULL);
         g_detect_tid = 0;
     }
+    if (g_det_worker) {
+        for (int i = 0; i < g_det_worker_num; i++) {
+            if (g_det_worker[i].tid)
+                pthread_join(g_det_worker[i].tid, NULL);
+            if (g_det_worker[i].handle)
+                g_backend->release_handle(g_det_worker[i].handle);
+        }
+        free(g_det_worker);
+        g_det_worker = NULL;
+    }
+    if (g_det_reorder) {
+        free(g_det_reorder);
+        g_det_reorder = NULL;
+    }
     rockface_control_signal();
     if (g_tid) {
         pthread_join(g_tid, NULL);
         g_tid = 0;
     }
+    snapshot_exit();
+    pthread_mutex_lock(&g_lib_lock);
+    pthread_cond_signal(&g_compact_cond);
+    pthread_mutex_unlock(&g_lib_lock);
+    if (g_compact_tid) {
+        pthread_join(g_compact_tid, NULL);
+        g_compact_tid = 0;
+    }
+    pthread_mutex_lock(&g_lib_lock);
+    rockface_control_compact_library();
+    rockface_control_save_gallery();
+    rockface_control_save_index();
+    pthread_mutex_unlock(&g_lib_lock);
 
     rockface_control_release_library();
-    rockface_release_handle(face_handle);
+    g_backend->release_handle(face_handle);
 
     database_exit();
 
-    if (g_face_data) {
+    if (g_gallery.addr) {
+        face_gallery_unmap(&g_gallery);
+    } else {
         free(g_face_data);
-        g_face_data = NULL;
-    }
 #ifdef FACE_MASK
-    if (g_mask_data) {
         free(g_mask_data);
-        g_mask_data = NULL;
+#endif
     }
+    g_face_data = NULL;
+    g_face_index = 0;
+#ifdef FACE_MASK
+    g_mask_data = NULL;
+    g_mask_index = 0;
 #endif
 
-    for (int i = 0; i < DET_BUFFER_NUM; i++) {
-        rga_control_buffer_deinit(&g_detect[i].bo, g_detect[i].fd);
+    if (g_detect) {
+        for (int i = 0; i < g_det_num; i++)
+            rga_control_buffer_deinit(&g_detect[i].bo, g_detect[i].fd);
+        free(g_detect);
+        g_detect = NULL;
     }
+    frame_ring_deinit(&g_det_free);
+    frame_ring_deinit(&g_det_ready);
     rga_control_buffer_deinit(&g_feature.bo, g_feature.fd);
 #ifdef IR_TEST_DATA
     rga_control_buffer_deinit(&g_test_bo, g_test_fd);
 #endif
     rga_control_buffer_deinit(&g_ir_bo, g_ir_fd);
     rga_control_buffer_deinit(&g_ir_det_bo, g_ir_det_fd);
-    snapshot_exit(&g_snap);
+    codec_pool_exit();
+
+    pthread_mutex_lock(&g_identity_lock);
+    if (g_identity_fd >= 0) {
+        close(g_identity_fd);
+        g_identity_fd = -1;
+        g_identity_wd = -1;
+    }
+    g_identity.valid = false;
+    pthread_mutex_unlock(&g_identity_lock);
 }
 
 void rockface_control_database(void)
@@ -1561,13 +2436,19 @@ void rockface_control_database(void)
     rockface_control_init_library(g_mask_data, g_mask_index,
             sizeof(struct mask_data), 0, 1);
 #endif
+    g_lib_dirty = false;
+    g_gallery_stale = false;
+    g_gallery_gen++;
     pthread_mutex_unlock(&g_lib_lock);
+    rockface_control_index_library();
 }
 
 void rockface_control_delete_all(void)
 {
+    rockface_control_db_begin();
     database_reset();
     rockface_control_database();
+    rockface_control_db_end(true);
 }
 
 int rockface_control_delete(int id, const char *pname, bool notify, bool del)
@@ -1581,13 +2462,15 @@ int rockface_control_delete(int id, const char *pname, bool notify, bool del)
     }
 
     printf("delete %d from %s\n", id, DATABASE_PATH);
+    rockface_control_db_begin();
     database_delete(id, true);
     if (del && strlen(name))
         unlink(name);
     if (notify)
         db_monitor_face_list_delete(id);
 
-    rockface_control_database();
+    rockface_control_delete_library(id);
+    rockface_control_db_end(true);
 
     return 0;
 }
@@ -1597,48 +2480,57 @@ int rockface_control_add_ui(int id, const char *name, void *feature, void *mask_
     printf("add %s, %d to %s\n", name, id, DATABASE_PATH);
     char user[] = USER_NAME;
     char type[] = "whiteList";
+    rockface_control_db_begin();
     database_insert(feature, feature ? sizeof(rockface_feature_t) : 0, name, NAME_LEN, id, true,
                     mask_feature, mask_feature ? sizeof(rockface_feature_float_t) : 0);
     db_monitor_face_list_add(id, (char*)name, user, type);
 
-    rockface_control_database();
+    rockface_control_insert_library(id, feature, mask_feature);
+    rockface_control_db_end(true);
 
     return 0;
 }
 
+static void rockface_control_set_reg_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    pthread_mutex_lock(&g_det_time_lock);
+    g_last_reg_tv = tv;
+    pthread_mutex_unlock(&g_det_time_lock);
+}
+
 int rockface_control_add_web(int id, const char *name)
 {
     rockface_control_delete(id, NULL, false, false);
     printf("add %s, %d to %s\n", name, id, DATABASE_PATH);
-    gettimeofday(&g_last_reg_tv, NULL);
+    rockface_control_set_reg_time();
     rockface_feature_t f;
     rockface_feature_float_t m;
     float mask_score;
     if (!rockface_control_get_path_feature(name, &f, &m, &mask_score)) {
+        rockface_control_db_begin();
 #if 1
         database_insert(&f, sizeof(rockface_feature_t), name, NAME_LEN, id, g_detect_en ? true : false, &m, sizeof(rockface_feature_float_t));
 #else
         rockface_search_result_t result;
         rockface_ret_t ret;
         char result_name[NAME_LEN];
+        int result_id = -1;
         pthread_mutex_lock(&g_lib_lock);
-        ret = rockface_feature_search(face_handle, mask_score < 0.5 ? &f : (rockface_feature_t *)&m,
-                                      FACE_SIMILARITY_SCORE_REGISTER, &result);
+        ret = rockface_control_feature_search(mask_score < 0.5 ? &f : (rockface_feature_t *)&m,
+                                              mask_score >= 0.5, FACE_SIMILARITY_SCORE_REGISTER, &result);
+        if (ret == ROCKFACE_RET_SUCCESS)
+            result_id = rockface_control_result_id(&result, mask_score >= 0.5);
         pthread_mutex_unlock(&g_lib_lock);
         if (ret != ROCKFACE_RET_SUCCESS) {
             database_insert(&f, sizeof(rockface_feature_t), name, NAME_LEN, id, g_detect_en ? true : false, &m, sizeof(rockface_feature_float_t));
         } else {
-            int id;
-            if (mask_score < 0.5) {
-                struct face_data *face_data = (struct face_data *)result.face_data;
-                id = face_data->id;
-            } else {
-                struct mask_data *mask_data = (struct mask_data *)result.face_data;
-                id = mask_data->id;
-            }
             memset(result_name, 0, NAME_LEN);
-            database_is_id_exist(id, result_name, NAME_LEN);
+            database_is_id_exist(result_id, result_name, NAME_LEN);
             printf("%s is similar with %s, similarity is %f\n", name, result_name, result.similarity);
+            rockface_control_db_end(true);
             return 2;
         }
 #endif
@@ -1648,7 +2540,8 @@ int rockface_control_add_web(int id, const char *name)
     }
 
     if (g_detect_en)
-        rockface_control_database();
+        rockface_control_insert_library(id, &f, &m);
+    rockface_control_db_end(g_detect_en);
 
     return 0;
 }
@@ -1661,12 +2554,13 @@ int rockface_control_add_local(const char *name)
         return -3;
     }
     printf("add %s, %d to %s\n", name, id, DATABASE_PATH);
-    gettimeofday(&g_last_reg_tv, NULL);
+    rockface_control_set_reg_time();
     rockface_feature_t f;
     rockface_feature_float_t m;
     float mask_score;
     if (!rockface_control_get_path_feature(name, &f, &m, &mask_score)) {
         char type[] = "whiteList";
+        rockface_control_db_begin();
         char tmp[NAME_LEN];
         const char *begin = strrchr(name, '/');
         const char *end = strrchr(name, '.');
@@ -1682,25 +2576,21 @@ int rockface_control_add_local(const char *name)
         rockface_search_result_t result;
         rockface_ret_t ret;
         char result_name[NAME_LEN];
+        int result_id = -1;
         pthread_mutex_lock(&g_lib_lock);
-        ret = rockface_feature_search(face_handle, mask_score < 0.5 ? &f : (rockface_feature_t *)&m,
-                                      FACE_SIMILARITY_SCORE_REGISTER, &result);
+        ret = rockface_control_feature_search(mask_score < 0.5 ? &f : (rockface_feature_t *)&m,
+                                              mask_score >= 0.5, FACE_SIMILARITY_SCORE_REGISTER, &result);
+        if (ret == ROCKFACE_RET_SUCCESS)
+            result_id = rockface_control_result_id(&result, mask_score >= 0.5);
         pthread_mutex_unlock(&g_lib_lock);
         if (ret != ROCKFACE_RET_SUCCESS) {
             database_insert(&f, sizeof(rockface_feature_t), name, NAME_LEN, id, g_detect_en ? true : false, &m, sizeof(rockface_feature_float_t));
             db_monitor_face_list_add(id, (char*)name, tmp, type);
         } else {
-            int id;
-            if (mask_score < 0.5) {
-                struct face_data *face_data = (struct face_data *)result.face_data;
-                id = face_data->id;
-            } else {
-                struct mask_data *mask_data = (struct mask_data *)result.face_data;
-                id = mask_data->id;
-            }
             memset(result_name, 0, NAME_LEN);
-            database_is_id_exist(id, result_name, NAME_LEN);
+            database_is_id_exist(result_id, result_name, NAME_LEN);
             printf("%s is similar with %s, similarity is %f\n", name, result_name, result.similarity);
+            rockface_control_db_end(true);
             return -2;
         }
 #endif
@@ -1710,7 +2600,258 @@ int rockface_control_add_local(const char *name)
     }
 
     if (g_detect_en)
-        rockface_control_database();
+        rockface_control_insert_library(id, &f, &m);
+    rockface_control_db_end(g_detect_en);
 
     return id;
 }
+
+struct enroll_image {
+    struct enroll_item *item;
+    rockface_image_t img;
+    bo_t bo;
+    int fd;
+    int read;
+};
+
+struct enroll_batch {
+    struct enroll_item *item;
+    struct enroll_image *image;
+    int num;
+    int next;
+    int decoding;
+    struct enroll_image *queue[ENROLL_QUEUE_DEPTH];
+    int head;
+    int cnt;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct enroll_commit {
+    struct database_record record[ENROLL_COMMIT_NUM];
+    struct enroll_item *item[ENROLL_COMMIT_NUM];
+    rockface_feature_t feature[ENROLL_COMMIT_NUM];
+    rockface_feature_float_t mask[ENROLL_COMMIT_NUM];
+    int num;
+};
+
+/* decode ahead of the feature extraction, the decoder contexts come from the codec pool */
+static void *rockface_control_enroll_decode_thread(void *arg)
+{
+    struct enroll_batch *batch = (struct enroll_batch *)arg;
+
+    while (1) {
+        struct enroll_image *image;
+
+        pthread_mutex_lock(&batch->lock);
+        image = batch->next < batch->num ? &batch->image[batch->next++] : NULL;
+        pthread_mutex_unlock(&batch->lock);
+        if (!image)
+            break;
+
+        image->read = rockface_control_read_image(image->item->path, &image->img, &image->bo,
+                                                  &image->fd);
+
+        pthread_mutex_lock(&batch->lock);
+        while (batch->cnt == ENROLL_QUEUE_DEPTH)
+            pthread_cond_wait(&batch->cond, &batch->lock);
+        batch->queue[(batch->head + batch->cnt++) % ENROLL_QUEUE_DEPTH] = image;
+        pthread_cond_broadcast(&batch->cond);
+        pthread_mutex_unlock(&batch->lock);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    batch->decoding--;
+    pthread_cond_broadcast(&batch->cond);
+    pthread_mutex_unlock(&batch->lock);
+
+    return NULL;
+}
+
+static struct enroll_image *rockface_control_enroll_pop(struct enroll_batch *batch)
+{
+    struct enroll_image *image = NULL;
+    bool decode = false;
+
+    pthread_mutex_lock(&batch->lock);
+    while (!batch->cnt && batch->decoding)
+        pthread_cond_wait(&batch->cond, &batch->lock);
+    if (batch->cnt) {
+        image = batch->queue[batch->head];
+        batch->head = (batch->head + 1) % ENROLL_QUEUE_DEPTH;
+        batch->cnt--;
+        pthread_cond_broadcast(&batch->cond);
+    } else if (batch->next < batch->num) {
+        /* no decode thread could be started, decode in the caller */
+        image = &batch->image[batch->next++];
+        decode = true;
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (decode)
+        image->read = rockface_control_read_image(image->item->path, &image->img, &image->bo,
+                                                  &image->fd);
+
+    return image;
+}
+
+static void rockface_control_enroll_report(struct enroll_item *item, int *done, int total,
+                                           enroll_progress_callback cb)
+{
+    ++*done;
+    if (item->ret)
+        printf("%s: %s fail %d\n", __func__, item->path, item->ret);
+    if (cb)
+        cb(item, *done, total);
+}
+
+/* one transaction for the whole chunk, each user is then appended to the library */
+static int rockface_control_enroll_commit(struct enroll_commit *commit, bool notify, int *done, int total,
+                                          enroll_progress_callback cb)
+{
+    int ret;
+    int cnt = 0;
+
+    rockface_control_db_begin();
+    ret = database_insert_batch(commit->record, commit->num, g_detect_en ? true : false);
+    for (int i = 0; i < commit->num; i++) {
+        struct enroll_item *item = commit->item[i];
+
+        item->ret = ret ? -3 : 0;
+        if (!ret) {
+            cnt++;
+            rockface_control_set_reg_time();
+            if (g_detect_en)
+                rockface_control_insert_library(item->id, &commit->feature[i], &commit->mask[i]);
+            if (notify) {
+                char type[] = "whiteList";
+                char user[NAME_LEN];
+                const char *begin = strrchr(item->path, '/');
+                const char *end = strrchr(item->path, '.');
+                memset(user, 0, sizeof(user));
+                if (begin && end && end > begin)
+                    memcpy(user, begin + 1, end - begin - 1);
+                else
+                    strcpy(user, "unknown_user");
+                db_monitor_face_list_add(item->id, (char*)item->path, user, type);
+            }
+        }
+        rockface_control_enroll_report(item, done, total, cb);
+    }
+    rockface_control_db_end(ret || g_detect_en);
+    commit->num = 0;
+
+    return cnt;
+}
+
+/*
+ * Enroll many images at once: ENROLL_DECODE_NUM workers decode ahead while
+ * this thread detects and extracts on face_handle, as add_web does, the
+ * features go to the database ENROLL_COMMIT_NUM at a time and each user is
+ * appended to the library as its chunk commits. Returns the number of
+ * enrolled items.
+ */
+int rockface_control_add_batch(struct enroll_item *item, int num, bool notify, enroll_progress_callback cb)
+{
+    struct enroll_batch batch;
+    struct enroll_commit *commit = NULL;
+    pthread_t tid[ENROLL_DECODE_NUM];
+    int workers = 0;
+    int next_id;
+    int done = 0;
+    int cnt = 0;
+
+    if (!g_backend || num <= 0)
+        return 0;
+
+    for (int i = 0; i < num; i++)
+        item[i].ret = -1;
+    memset(&batch, 0, sizeof(batch));
+    batch.item = item;
+    batch.num = num;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.cond, NULL);
+    batch.image = (struct enroll_image *)calloc(num, sizeof(struct enroll_image));
+    commit = (struct enroll_commit *)calloc(1, sizeof(struct enroll_commit));
+    if (!batch.image || !commit) {
+        printf("%s: alloc fail!\n", __func__);
+        goto exit;
+    }
+
+    /* new ids follow the largest one in the database and in the batch */
+    next_id = database_get_user_name_id();
+    if (next_id < 0) {
+        printf("%s: get id fail!\n", __func__);
+        goto exit;
+    }
+    for (int i = 0; i < num; i++) {
+        if (item[i].id >= next_id)
+            next_id = item[i].id + 1;
+        batch.image[i].item = &item[i];
+        batch.image[i].fd = -1;
+    }
+
+    batch.decoding = ENROLL_DECODE_NUM;
+    for (int i = 0; i < ENROLL_DECODE_NUM; i++) {
+        if (pthread_create(&tid[i], NULL, rockface_control_enroll_decode_thread, &batch)) {
+            printf("%s: pthread_create error!\n", __func__);
+            pthread_mutex_lock(&batch.lock);
+            batch.decoding -= ENROLL_DECODE_NUM - i;
+            pthread_mutex_unlock(&batch.lock);
+            break;
+        }
+        workers++;
+    }
+
+    while (1) {
+        struct enroll_image *image = rockface_control_enroll_pop(&batch);
+        struct enroll_item *cur;
+        rockface_det_t face;
+        float mask_score;
+        int n = commit->num;
+
+        if (!image)
+            break;
+        cur = image->item;
+        if (image->read < 0) {
+            cur->ret = -1;
+            rockface_control_enroll_report(cur, &done, num, cb);
+            continue;
+        }
+        if (_rockface_control_detect(face_handle, &image->img, &face, NULL) ||
+                rockface_control_get_feature(face_handle, &image->img, &commit->feature[n], &commit->mask[n],
+                                             &face, true, &mask_score)) {
+            rockface_control_release_image(image->read, &image->img, &image->bo, &image->fd);
+            cur->ret = -2;
+            rockface_control_enroll_report(cur, &done, num, cb);
+            continue;
+        }
+        rockface_control_release_image(image->read, &image->img, &image->bo, &image->fd);
+
+        if (cur->id < 0)
+            cur->id = next_id++;
+        commit->item[n] = cur;
+        commit->record[n].data = &commit->feature[n];
+        commit->record[n].size = sizeof(rockface_feature_t);
+        commit->record[n].name = cur->path;
+        commit->record[n].id = cur->id;
+        commit->record[n].mask = &commit->mask[n];
+        commit->record[n].mask_size = sizeof(rockface_feature_float_t);
+        if (++commit->num == ENROLL_COMMIT_NUM)
+            cnt += rockface_control_enroll_commit(commit, notify, &done, num, cb);
+    }
+    if (commit->num)
+        cnt += rockface_control_enroll_commit(commit, notify, &done, num, cb);
+
+exit:
+    for (int i = 0; i < workers; i++)
+        pthread_join(tid[i], NULL);
+    free(commit);
+    free(batch.image);
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.cond);
+
+    printf("%s: %d of %d enrolled\n", __func__, cnt, num);
+
+    return cnt;
+}
@@ -45,16 +45,27 @@ int rockface_control_init(void);
 void rockface_control_init_thread(void);
 void rockface_control_exit(void);
 int rockface_control_get_path_feature(const char *path, void *feature, void *mask_feature, float *mask_score);
-int rockface_control_convert_detect(void *ptr, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id);
-int rockface_control_convert_feature(void *ptr, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id);
+int rockface_control_convert_detect(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id);
+int rockface_control_convert_feature(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id);
 void rockface_control_set_delete(void);
 void rockface_control_set_register(void);
-int rockface_control_convert_ir(void *ptr, int width, int height, RgaSURF_FORMAT fmt, int rotation);
+int rockface_control_convert(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation, int id);
+int rockface_control_convert_ir(void *ptr, int fd, int width, int height, RgaSURF_FORMAT fmt, int rotation);
 void rockface_control_delete_all(void);
 int rockface_control_delete(int id, const char *pname, bool notify, bool del);
 int rockface_control_add_ui(int id, const char *name, void *feature, void *mask_feature);
 int rockface_control_add_web(int id, const char *name);
 int rockface_control_add_local(const char *name);
+
+struct enroll_item {
+    const char *path;
+    int id;     /* < 0 to take a new one, the id used on return */
+    int ret;    /* 0 enrolled, -1 unreadable, -2 no usable face, -3 database error */
+};
+
+typedef void (*enroll_progress_callback)(const struct enroll_item *item, int done, int total);
+
+int rockface_control_add_batch(struct enroll_item *item, int num, bool notify, enroll_progress_callback cb);
 void rockface_control_database(void);
 void rockface_control_set_detect_en(int en);
 void rockface_control_set_identity_en(int en, char *path);
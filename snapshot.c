@@ -30,31 +30,220 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
-#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <sys/time.h>
 
+#include "rkfacial.h"
+#include "snapshot.h"
+#include "face_stat.h"
+#include "codec_pool.h"
+#include "frame_ring.h"
+
 #define SNAP_ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
 
-int snapshot_init(struct snapshot *s, int w, int h)
+/* a cropped NV12 picture waiting for the writer thread */
+struct snapshot_job {
+    bo_t nv12_bo;
+    int nv12_fd;
+    int size;
+    int w;
+    int h;
+    char name[NAME_LEN];
+    snapshot_callback cb;
+    char arg[SNAPSHOT_ARG_SIZE];
+};
+
+static int g_snap_depth = SNAPSHOT_QUEUE_DEPTH;
+static struct snapshot_job *g_snap_job;
+static struct frame_ring g_snap_free;
+static struct frame_ring g_snap_ready;
+static pthread_t g_snap_tid;
+static pthread_mutex_t g_snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_snap_cond = PTHREAD_COND_INITIALIZER;
+/* a job went back to g_snap_free, for snapshot_save */
+static pthread_cond_t g_snap_free_cond = PTHREAD_COND_INITIALIZER;
+/* g_enc_bo is shared by the writer thread and snapshot_save */
+static pthread_mutex_t g_snap_write_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool g_snap_run;
+static bo_t g_enc_bo;
+static int g_enc_fd = -1;
+static int g_enc_size;
+
+static int g_snap_max_queued;
+static unsigned int g_snap_written;
+static unsigned int g_snap_dropped;
+static unsigned int g_snap_failed;
+
+void set_snapshot_queue(int depth)
 {
-    if (s->size)
+    g_snap_depth = depth > 0 ? depth : SNAPSHOT_QUEUE_DEPTH;
+}
+
+void get_snapshot_queue_stat(struct snapshot_queue_stat *stat)
+{
+    memset(stat, 0, sizeof(struct snapshot_queue_stat));
+    stat->depth = g_snap_depth;
+    if (g_snap_job)
+        stat->queued = frame_ring_count(&g_snap_ready);
+    stat->max_queued = __atomic_load_n(&g_snap_max_queued, __ATOMIC_RELAXED);
+    stat->written = __atomic_load_n(&g_snap_written, __ATOMIC_RELAXED);
+    stat->dropped = __atomic_load_n(&g_snap_dropped, __ATOMIC_RELAXED);
+    stat->failed = __atomic_load_n(&g_snap_failed, __ATOMIC_RELAXED);
+}
+
+static int snapshot_buffer(bo_t *bo, int *fd, int *size, int w, int h)
+{
+    if (*size >= w * h * 3 / 2)
         return 0;
+    if (*size)
+        rga_control_buffer_deinit(bo, *fd);
+    *size = 0;
+    if (rga_control_buffer_init_nocache(bo, fd, w, h, 12))
+        return -1;
+    *size = w * h * 3 / 2;
+    return 0;
+}
+
+static void snapshot_job_free(struct snapshot_job *job)
+{
+    frame_ring_push(&g_snap_free, job);
+    pthread_mutex_lock(&g_snap_lock);
+    pthread_cond_broadcast(&g_snap_free_cond);
+    pthread_mutex_unlock(&g_snap_lock);
+}
+
+/* g_snap_write_lock held */
+static int snapshot_write(struct snapshot_job *job)
+{
+    FILE *fp;
+    struct codec_ctx *enc;
+    struct face_stat_timer timer;
+    int ret;
 
-    if (rga_control_buffer_init_nocache(&s->nv12_bo, &s->nv12_fd, w, h, 12))
+    if (snapshot_buffer(&g_enc_bo, &g_enc_fd, &g_enc_size, job->w, job->h))
         return -1;
-    if (rga_control_buffer_init_nocache(&s->enc_bo, &s->enc_fd, w, h, 12))
+    enc = codec_pool_get(CODEC_JPEG_ENC, job->w, job->h, MPP_FMT_YUV420SP, 7);
+    if (!enc)
         return -1;
-    s->size = w * h * 3 / 2;
 
+    face_stat_begin(&timer);
+    ret = codec_jpeg_encode(enc, job->nv12_bo.ptr, job->nv12_fd, job->w * job->h * 3 / 2,
+            g_enc_bo.ptr, g_enc_fd, g_enc_size);
+    face_stat_end(&timer, FACE_STAGE_SNAPSHOT_ENCODE);
+    if (ret || !enc->out_len) {
+        printf("%s: encode fail\n", __func__);
+        codec_pool_put(enc, false);
+        return -1;
+    }
+
+    fp = fopen(job->name, "wb");
+    if (fp) {
+        fwrite(enc->out, 1, enc->out_len, fp);
+        fclose(fp);
+        printf("%s: save %s ok!\n", __func__, job->name);
+    } else {
+        printf("%s: open %s fail!\n", __func__, job->name);
+        ret = -1;
+    }
+
+    codec_pool_put(enc, true);
+    return ret;
+}
+
+/* encode and write off the recognition threads, the queue drains before exit */
+static void *snapshot_thread(void *arg)
+{
+    struct snapshot_job *job;
+    int ret;
+
+    while (1) {
+        pthread_mutex_lock(&g_snap_lock);
+        while (g_snap_run && !frame_ring_count(&g_snap_ready))
+            pthread_cond_wait(&g_snap_cond, &g_snap_lock);
+        pthread_mutex_unlock(&g_snap_lock);
+
+        job = (struct snapshot_job *)frame_ring_pop(&g_snap_ready);
+        if (!job) {
+            if (!g_snap_run)
+                break;
+            continue;
+        }
+
+        pthread_mutex_lock(&g_snap_write_lock);
+        ret = snapshot_write(job);
+        pthread_mutex_unlock(&g_snap_write_lock);
+        if (ret) {
+            __atomic_add_fetch(&g_snap_failed, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&g_snap_written, 1, __ATOMIC_RELAXED);
+            if (job->cb)
+                job->cb(job->name, job->arg);
+        }
+        snapshot_job_free(job);
+    }
+
+    pthread_exit(NULL);
+}
+
+int snapshot_init(void)
+{
+    if (g_snap_job)
+        return 0;
+
+    g_snap_job = (struct snapshot_job *)calloc(g_snap_depth, sizeof(struct snapshot_job));
+    if (!g_snap_job)
+        return -1;
+    if (frame_ring_init(&g_snap_free, g_snap_depth) || frame_ring_init(&g_snap_ready, g_snap_depth))
+        goto err;
+    for (int i = 0; i < g_snap_depth; i++)
+        frame_ring_push(&g_snap_free, &g_snap_job[i]);
+
+    g_snap_run = true;
+    if (pthread_create(&g_snap_tid, NULL, snapshot_thread, NULL)) {
+        printf("%s: create thread fail!\n", __func__);
+        g_snap_run = false;
+        g_snap_tid = 0;
+        goto err;
+    }
     return 0;
+
+err:
+    frame_ring_deinit(&g_snap_free);
+    frame_ring_deinit(&g_snap_ready);
+    free(g_snap_job);
+    g_snap_job = NULL;
+    return -1;
 }
 
-void snapshot_exit(struct snapshot *s)
+void snapshot_exit(void)
 {
-    if (s->size) {
-        rga_control_buffer_deinit(&s->nv12_bo, s->nv12_fd);
-        rga_control_buffer_deinit(&s->enc_bo, s->enc_fd);
+    if (!g_snap_job)
+        return;
+
+    pthread_mutex_lock(&g_snap_lock);
+    g_snap_run = false;
+    pthread_cond_signal(&g_snap_cond);
+    pthread_cond_broadcast(&g_snap_free_cond);
+    pthread_mutex_unlock(&g_snap_lock);
+    if (g_snap_tid) {
+        pthread_join(g_snap_tid, NULL);
+        g_snap_tid = 0;
     }
+
+    for (int i = 0; i < g_snap_depth; i++) {
+        if (g_snap_job[i].size)
+            rga_control_buffer_deinit(&g_snap_job[i].nv12_bo, g_snap_job[i].nv12_fd);
+    }
+    if (g_enc_size)
+        rga_control_buffer_deinit(&g_enc_bo, g_enc_fd);
+    g_enc_size = 0;
+    frame_ring_deinit(&g_snap_free);
+    frame_ring_deinit(&g_snap_ready);
+    free(g_snap_job);
+    g_snap_job = NULL;
 }
 
 void face_convert(rockface_det_t face, int *x, int *y, int *w, int *h, int width, int height)
@@ -106,26 +295,24 @@ void face_convert(rockface_det_t face, int *x, int *y, int *w, int *h, int width
         *y = 0;
 }
 
-int snapshot_run(struct snapshot *s, rockface_image_t *image, rockface_det_t *face,
-                 RgaSURF_FORMAT fmt, long int sec, char mark)
+/* crop into a free job, waiting for one when wait is set; s->name is cleared on failure */
+static struct snapshot_job *snapshot_crop(struct snapshot *s, rockface_image_t *image, int image_fd,
+                                          rockface_det_t *face, RgaSURF_FORMAT fmt, long int sec,
+                                          char mark, bool wait)
 {
-    FILE *fp;
     rga_info_t src, dst;
+    struct snapshot_job *job;
     int w, h;
     int x, y;
+    int ret;
+    struct face_stat_timer timer;
 
     void *buffer = image->data;
     int width = image->width;
     int height = image->height;
 
-    if (!strlen(g_snapshot))
-        return -1;
-
-    if (snapshot_init(s, width, height))
-        return -1;
-
-    if (width * height * 3 / 2 > s->size)
-        return -1;
+    if (!strlen(g_snapshot) || !g_snap_job)
+        return NULL;
 
     if (sec) {
         if (!s->t0.tv_sec && !s->t0.tv_usec) {
@@ -133,7 +320,7 @@ int snapshot_run(struct snapshot *s, rockface_image_t *image, rockface_det_t *fa
         } else {
             gettimeofday(&s->t1, NULL);
             if (s->t1.tv_sec - s->t0.tv_sec < sec)
-                return -1;
+                return NULL;
             else
                 gettimeofday(&s->t0, NULL);
         }
@@ -152,8 +339,10 @@ int snapshot_run(struct snapshot *s, rockface_image_t *image, rockface_det_t *fa
 
     if (face) {
         face_convert(*face, &x, &y, &w, &h, width, height);
-        if (!w || !h)
-            return -1;
+        if (!w || !h) {
+            memset(s->name, 0, sizeof(s->name));
+            return NULL;
+        }
     } else {
         w = width;
         h = height;
@@ -161,36 +350,100 @@ int snapshot_run(struct snapshot *s, rockface_image_t *image, rockface_det_t *fa
         y = 0;
     }
 
-    if (vpu_encode_jpeg_init(&s->enc, w, h, 7, MPP_FMT_YUV420SP))
-        return -1;
+    job = (struct snapshot_job *)frame_ring_pop(&g_snap_free);
+    while (!job && wait) {
+        pthread_mutex_lock(&g_snap_lock);
+        while (g_snap_run && !frame_ring_count(&g_snap_free))
+            pthread_cond_wait(&g_snap_free_cond, &g_snap_lock);
+        pthread_mutex_unlock(&g_snap_lock);
+        if (!g_snap_run)
+            break;
+        job = (struct snapshot_job *)frame_ring_pop(&g_snap_free);
+    }
+    if (!job) {
+        __atomic_add_fetch(&g_snap_dropped, 1, __ATOMIC_RELAXED);
+        memset(s->name, 0, sizeof(s->name));
+        return NULL;
+    }
+    /* sized for the whole image so any crop of it fits */
+    if (snapshot_buffer(&job->nv12_bo, &job->nv12_fd, &job->size, width, height))
+        goto err;
 
     memset(&src, 0, sizeof(rga_info_t));
-    src.fd = -1;
-    src.virAddr = buffer;
-    src.mmuFlag = 1;
+    rga_control_set_buf(&src, buffer, image_fd);
     rga_set_rect(&src.rect, x, y, w, h, width, height, fmt);
     memset(&dst, 0, sizeof(rga_info_t));
-    dst.fd = -1;
-    dst.virAddr = s->nv12_bo.ptr;
-    dst.mmuFlag = 1;
+    rga_control_set_buf(&dst, job->nv12_bo.ptr, job->nv12_fd);
     rga_set_rect(&dst.rect, 0, 0, w, h, w, h, RK_FORMAT_YCbCr_420_SP);
-    if (c_RkRgaBlit(&src, &dst, NULL)) {
+    face_stat_begin(&timer);
+    ret = rga_control_blit(&src, &dst);
+    face_stat_end(&timer, FACE_STAGE_RGA_SNAPSHOT);
+    if (ret) {
         printf("%s: rga fail\n", __func__);
-        return -1;
+        goto err;
     }
 
-    vpu_encode_jpeg_doing(&s->enc, s->nv12_bo.ptr, s->nv12_fd, w * h * 3 / 2,
-            s->enc_bo.ptr, s->enc_fd, s->size);
+    job->w = w;
+    job->h = h;
+    memcpy(job->name, s->name, sizeof(job->name));
+    return job;
 
-    fp = fopen(s->name, "wb");
-    if (fp) {
-        fwrite(s->enc.enc_out_data, 1, s->enc.enc_out_length, fp);
-        fclose(fp);
-        printf("%s: save %s ok!\n", __func__, s->name);
-    } else {
-        printf("%s: open %s fail!\n", __func__, s->name);
-    }
+err:
+    snapshot_job_free(job);
+    __atomic_add_fetch(&g_snap_failed, 1, __ATOMIC_RELAXED);
+    memset(s->name, 0, sizeof(s->name));
+    return NULL;
+}
+
+/*
+ * Crop into a queued buffer and return, the writer thread encodes, saves
+ * and calls cb. When every buffer is queued the snapshot is dropped and
+ * s->name is cleared, otherwise the file may not exist yet on return.
+ */
+int snapshot_run(struct snapshot *s, rockface_image_t *image, int image_fd, rockface_det_t *face,
+                 RgaSURF_FORMAT fmt, long int sec, char mark,
+                 snapshot_callback cb, const void *arg, size_t arg_size)
+{
+    struct snapshot_job *job;
+    int queued;
+
+    if (arg_size > SNAPSHOT_ARG_SIZE)
+        return -1;
+    job = snapshot_crop(s, image, image_fd, face, fmt, sec, mark, false);
+    if (!job)
+        return -1;
+
+    job->cb = cb;
+    if (arg_size)
+        memcpy(job->arg, arg, arg_size);
 
-    vpu_encode_jpeg_done(&s->enc);
+    pthread_mutex_lock(&g_snap_lock);
+    frame_ring_push(&g_snap_ready, job);
+    queued = frame_ring_count(&g_snap_ready);
+    if (queued > g_snap_max_queued)
+        __atomic_store_n(&g_snap_max_queued, queued, __ATOMIC_RELAXED);
+    pthread_cond_signal(&g_snap_cond);
+    pthread_mutex_unlock(&g_snap_lock);
     return 0;
 }
+
+/* the whole image to s->name on the calling thread, waits for a buffer rather than drop */
+int snapshot_save(struct snapshot *s, rockface_image_t *image, int image_fd, RgaSURF_FORMAT fmt)
+{
+    struct snapshot_job *job;
+    int ret;
+
+    job = snapshot_crop(s, image, image_fd, NULL, fmt, 0, 0, true);
+    if (!job)
+        return -1;
+
+    pthread_mutex_lock(&g_snap_write_lock);
+    ret = snapshot_write(job);
+    pthread_mutex_unlock(&g_snap_write_lock);
+    if (ret)
+        __atomic_add_fetch(&g_snap_failed, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_add_fetch(&g_snap_written, 1, __ATOMIC_RELAXED);
+    snapshot_job_free(job);
+    return ret;
+}
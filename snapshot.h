@@ -37,27 +37,30 @@
 extern "C" {
 #endif
 
-#include "vpu_encode.h"
+#include <sys/time.h>
+
 #include "rga_control.h"
 #include "video_common.h"
 #include <rockface/rockface.h>
 
+#define SNAPSHOT_QUEUE_DEPTH 4
+#define SNAPSHOT_ARG_SIZE 128
+
+/* called on the writer thread once the file is written, arg is a copy */
+typedef void (*snapshot_callback)(const char *name, void *arg);
+
 struct snapshot {
-    struct vpu_encode enc;
-    bo_t nv12_bo;
-    int nv12_fd;
-    bo_t enc_bo;
-    int enc_fd;
-    int size;
     char name[NAME_LEN];
     struct timeval t0;
     struct timeval t1;
 };
 
-int snapshot_init(struct snapshot *s, int w, int h);
-void snapshot_exit(struct snapshot *s);
-int snapshot_run(struct snapshot *s, rockface_image_t *image, rockface_det_t *face,
-                 RgaSURF_FORMAT fmt, long int sec, char mark);
+int snapshot_init(void);
+void snapshot_exit(void);
+int snapshot_run(struct snapshot *s, rockface_image_t *image, int image_fd, rockface_det_t *face,
+                 RgaSURF_FORMAT fmt, long int sec, char mark,
+                 snapshot_callback cb, const void *arg, size_t arg_size);
+int snapshot_save(struct snapshot *s, rockface_image_t *image, int image_fd, RgaSURF_FORMAT fmt);
 void face_convert(rockface_det_t face, int *x, int *y, int *w, int *h, int width, int height);
 
 #ifdef __cplusplus
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "soft_jpeg.h"
+
+struct soft_jpeg_error {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jmp;
+};
+
+struct soft_jpeg {
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    struct soft_jpeg_error err;
+    unsigned char *line;
+    int line_size;
+};
+
+static void soft_jpeg_error_exit(j_common_ptr info)
+{
+    struct soft_jpeg_error *err = (struct soft_jpeg_error *)info->err;
+    char msg[JMSG_LENGTH_MAX];
+
+    info->err->format_message(info, msg);
+    printf("%s: %s\n", __func__, msg);
+    longjmp(err->jmp, 1);
+}
+
+struct soft_jpeg *soft_jpeg_create(void)
+{
+    struct soft_jpeg *j = (struct soft_jpeg *)calloc(1, sizeof(struct soft_jpeg));
+
+    if (!j)
+        return NULL;
+    j->dinfo.err = jpeg_std_error(&j->err.mgr);
+    j->cinfo.err = &j->err.mgr;
+    j->err.mgr.error_exit = soft_jpeg_error_exit;
+    jpeg_create_decompress(&j->dinfo);
+    jpeg_create_compress(&j->cinfo);
+    return j;
+}
+
+void soft_jpeg_destroy(struct soft_jpeg *j)
+{
+    if (!j)
+        return;
+    jpeg_destroy_decompress(&j->dinfo);
+    jpeg_destroy_compress(&j->cinfo);
+    free(j->line);
+    free(j);
+}
+
+static int soft_jpeg_line(struct soft_jpeg *j, int width)
+{
+    if (j->line_size >= width * 3)
+        return 0;
+    free(j->line);
+    j->line = (unsigned char *)malloc(width * 3);
+    j->line_size = j->line ? width * 3 : 0;
+    return j->line ? 0 : -1;
+}
+
+int soft_jpeg_decode(struct soft_jpeg *j, const void *data, size_t size, void *nv12,
+                     int hor_stride, int ver_stride)
+{
+    struct jpeg_decompress_struct *d = &j->dinfo;
+    unsigned char *y_plane = (unsigned char *)nv12;
+    unsigned char *uv_plane = y_plane + hor_stride * ver_stride;
+
+    if (setjmp(j->err.jmp)) {
+        jpeg_abort_decompress(d);
+        return -1;
+    }
+    j->err.mgr.num_warnings = 0;
+    jpeg_mem_src(d, (unsigned char *)data, size);
+    jpeg_read_header(d, TRUE);
+    d->out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(d);
+    if ((int)d->output_width > hor_stride || (int)d->output_height > ver_stride ||
+            d->output_components != 3 || soft_jpeg_line(j, d->output_width)) {
+        jpeg_abort_decompress(d);
+        return -1;
+    }
+    while (d->output_scanline < d->output_height) {
+        int y = d->output_scanline;
+        unsigned char *src = j->line;
+        unsigned char *dst = y_plane + y * hor_stride;
+        unsigned char *uv = uv_plane + (y / 2) * hor_stride;
+
+        jpeg_read_scanlines(d, &src, 1);
+        for (unsigned int x = 0; x < d->output_width; x++)
+            dst[x] = src[x * 3];
+        /* chroma of the even lines and columns */
+        if (!(y & 1)) {
+            for (unsigned int x = 0; x + 1 < d->output_width; x += 2) {
+                uv[x] = src[x * 3 + 1];
+                uv[x + 1] = src[x * 3 + 2];
+            }
+        }
+    }
+    jpeg_finish_decompress(d);
+    /* a truncated or corrupt stream only warns, fail it like the VPU does */
+    return j->err.mgr.num_warnings ? -1 : 0;
+}
+
+int soft_jpeg_encode(struct soft_jpeg *j, const void *nv12, int width, int height, int quality,
+                     void *dst, size_t dst_size, size_t *length)
+{
+    struct jpeg_compress_struct *c = &j->cinfo;
+    const unsigned char *y_plane = (const unsigned char *)nv12;
+    const unsigned char *uv_plane = y_plane + width * height;
+    unsigned char *out = NULL;
+    unsigned long out_size = 0;
+
+    *length = 0;
+    if (soft_jpeg_line(j, width))
+        return -1;
+    if (setjmp(j->err.jmp)) {
+        jpeg_abort_compress(c);
+        free(out);
+        return -1;
+    }
+    jpeg_mem_dest(c, &out, &out_size);
+    c->image_width = width;
+    c->image_height = height;
+    c->input_components = 3;
+    c->in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(c);
+    jpeg_set_quality(c, quality, TRUE);
+    jpeg_start_compress(c, TRUE);
+    while (c->next_scanline < c->image_height) {
+        int y = c->next_scanline;
+        const unsigned char *src = y_plane + y * width;
+        const unsigned char *uv = uv_plane + (y / 2) * width;
+        unsigned char *line = j->line;
+
+        for (int x = 0; x < width; x++) {
+            line[x * 3] = src[x];
+            line[x * 3 + 1] = uv[x & ~1];
+            line[x * 3 + 2] = uv[(x & ~1) + 1];
+        }
+        jpeg_write_scanlines(c, &line, 1);
+    }
+    jpeg_finish_compress(c);
+
+    if (out_size > dst_size) {
+        printf("%s: %lu bytes do not fit %zu\n", __func__, out_size, dst_size);
+        free(out);
+        return -1;
+    }
+    memcpy(dst, out, out_size);
+    *length = out_size;
+    free(out);
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2019 Rockchip Electronics Co., Ltd.
+ * author: Zhihua Wang, hogan.wang@rock-chips.com
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL), available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef __SOFT_JPEG_H__
+#define __SOFT_JPEG_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*
+ * libjpeg(-turbo) codec on the CPU with the buffer layout of the VPU one:
+ * decode to NV12 at 16 aligned strides, encode from NV12. One context
+ * handles any number of images.
+ */
+struct soft_jpeg;
+
+struct soft_jpeg *soft_jpeg_create(void);
+void soft_jpeg_destroy(struct soft_jpeg *j);
+int soft_jpeg_decode(struct soft_jpeg *j, const void *data, size_t size, void *nv12,
+                     int hor_stride, int ver_stride);
+int soft_jpeg_encode(struct soft_jpeg *j, const void *nv12, int width, int height, int quality,
+                     void *dst, size_t dst_size, size_t *length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
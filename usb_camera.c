@@ -41,21 +41,30 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <linux/videodev2.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include "usb_camera.h"
 #include "vpu_decode.h"
 #include "rga_control.h"
+#include "frame_mailbox.h"
+#include "frame_ring.h"
 #include "rockface_control.h"
 #include "video_common.h"
 #include "rkfacial.h"
 
 #define CAMERA_NUM 15
 #define BUFFER_COUNT 4
+/* raw capture has not been run on a camera yet, MJPEG unless set_usb_raw asks */
+#define USB_RAW_MIN_FPS 0
+/* the capture thread looks at g_run this often when the camera stalls */
+#define USB_POLL_MS 100
 
 struct map_buffer {
     void *start;
@@ -68,8 +77,31 @@ static int g_width, g_height;
 static bool g_run;
 static pthread_t g_th;
 static struct vpu_decode g_decode;
-static bo_t g_dec_bo;
-static int g_dec_fd = -1;
+static pthread_t g_convert_th;
+
+/*
+ * Decoded frames. The decode thread fills a free one (ref 0) and queues
+ * it to the convert thread, which hands it to display and drops its
+ * reference. Frame N + 1 is decoded while frame N is converted.
+ */
+#define DEC_BUF_NUM 4
+
+struct usb_buf {
+    bo_t bo;
+    int fd;
+    int index;
+    int id;
+};
+
+static struct usb_buf g_dec_buf[DEC_BUF_NUM];
+static struct mailbox_frame g_dec_frame[DEC_BUF_NUM];
+/* raw capture, the V4L2 buffers go to convert and display as they are */
+static struct usb_buf g_raw_buf[BUFFER_COUNT];
+static struct mailbox_frame g_raw_frame[BUFFER_COUNT];
+static int g_raw_fmt = -1;
+static struct frame_ring g_dec_ready;
+static pthread_mutex_t g_dec_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_dec_cond = PTHREAD_COND_INITIALIZER;
 
 static bool g_usb_en;
 static int g_usb_width;
@@ -77,6 +109,30 @@ static int g_usb_height;
 static display_callback g_display_cb = NULL;
 static pthread_mutex_t g_display_lock = PTHREAD_MUTEX_INITIALIZER;
 static int g_rotation = HAL_TRANSFORM_ROT_90;
+static int g_raw_min_fps = USB_RAW_MIN_FPS;
+static char g_usb_device[32];
+
+/* raw formats in order of preference, MJPEG is the fallback */
+static const struct {
+    unsigned int pixfmt;
+    int rga_fmt;
+    int bpp;
+} g_raw_fmts[] = {
+    { V4L2_PIX_FMT_NV12, RK_FORMAT_YCbCr_420_SP, 8 },
+    { V4L2_PIX_FMT_NV16, RK_FORMAT_YCbCr_422_SP, 8 },
+    { V4L2_PIX_FMT_YUYV, RK_FORMAT_YUYV_422, 16 },
+};
+#define RAW_FMT_NUM (sizeof(g_raw_fmts) / sizeof(g_raw_fmts[0]))
+
+void set_usb_raw(int min_fps)
+{
+    g_raw_min_fps = min_fps;
+}
+
+void set_usb_device(const char *dev)
+{
+    snprintf(g_usb_device, sizeof(g_usb_device), "%s", dev ? dev : "");
+}
 
 void set_usb_rotation(int angle)
 {
@@ -174,6 +230,10 @@ static int req_bufs(int fd, struct map_buffer *map_buf)
     int ret;
     struct v4l2_requestbuffers reqbuf;
 
+    for (i = 0; i < BUFFER_COUNT; i++) {
+        map_buf[i].start = NULL;
+        map_buf[i].length = 0;
+    }
     memset(&reqbuf, 0, sizeof(reqbuf));
     reqbuf.count = BUFFER_COUNT;
     reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -199,6 +259,7 @@ static int req_bufs(int fd, struct map_buffer *map_buf)
                 MAP_SHARED, fd, buf.m.offset);
         if (map_buf[i].start == MAP_FAILED) {
             perror("mmap");
+            map_buf[i].start = NULL;
             return -1;
         }
         ret = ioctl(fd, VIDIOC_QBUF, &buf);
@@ -210,16 +271,115 @@ static int req_bufs(int fd, struct map_buffer *map_buf)
     return 0;
 }
 
-static int set_fmt(int fd, int *width, int *height)
+static bool has_fmt(int fd, unsigned int pixfmt)
+{
+    struct v4l2_fmtdesc desc;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    while (!ioctl(fd, VIDIOC_ENUM_FMT, &desc)) {
+        if (desc.pixelformat == pixfmt)
+            return true;
+        desc.index++;
+    }
+    return false;
+}
+
+static bool has_size(int fd, unsigned int pixfmt, int width, int height)
+{
+    struct v4l2_frmsizeenum size;
+
+    memset(&size, 0, sizeof(size));
+    size.pixel_format = pixfmt;
+    while (!ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size)) {
+        if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            if (size.discrete.width == width && size.discrete.height == height)
+                return true;
+        } else {
+            struct v4l2_frmsize_stepwise *sw = &size.stepwise;
+            return width >= sw->min_width && width <= sw->max_width &&
+                   height >= sw->min_height && height <= sw->max_height &&
+                   (width - sw->min_width) % sw->step_width == 0 &&
+                   (height - sw->min_height) % sw->step_height == 0;
+        }
+        size.index++;
+    }
+    return false;
+}
+
+/* highest fps at the size, 0 when the driver does not tell */
+static int max_fps(int fd, unsigned int pixfmt, int width, int height,
+                   struct v4l2_fract *interval)
+{
+    struct v4l2_frmivalenum ival;
+    struct v4l2_fract *f;
+    int fps = 0;
+
+    memset(&ival, 0, sizeof(ival));
+    ival.pixel_format = pixfmt;
+    ival.width = width;
+    ival.height = height;
+    while (!ioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival)) {
+        f = ival.type == V4L2_FRMIVAL_TYPE_DISCRETE ? &ival.discrete : &ival.stepwise.min;
+        if (f->numerator && (int)(f->denominator / f->numerator) > fps) {
+            fps = f->denominator / f->numerator;
+            *interval = *f;
+        }
+        if (ival.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+            break;
+        ival.index++;
+    }
+    return fps;
+}
+
+/* index in g_raw_fmts of the raw format to use, -1 for MJPEG */
+static int choose_fmt(int fd, int width, int height, struct v4l2_fract *interval)
+{
+    int fps;
+
+    if (g_raw_min_fps <= 0)
+        return -1;
+    for (int i = 0; i < RAW_FMT_NUM; i++) {
+        unsigned int pixfmt = g_raw_fmts[i].pixfmt;
+
+        if (!has_fmt(fd, pixfmt) || !has_size(fd, pixfmt, width, height))
+            continue;
+        interval->numerator = 0;
+        fps = max_fps(fd, pixfmt, width, height, interval);
+        if (fps && fps < g_raw_min_fps) {
+            printf("%s: %.4s %dx%d only %d fps\n", __func__,
+                   (char *)&pixfmt, width, height, fps);
+            continue;
+        }
+        return i;
+    }
+    return -1;
+}
+
+static void set_interval(int fd, struct v4l2_fract *interval)
+{
+    struct v4l2_streamparm parm;
+
+    if (!interval->numerator)
+        return;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe = *interval;
+    if (ioctl(fd, VIDIOC_S_PARM, &parm) < 0)
+        perror("VIDIOC_S_PARM");
+}
+
+static int set_fmt(int fd, int *width, int *height, int raw)
 {
     int ret;
     struct v4l2_format fmt;
+    unsigned int pixfmt = raw < 0 ? V4L2_PIX_FMT_MJPEG : g_raw_fmts[raw].pixfmt;
 
     memset(&fmt, 0, sizeof(fmt));
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     fmt.fmt.pix.width = *width;
     fmt.fmt.pix.height = *height;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_MJPEG;
+    fmt.fmt.pix.pixelformat = pixfmt;
     ret = ioctl(fd, VIDIOC_S_FMT, &fmt);
     if (ret < 0) {
         perror("VIDIOC_S_FMT");
@@ -231,9 +391,20 @@ static int set_fmt(int fd, int *width, int *height)
         perror("VIDIOC_G_FMT");
         return -1;
     }
+    if (fmt.fmt.pix.pixelformat != pixfmt) {
+        printf("%s: %.4s not taken\n", __func__, (char *)&pixfmt);
+        return -1;
+    }
+    /* raw frames are used in place, so no line padding */
+    if (raw >= 0 && (fmt.fmt.pix.width != *width || fmt.fmt.pix.height != *height ||
+                     fmt.fmt.pix.bytesperline != *width * g_raw_fmts[raw].bpp / 8)) {
+        printf("%s: %.4s %dx%d stride %d not usable\n", __func__, (char *)&pixfmt,
+               fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.bytesperline);
+        return -1;
+    }
     *width = fmt.fmt.pix.width;
     *height = fmt.fmt.pix.height;
-    printf("%s: %dx%d\n", __func__, *width, *height);
+    printf("%s: %.4s %dx%d\n", __func__, (char *)&pixfmt, *width, *height);
     return 0;
 }
 
@@ -257,6 +428,14 @@ static int open_usb_camera(void)
     char name[32];
     int fd;
 
+    /* a fixed device skips the usb bus check, e.g. vivid for testing */
+    if (g_usb_device[0]) {
+        fd = open(g_usb_device, O_RDWR, 0);
+        if (fd < 0)
+            perror(g_usb_device);
+        return fd;
+    }
+
     for (i = 0; i < CAMERA_NUM; i++) {
         snprintf(name, sizeof(name), "/dev/video%d", i);
         if (stat(name, &st) == -1)
@@ -273,45 +452,240 @@ static int open_usb_camera(void)
     return -1;
 }
 
+static void dec_wait(void)
+{
+    struct timespec ts;
+
+    /* timed, a released frame only reaches ref 0 after its release hook */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 5 * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&g_dec_lock);
+    if (g_run)
+        pthread_cond_timedwait(&g_dec_cond, &g_dec_lock, &ts);
+    pthread_mutex_unlock(&g_dec_lock);
+}
+
+static void dec_frame_release(struct mailbox_frame *frame)
+{
+    pthread_mutex_lock(&g_dec_lock);
+    pthread_cond_broadcast(&g_dec_cond);
+    pthread_mutex_unlock(&g_dec_lock);
+}
+
+/* a free frame, or the oldest one not yet converted when convert lags */
+static struct mailbox_frame *dec_get_frame(void)
+{
+    struct mailbox_frame *frame;
+
+    while (g_run) {
+        frame = mailbox_frame_alloc(g_dec_frame, DEC_BUF_NUM);
+        if (frame)
+            return frame;
+        frame = (struct mailbox_frame *)frame_ring_pop(&g_dec_ready);
+        if (frame)
+            return frame;
+        dec_wait();
+    }
+
+    return NULL;
+}
+
+static void raw_frame_release(struct mailbox_frame *frame)
+{
+    struct usb_buf *raw = (struct usb_buf *)frame->priv;
+    struct v4l2_buffer buf;
+
+    if (!g_run)
+        return;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = raw->index;
+    qbuf(g_fd, &buf);
+}
+
+/* queue a raw frame, stale ones go back to the camera first */
+static void raw_queue(struct v4l2_buffer *buf, int id)
+{
+    struct mailbox_frame *frame = &g_raw_frame[buf->index];
+    struct mailbox_frame *old;
+    int ref = 0;
+
+    while ((old = (struct mailbox_frame *)frame_ring_pop(&g_dec_ready)))
+        mailbox_frame_put(old);
+
+    /* the last put qbufs the buffer before it stores ref 0, wait for that store */
+    while (!__atomic_compare_exchange_n(&frame->ref, &ref, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        ref = 0;
+        sched_yield();
+    }
+    g_raw_buf[buf->index].id = id;
+    frame->rotation = g_rotation;
+    frame_ring_push(&g_dec_ready, frame);
+    pthread_mutex_lock(&g_dec_lock);
+    pthread_cond_broadcast(&g_dec_cond);
+    pthread_mutex_unlock(&g_dec_lock);
+}
+
+static void raw_bufs_init(int width, int height)
+{
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        struct mailbox_frame *frame = &g_raw_frame[i];
+
+        memset(&g_raw_buf[i], 0, sizeof(struct usb_buf));
+        g_raw_buf[i].index = i;
+        memset(frame, 0, sizeof(*frame));
+        frame->ptr = g_map_buf[i].start;
+        /* uvc buffers are vmalloc, let rga take the virtual address */
+        frame->fd = -1;
+        frame->fmt = g_raw_fmts[g_raw_fmt].rga_fmt;
+        frame->width = width;
+        frame->height = height;
+        frame->release = raw_frame_release;
+        frame->priv = &g_raw_buf[i];
+    }
+}
+
+static int decode(struct v4l2_buffer *buf, struct usb_buf *dec)
+{
+    struct map_buffer *map = &g_map_buf[buf->index];
+
+    /*
+     * uvcvideo fills vmalloc buffers with the CPU and nothing makes them
+     * coherent for the VPU, so the mjpeg data is copied rather than the
+     * exported buffer imported
+     */
+    return vpu_decode_jpeg_doing(&g_decode, map->start, buf->bytesused,
+                                 dec->fd, dec->bo.ptr);
+}
+
 static void *process(void *arg)
 {
     struct v4l2_buffer buf;
-    rga_info_t src, dst;
+    struct mailbox_frame *frame;
+    struct usb_buf *dec;
+    struct pollfd pfd;
     int id = 0;
-    RgaSURF_FORMAT fmt;
+    int ret;
 
     memset(&buf, 0, sizeof(buf));
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buf.memory = V4L2_MEMORY_MMAP;
+    pfd.fd = g_fd;
+    pfd.events = POLLIN;
     while (g_run) {
+        /* no blocking dqbuf, exit stops the stream only after this thread is gone */
+        ret = poll(&pfd, 1, USB_POLL_MS);
+        if (ret < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        if (ret <= 0)
+            continue;
         id++;
         if (dqbuf(g_fd, &buf))
             break;
 
-        vpu_decode_jpeg_doing(&g_decode, g_map_buf[buf.index].start, buf.bytesused,
-                              g_dec_fd, g_dec_bo.ptr);
+        if (g_raw_fmt >= 0) {
+            raw_queue(&buf, id);
+            continue;
+        }
+
+        frame = dec_get_frame();
+        if (!frame) {
+            qbuf(g_fd, &buf);
+            break;
+        }
+        dec = (struct usb_buf *)frame->priv;
+        ret = decode(&buf, dec);
+        if (qbuf(g_fd, &buf)) {
+            mailbox_frame_put(frame);
+            break;
+        }
+        if (ret) {
+            mailbox_frame_put(frame);
+            continue;
+        }
 
-        fmt = (g_decode.fmt == MPP_FMT_YUV422SP ? RK_FORMAT_YCbCr_422_SP : RK_FORMAT_YCbCr_420_SP);
-        if (!rockface_control_convert_detect(g_dec_bo.ptr, g_width, g_height, fmt, g_rotation, id))
-            rockface_control_convert_feature(g_dec_bo.ptr, g_width, g_height, fmt, g_rotation, id);
+        dec->id = id;
+        frame->fmt = (g_decode.fmt == MPP_FMT_YUV422SP ? RK_FORMAT_YCbCr_422_SP : RK_FORMAT_YCbCr_420_SP);
+        frame->rotation = g_rotation;
+        frame_ring_push(&g_dec_ready, frame);
+        pthread_mutex_lock(&g_dec_lock);
+        pthread_cond_broadcast(&g_dec_cond);
+        pthread_mutex_unlock(&g_dec_lock);
+    }
+
+    pthread_exit(NULL);
+}
+
+static void *convert_process(void *arg)
+{
+    struct mailbox_frame *frame;
+    struct usb_buf *dec;
+
+    while (g_run) {
+        frame = (struct mailbox_frame *)frame_ring_pop(&g_dec_ready);
+        if (!frame) {
+            dec_wait();
+            continue;
+        }
+        dec = (struct usb_buf *)frame->priv;
+
+        rockface_control_convert(frame->ptr, frame->fd, frame->width, frame->height,
+                                 frame->fmt, frame->rotation, dec->id);
 
         pthread_mutex_lock(&g_display_lock);
         if (g_display_cb)
-            g_display_cb(g_dec_bo.ptr, g_dec_fd, fmt,
-                    g_width, g_height, g_rotation);
+            frame_mailbox_post(frame, g_display_cb);
         pthread_mutex_unlock(&g_display_lock);
 
-        if (qbuf(g_fd, &buf))
-            break;
+        mailbox_frame_put(frame);
     }
 
     pthread_exit(NULL);
 }
 
+static void dec_bufs_deinit(void)
+{
+    for (int i = 0; i < DEC_BUF_NUM; i++) {
+        if (g_dec_buf[i].bo.ptr)
+            rga_control_buffer_deinit(&g_dec_buf[i].bo, g_dec_buf[i].fd);
+        memset(&g_dec_buf[i], 0, sizeof(struct usb_buf));
+        g_dec_buf[i].fd = -1;
+    }
+}
+
+static int dec_bufs_init(int width, int height)
+{
+    for (int i = 0; i < DEC_BUF_NUM; i++) {
+        struct mailbox_frame *frame = &g_dec_frame[i];
+
+        if (rga_control_buffer_init(&g_dec_buf[i].bo, &g_dec_buf[i].fd, width, height, 16)) {
+            dec_bufs_deinit();
+            return -1;
+        }
+        memset(frame, 0, sizeof(*frame));
+        frame->ptr = g_dec_buf[i].bo.ptr;
+        frame->fd = g_dec_buf[i].fd;
+        frame->width = width;
+        frame->height = height;
+        frame->release = dec_frame_release;
+        frame->priv = &g_dec_buf[i];
+    }
+
+    return 0;
+}
+
 int usb_camera_init(void)
 {
     int width = g_usb_width;
     int height = g_usb_height;
+    struct v4l2_fract interval;
     if (!g_usb_en)
         return 0;
 
@@ -320,10 +694,18 @@ int usb_camera_init(void)
         printf("%s: %d exit!\n", __func__, __LINE__);
         return -1;
     }
-    if (set_fmt(g_fd, &width, &height)) {
+    g_raw_fmt = choose_fmt(g_fd, width, height, &interval);
+    if (g_raw_fmt >= 0 && set_fmt(g_fd, &width, &height, g_raw_fmt)) {
+        width = g_usb_width;
+        height = g_usb_height;
+        g_raw_fmt = -1;
+    }
+    if (g_raw_fmt < 0 && set_fmt(g_fd, &width, &height, -1)) {
         printf("%s: %d exit!\n", __func__, __LINE__);
         return -1;
     }
+    if (g_raw_fmt >= 0)
+        set_interval(g_fd, &interval);
     if (req_bufs(g_fd, g_map_buf)) {
         printf("%s: %d exit!\n", __func__, __LINE__);
         return -1;
@@ -333,14 +715,23 @@ int usb_camera_init(void)
         return -1;
     }
 
-    if (rga_control_buffer_init(&g_dec_bo, &g_dec_fd, width, height, 16)) {
+    if (frame_ring_init(&g_dec_ready, BUFFER_COUNT > DEC_BUF_NUM ? BUFFER_COUNT : DEC_BUF_NUM)) {
         printf("%s: %d exit!\n", __func__, __LINE__);
         return -1;
     }
 
-    if (vpu_decode_jpeg_init(&g_decode, width, height)) {
-        printf("%s: %d exit!\n", __func__, __LINE__);
-        return -1;
+    if (g_raw_fmt >= 0) {
+        raw_bufs_init(width, height);
+    } else {
+        if (dec_bufs_init(width, height)) {
+            printf("%s: %d exit!\n", __func__, __LINE__);
+            return -1;
+        }
+
+        if (vpu_decode_jpeg_init(&g_decode, width, height)) {
+            printf("%s: %d exit!\n", __func__, __LINE__);
+            return -1;
+        }
     }
 
     g_width = width;
@@ -351,24 +742,45 @@ int usb_camera_init(void)
         printf("%s: %d exit!\n", __func__, __LINE__);
         return -1;
     }
+    if (pthread_create(&g_convert_th, NULL, convert_process, NULL)) {
+        printf("%s: %d exit!\n", __func__, __LINE__);
+        return -1;
+    }
 
     return 0;
 }
 
 void usb_camera_exit(void)
 {
+    struct mailbox_frame *frame;
+
     if (!g_usb_en)
         return;
 
     g_run = false;
-    stream_off(g_fd);
-    free_bufs(g_map_buf);
-    close(g_fd);
-
+    pthread_mutex_lock(&g_dec_lock);
+    pthread_cond_broadcast(&g_dec_cond);
+    pthread_mutex_unlock(&g_dec_lock);
     if (g_th) {
         pthread_join(g_th, NULL);
         g_th = 0;
     }
-    vpu_decode_jpeg_done(&g_decode);
-    rga_control_buffer_deinit(&g_dec_bo, g_dec_fd);
+    if (g_convert_th) {
+        pthread_join(g_convert_th, NULL);
+        g_convert_th = 0;
+    }
+    frame_mailbox_flush();
+    while ((frame = (struct mailbox_frame *)frame_ring_pop(&g_dec_ready)))
+        mailbox_frame_put(frame);
+    if (g_raw_fmt < 0) {
+        vpu_decode_jpeg_done(&g_decode);
+        dec_bufs_deinit();
+    }
+
+    /* nothing holds a V4L2 buffer any more */
+    stream_off(g_fd);
+    free_bufs(g_map_buf);
+    close(g_fd);
+    g_fd = -1;
+    frame_ring_deinit(&g_dec_ready);
 }
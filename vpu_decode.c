@@ -34,12 +34,15 @@
 #include <assert.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <stdbool.h>
 
 int vpu_decode_jpeg_init(struct vpu_decode* decode, int width, int height)
 {
     int ret;
     decode->in_width = width;
     decode->in_height = height;
+    decode->frame = NULL;
+    decode->import_cnt = 0;
 
     ret = mpp_buffer_group_get_internal(&decode->memGroup, MPP_BUFFER_TYPE_ION);
     if (MPP_OK != ret) {
@@ -77,95 +80,41 @@ int vpu_decode_jpeg_init(struct vpu_decode* decode, int width, int height)
     ret = mpi->control(mpp_ctx, MPP_DEC_SET_FRAME_INFO, (MppParam)frame);
     mpp_frame_deinit(&frame);
 
+    /* output frame reused by every decode */
+    ret = mpp_frame_init(&decode->frame);
+    if (MPP_OK != ret) {
+        printf("mpp_frame_init failed\n");
+        return ret;
+    }
+
+    decode->hor_stride = MPP_ALIGN(width, 16);
+    decode->ver_stride = MPP_ALIGN(height, 16);
+
     return 0;
 }
 
-int vpu_decode_jpeg_doing(struct vpu_decode* decode, void* in_data, RK_S32 in_size,
-                          int out_fd, void* out_data)
+/* decode packet into pic_buf through the task interface */
+static MPP_RET vpu_decode_run(struct vpu_decode* decode, MppPacket packet, MppBuffer pic_buf)
 {
     MPP_RET ret = MPP_OK;
     MppTask task = NULL;
-
-    decode->pkt_size = in_size;
-    if (decode->pkt_size <= 0) {
-        printf("invalid input size %d\n", decode->pkt_size);
-        return MPP_ERR_UNKNOW;
-    }
-
-    if (NULL == in_data) {
-        ret = MPP_ERR_NULL_PTR;
-        goto DECODE_OUT;
-    }
-
-    /* try import input buffer and output buffer */
-    RK_U32 width = decode->in_width;
-    RK_U32 height = decode->in_height;
-    RK_U32 hor_stride = MPP_ALIGN(width, 16);
-    RK_U32 ver_stride = MPP_ALIGN(height, 16);
-    decode->hor_stride = hor_stride;
-    decode->ver_stride = ver_stride;
-    MppFrame frame = NULL;
-    MppPacket packet = NULL;
-    MppBuffer str_buf = NULL; /* input */
-    MppBuffer pic_buf = NULL; /* output */
+    MppFrame frame = decode->frame;
     MppCtx mpp_ctx = decode->mpp_ctx;
     MppApi* mpi = decode->mpi;
 
-    ret = mpp_frame_init(&frame);
-    if (MPP_OK != ret) {
-        printf("mpp_frame_init failed\n");
-        goto DECODE_OUT;
-    }
-
-    ret = mpp_buffer_get(decode->memGroup, &str_buf, decode->pkt_size);
-    if (ret) {
-        printf("allocate input picture buffer failed\n");
-        goto DECODE_OUT;
-    }
-    memcpy((RK_U8*)mpp_buffer_get_ptr(str_buf), in_data, decode->pkt_size);
-
-    if (out_fd > 0) {
-        MppBufferInfo outputCommit;
-
-        memset(&outputCommit, 0, sizeof(outputCommit));
-        /* in order to avoid interface change use space in output to transmit
-         * information */
-        outputCommit.type = MPP_BUFFER_TYPE_ION;
-        outputCommit.fd = out_fd;
-        outputCommit.size = hor_stride * ver_stride * 2;
-        outputCommit.ptr = out_data;
-
-        ret = mpp_buffer_import(&pic_buf, &outputCommit);
-        if (ret) {
-            printf("import output stream buffer failed\n");
-            goto DECODE_OUT;
-        }
-    } else {
-        ret =
-            mpp_buffer_get(decode->memGroup, &pic_buf, hor_stride * ver_stride * 2);
-        if (ret) {
-            printf("allocate output stream buffer failed\n");
-            goto DECODE_OUT;
-        }
-    }
-
-    mpp_packet_init_with_buffer(&packet, str_buf); /* input */
-    mpp_frame_set_buffer(frame, pic_buf);          /* output */
-    mpp_packet_set_length(packet, decode->pkt_size);
-
-    // printf("mpp import input fd %d output fd %d\n",
-    //        mpp_buffer_get_fd(str_buf), mpp_buffer_get_fd(pic_buf));
+    mpp_frame_set_buffer(frame, pic_buf);
+    mpp_frame_set_errinfo(frame, 0);
 
     ret = mpi->poll(mpp_ctx, MPP_PORT_INPUT, MPP_POLL_BLOCK);
     if (ret) {
         printf("mpp input poll failed\n");
-        goto DECODE_OUT;
+        return ret;
     }
 
     ret = mpi->dequeue(mpp_ctx, MPP_PORT_INPUT, &task); /* input queue */
     if (ret) {
         printf("mpp task input dequeue failed\n");
-        goto DECODE_OUT;
+        return ret;
     }
 
     assert(task);
@@ -176,20 +125,20 @@ int vpu_decode_jpeg_doing(struct vpu_decode* decode, void* in_data, RK_S32 in_si
     ret = mpi->enqueue(mpp_ctx, MPP_PORT_INPUT, task); /* input queue */
     if (ret) {
         printf("mpp task input enqueue failed\n");
-        goto DECODE_OUT;
+        return ret;
     }
 
     /* poll and wait here */
     ret = mpi->poll(mpp_ctx, MPP_PORT_OUTPUT, MPP_POLL_BLOCK);
     if (ret) {
         printf("mpp output poll failed\n");
-        goto DECODE_OUT;
+        return ret;
     }
 
     ret = mpi->dequeue(mpp_ctx, MPP_PORT_OUTPUT, &task); /* output queue */
     if (ret) {
         printf("mpp task output dequeue failed\n");
-        goto DECODE_OUT;
+        return ret;
     }
 
     assert(task);
@@ -212,7 +161,7 @@ int vpu_decode_jpeg_doing(struct vpu_decode* decode, void* in_data, RK_S32 in_si
         ret = mpi->enqueue(mpp_ctx, MPP_PORT_OUTPUT, task);
         if (ret) {
             printf("mpp task output enqueue failed\n");
-            goto DECODE_OUT;
+            return ret;
         }
         task = NULL;
 
@@ -222,6 +171,69 @@ int vpu_decode_jpeg_doing(struct vpu_decode* decode, void* in_data, RK_S32 in_si
             ret = MPP_NOK;
     }
 
+    return ret;
+}
+
+int vpu_decode_jpeg_doing(struct vpu_decode* decode, void* in_data, RK_S32 in_size,
+                          int out_fd, void* out_data)
+{
+    MPP_RET ret = MPP_OK;
+    MppPacket packet = NULL;
+    MppBuffer str_buf = NULL; /* input */
+    MppBuffer pic_buf = NULL; /* output */
+
+    decode->pkt_size = in_size;
+    if (decode->pkt_size <= 0) {
+        printf("invalid input size %d\n", decode->pkt_size);
+        return MPP_ERR_UNKNOW;
+    }
+
+    if (NULL == in_data) {
+        ret = MPP_ERR_NULL_PTR;
+        goto DECODE_OUT;
+    }
+
+    /* try import input buffer and output buffer */
+    RK_U32 hor_stride = decode->hor_stride;
+    RK_U32 ver_stride = decode->ver_stride;
+
+    ret = mpp_buffer_get(decode->memGroup, &str_buf, decode->pkt_size);
+    if (ret) {
+        printf("allocate input picture buffer failed\n");
+        goto DECODE_OUT;
+    }
+    memcpy((RK_U8*)mpp_buffer_get_ptr(str_buf), in_data, decode->pkt_size);
+
+    if (out_fd > 0) {
+        MppBufferInfo outputCommit;
+
+        memset(&outputCommit, 0, sizeof(outputCommit));
+        /* in order to avoid interface change use space in output to transmit
+         * information */
+        outputCommit.type = MPP_BUFFER_TYPE_ION;
+        outputCommit.fd = out_fd;
+        outputCommit.size = hor_stride * ver_stride * 2;
+        outputCommit.ptr = out_data;
+
+        ret = mpp_buffer_import(&pic_buf, &outputCommit);
+        if (ret) {
+            printf("import output stream buffer failed\n");
+            goto DECODE_OUT;
+        }
+    } else {
+        ret =
+            mpp_buffer_get(decode->memGroup, &pic_buf, hor_stride * ver_stride * 2);
+        if (ret) {
+            printf("allocate output stream buffer failed\n");
+            goto DECODE_OUT;
+        }
+    }
+
+    mpp_packet_init_with_buffer(&packet, str_buf); /* input */
+    mpp_packet_set_length(packet, decode->pkt_size);
+
+    ret = vpu_decode_run(decode, packet, pic_buf);
+
 DECODE_OUT:
     if (str_buf) {
         mpp_buffer_put(str_buf);
@@ -233,15 +245,84 @@ DECODE_OUT:
         pic_buf = NULL;
     }
 
-    if (frame)
-        mpp_frame_deinit(&frame);
-
     if (packet)
         mpp_packet_deinit(&packet);
 
     return ret;
 }
 
+static struct vpu_decode_import *vpu_decode_import(struct vpu_decode* decode, int fd,
+                                                   void* ptr, size_t size, bool input)
+{
+    struct vpu_decode_import *import;
+    MppBufferInfo info;
+    MPP_RET ret;
+
+    for (int i = 0; i < decode->import_cnt; i++) {
+        if (decode->import[i].fd == fd)
+            return &decode->import[i];
+    }
+    if (decode->import_cnt >= VPU_DECODE_IMPORT_NUM) {
+        printf("%s: too many imported buffers\n", __func__);
+        return NULL;
+    }
+
+    import = &decode->import[decode->import_cnt];
+    memset(import, 0, sizeof(*import));
+    memset(&info, 0, sizeof(info));
+    info.type = MPP_BUFFER_TYPE_ION;
+    info.fd = fd;
+    info.size = size;
+    info.ptr = ptr;
+    ret = mpp_buffer_import(&import->buf, &info);
+    if (ret) {
+        printf("%s: import fd %d failed\n", __func__, fd);
+        return NULL;
+    }
+    if (input) {
+        ret = mpp_packet_init_with_buffer(&import->packet, import->buf);
+        if (ret) {
+            printf("%s: packet init failed\n", __func__);
+            mpp_buffer_put(import->buf);
+            return NULL;
+        }
+    }
+    import->fd = fd;
+    decode->import_cnt++;
+
+    return import;
+}
+
+/*
+ * Decode straight from a dma-buf, e.g. a V4L2 buffer exported with
+ * VIDIOC_EXPBUF, into a dma-buf output. Both are imported on first use
+ * and stay imported, so the fds must live until vpu_decode_jpeg_done.
+ * MPP_ERR_VALUE means a buffer could not be imported, the caller should
+ * fall back to vpu_decode_jpeg_doing.
+ */
+int vpu_decode_jpeg_doing_fd(struct vpu_decode* decode, int in_fd, void* in_data,
+                             size_t in_len, RK_S32 in_size, int out_fd, void* out_data)
+{
+    struct vpu_decode_import *in, *out;
+
+    if (in_size <= 0 || in_fd < 0 || out_fd < 0) {
+        printf("invalid input size %d fd %d/%d\n", in_size, in_fd, out_fd);
+        return MPP_ERR_UNKNOW;
+    }
+    decode->pkt_size = in_size;
+
+    in = vpu_decode_import(decode, in_fd, in_data, in_len, true);
+    out = vpu_decode_import(decode, out_fd, out_data,
+                            decode->hor_stride * decode->ver_stride * 2, false);
+    if (!in || !out)
+        return MPP_ERR_VALUE;
+
+    mpp_packet_set_pos(in->packet, mpp_buffer_get_ptr(in->buf));
+    mpp_packet_set_length(in->packet, in_size);
+
+    return vpu_decode_run(decode, in->packet, out->buf);
+}
+
 int vpu_decode_jpeg_done(struct vpu_decode* decode)
 {
     MPP_RET ret = MPP_OK;
@@ -250,6 +331,16 @@ int vpu_decode_jpeg_done(struct vpu_decode* decode)
         printf("something wrong with mpp_destroy! ret:%d\n", ret);
     }
 
+    for (int i = 0; i < decode->import_cnt; i++) {
+        if (decode->import[i].packet)
+            mpp_packet_deinit(&decode->import[i].packet);
+        mpp_buffer_put(decode->import[i].buf);
+    }
+    decode->import_cnt = 0;
+
+    if (decode->frame)
+        mpp_frame_deinit(&decode->frame);
+
     if (decode->memGroup) {
         mpp_buffer_group_put(decode->memGroup);
         decode->memGroup = NULL;
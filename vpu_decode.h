@@ -41,6 +41,15 @@
 
 #define MPP_ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
 
+#define VPU_DECODE_IMPORT_NUM 8
+
+/* dma-buf imported once and kept until vpu_decode_jpeg_done */
+struct vpu_decode_import {
+    int fd;
+    MppBuffer buf;
+    MppPacket packet;
+};
+
 struct vpu_decode {
     int in_width;
     int in_height;
@@ -51,6 +60,9 @@ struct vpu_decode {
     MppApi* mpi;
     MppBufferGroup memGroup;
     MppFrameFormat fmt;
+    MppFrame frame;
+    struct vpu_decode_import import[VPU_DECODE_IMPORT_NUM];
+    int import_cnt;
 };
 
 #ifdef __cplusplus
@@ -60,6 +72,13 @@ extern "C" {
 int vpu_decode_jpeg_init(struct vpu_decode* decode, int width, int height);
 int vpu_decode_jpeg_doing(struct vpu_decode* decode, void* in_data, RK_S32 in_size,
                           int out_fd, void* out_data);
+/*
+ * decode straight from a dma-buf, imported on first use; the buffer must be
+ * coherent for the VPU, CPU-filled ones such as uvc buffers go through the
+ * copy in vpu_decode_jpeg_doing
+ */
+int vpu_decode_jpeg_doing_fd(struct vpu_decode* decode, int in_fd, void* in_data,
+                             size_t in_len, RK_S32 in_size, int out_fd, void* out_data);
 int vpu_decode_jpeg_done(struct vpu_decode* decode);
 
 #ifdef __cplusplus